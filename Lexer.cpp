@@ -3,6 +3,9 @@
 #include "Lexer.hpp"
 
 #include <cassert>
+#include <cerrno>
+#include <cstdlib>
+#include <iterator>
 
 #include "utility.hpp"
 
@@ -10,11 +13,13 @@ void Lexer::newline(std::string&& line)
 {
 	line_ = std::istringstream{std::move(line)};
 	last_ = ' ';
+	offset_ = 0;
 }
 
 char Lexer::next()
 {
 	last_token_ = peek();
+	column_ = peeked_column_;
 	peeked_ = Token::invalid;
 	return last_token_;
 }
@@ -28,7 +33,8 @@ char Lexer::peek()
 		return peeked_ = Token::eof;
 
 	while (std::isspace(last_))
-		last_ = static_cast<char>(line_.get());
+		last_ = get_();
+	peeked_column_ = offset_;
 
 	if (last_ == decltype(line_)::traits_type::eof())
 		return peeked_ = Token::eof;
@@ -39,14 +45,22 @@ char Lexer::peek()
 		bool decimal{last_ == '.'};
 		bool exp{false};
 		bool exp_sign{false};
+		// Malformed numbers are read to their end, so that lexing resumes after them.
+		bool valid{true};
 		do
 		{
 			str_num += last_;
-			last_ = static_cast<char>(line_.get());
+			last_ = get_();
 			if (last_ == '.')
-				decimal = decimal || exp ? throw InvalidInput{"Wrong number format"} : true;
+			{
+				valid = valid && !decimal && !exp;
+				decimal = true;
+			}
 			if (last_ == 'e')
-				exp = exp ? throw InvalidInput{"Wrong number format"} : true;
+			{
+				valid = valid && !exp;
+				exp = true;
+			}
 			if (last_ == '+' || last_ == '-')
 			{
 				if (!exp || exp_sign)
@@ -54,14 +68,11 @@ char Lexer::peek()
 				exp_sign = true;
 			}
 		} while (std::isdigit(last_) || is_in(last_, {'.', 'e', '+', '-'}));
-		try
-		{
-			number_ = stod(str_num);
-		}
-		catch (std::logic_error const&)
-		{
-			throw InvalidInput{"Wrong number format"};
-		}
+		char* end{nullptr};
+		errno = 0;
+		number_ = std::strtod(str_num.c_str(), &end);
+		if (!valid || end == str_num.c_str() || errno == ERANGE)
+			return peeked_ = Token::error;
 		return peeked_ = Token::number;
 	}
 	if (std::isalpha(last_))
@@ -70,16 +81,37 @@ char Lexer::peek()
 		do
 		{
 			identifier_ += last_;
-			last_ = static_cast<char>(line_.get());
+			last_ = get_();
 		}
 		while (std::isalnum(last_));
 		return peeked_ = Token::identifier;
 	}
 	peeked_ = last_;
-	last_ = static_cast<char>(line_.get());
+	last_ = get_();
+	if (last_ == '=')
+	{
+		auto comparison = peeked_ == '<' ? Token::less_equal : peeked_ == '>' ? Token::greater_equal :
+		                  peeked_ == '=' ? Token::equal : peeked_ == '!' ? Token::not_equal : Token::invalid;
+		if (comparison != Token::invalid)
+		{
+			peeked_ = comparison;
+			last_ = get_();
+		}
+	}
 	return peeked_;
 }
 
+std::string Lexer::remaining()
+{
+	assert(peeked_ == Token::invalid);
+	std::string rest{};
+	if (!line_.eof())
+		rest += last_;
+	rest.append(std::istreambuf_iterator<char>{line_}, std::istreambuf_iterator<char>{});
+	line_.setstate(std::ios::eofbit);
+	return rest;
+}
+
 double Lexer::number() const
 {
 	assert(last_token_ == Token::number);
@@ -96,3 +128,14 @@ bool Lexer::is_valid() const
 {
 	return line_.good();
 }
+
+std::size_t Lexer::column() const
+{
+	return column_;
+}
+
+char Lexer::get_()
+{
+	++offset_;
+	return static_cast<char>(line_.get());
+}
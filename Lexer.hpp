@@ -13,14 +13,22 @@ namespace Token
 		number = -2,
 		identifier = -3,
 		
-		invalid = -4
+		invalid = -4,
+		// Malformed number.
+		error = -5,
+		// Comparisons of two characters.
+		less_equal = -6,
+		greater_equal = -7,
+		equal = -8,
+		not_equal = -9
 	};
 }
 
 class Lexer
 {
 	public:
-	Lexer() : line_{}, number_{0.0}, last_{'\0'}, last_token_{Token::eof}, peeked_{Token::invalid}
+	Lexer() : line_{}, number_{0.0}, last_{'\0'}, last_token_{Token::eof}, peeked_{Token::invalid}, offset_{0},
+	          column_{0}, peeked_column_{0}
 	{}
 
 	Lexer(Lexer const&) = delete;
@@ -36,17 +44,28 @@ class Lexer
 	char next();
 	char peek();
 
+	// Consumes the rest of the line and returns it unlexed.
+	std::string remaining();
+
 	double number() const;
 	std::string identifier() const;
 	bool is_valid() const;
 
+	// Column of the last token in the line, starting at 1.
+	std::size_t column() const;
+
 	private:
+	char get_();
+
 	std::istringstream line_;
 	double number_;
 	std::string identifier_;
 	char last_;
 	char last_token_;
 	char peeked_;
+	std::size_t offset_;
+	std::size_t column_;
+	std::size_t peeked_column_;
 };
 
 #endif // Header guard
@@ -2,166 +2,596 @@
 
 #include "Parser.hpp"
 
+#include <cassert>
+#include <cstring>
 #include <iostream>
 
 #include "Lexer.hpp"
 #include "syntax_tree.hpp"
 
-static std::vector<char> unary_operators{'-'};
+using namespace std::string_literals;
 
-static std::map<char, OpCarac> binary_operators
-	{{'=', {5, Associativity::right}},
-	 {'+', {10, Associativity::left}},
-	 {'-', {10, Associativity::left}},
-	 {'*', {20, Associativity::left}},
-	 {'/', {20, Associativity::left}},
-	 {'%', {20, Associativity::left}},
-	 {'^', {30, Associativity::right}}};
+namespace
+{
+
+// Unary operators bind tighter than every binary operator.
+int const unary_precedence{40};
+
+char const user_symbols[] = "&|<>@$#~?";
+
+constexpr std::size_t index(char c)
+{
+	return static_cast<unsigned char>(c);
+}
+
+constexpr OperatorTable builtin_operators()
+{
+	OperatorTable table{};
+	for (auto& elem : table.binary)
+	{
+		elem.precedence = -1;
+		elem.associativity = Associativity::unknown;
+	}
+	table.binary[index('=')] = OpCarac{5, Associativity::right};
+	// < and > can be redefined by the user.
+	for (auto op : {'<', '>', char(Token::less_equal), char(Token::greater_equal), char(Token::equal),
+	                char(Token::not_equal)})
+		table.binary[index(op)] = OpCarac{8, Associativity::left};
+	table.binary[index('+')] = OpCarac{10, Associativity::left};
+	table.binary[index('-')] = OpCarac{10, Associativity::left};
+	table.binary[index('*')] = OpCarac{20, Associativity::left};
+	table.binary[index('/')] = OpCarac{20, Associativity::left};
+	table.binary[index('%')] = OpCarac{20, Associativity::left};
+	table.binary[index('^')] = OpCarac{30, Associativity::right};
+	table.unary[index('-')] = true;
+	return table;
+}
+
+constexpr OperatorTable builtin_table = builtin_operators();
+
+// Stands for the operands which could not be parsed, so that parsing can go on.
+ExprNode placeholder()
+{
+	return std::make_unique<NumberTree>(0.0);
+}
+
+} // namespace
 
 int operator_precedence(char op)
 {
-	if (binary_operators.find(op) == std::end(binary_operators))
-		return -1;
-	return binary_operators[op].precedence;
+	return builtin_table.binary[index(op)].precedence;
 }
 
 Associativity operator_associativity(char op)
 {
-	if (binary_operators.find(op) == std::end(binary_operators))
-		return Associativity::unknown;
-	return binary_operators[op].associativity;
+	return builtin_table.binary[index(op)].associativity;
+}
+
+std::string operator_symbol(char op)
+{
+	switch (op)
+	{
+		case Token::less_equal:
+			return "<=";
+		case Token::greater_equal:
+			return ">=";
+		case Token::equal:
+			return "==";
+		case Token::not_equal:
+			return "!=";
+		default:
+			return std::string(1, op);
+	}
+}
+
+bool is_user_operator_symbol(char c)
+{
+	return c != '\0' && std::strchr(user_symbols, c);
 }
 
-Parser::Parser(std::map<std::string, double>& vars, std::map<std::string, Function*>& funs)
-	: vars_{vars}, funs_{funs}, lex_{nullptr}, cur_tok_{Token::eof}
+bool is_reserved_name(std::string const& name)
+{
+	return is_in(name, {"if"s, "while"s, "for"s});
+}
+
+Parser::Parser(std::map<std::string, double>& vars, std::map<std::string, Function*>& funs,
+               std::map<std::string, Array>& arrays, DependencyGraph& graph)
+	: vars_{vars}, funs_{funs}, arrays_{arrays}, graph_{graph}, deps_{nullptr}, fn_name_{nullptr}, fn_{nullptr},
+	  lex_{nullptr}, cur_tok_{Token::eof}, operators_(builtin_table), diagnostics_{nullptr}, first_diagnostic_{0},
+	  recovering_{false}
 {}
 
 ExprNode Parser::parse(Lexer& lex)
 {
 	lex_ = &lex;
-	cur_tok_ = lex_->next();
-	auto ast = parse_expr_(nullptr, nullptr);
-	if (cur_tok_ != Token::eof)
-		throw InvalidInput{"Ill-formed expression"};
-	return ast;
+	deps_ = nullptr;
+	fn_name_ = nullptr;
+	fn_ = nullptr;
+	return parse_or_throw_();
 }
 
-ExprNode Parser::parse_function_body(Lexer& lex, std::string const& fn_name, Function& fn)
+ExprNode Parser::parse_formula(Lexer& lex, std::set<std::string>& deps)
 {
 	lex_ = &lex;
-	cur_tok_ = lex_->next();
-	auto body = parse_expr_(&fn_name, &fn);
-	if (cur_tok_ != Token::eof)
-		throw InvalidInput{"Ill-formed expression"};
-	return body;
+	deps_ = &deps;
+	fn_name_ = nullptr;
+	fn_ = nullptr;
+	return parse_or_throw_();
 }
 
-ExprNode Parser::parse_expr_(std::string const* fn_name, Function* fn)
+ExprNode Parser::parse_function_body(Lexer& lex, std::string const& fn_name, Function& fn,
+                                     std::set<std::string>& deps)
 {
-	return parse_binary_rhs_(0, parse_unary_(fn_name, fn), fn_name, fn);
+	lex_ = &lex;
+	deps_ = &deps;
+	fn_name_ = &fn_name;
+	fn_ = &fn;
+	return parse_or_throw_();
+}
+
+ExprNode Parser::check(Lexer& lex, std::vector<Diagnostic>& diagnostics)
+{
+	lex_ = &lex;
+	deps_ = nullptr;
+	fn_name_ = nullptr;
+	fn_ = nullptr;
+	diagnostics_ = &diagnostics;
+	return parse_();
 }
 
-ExprNode Parser::parse_top_(std::string const* fn_name, Function* fn)
+ExprNode Parser::check_function_body(Lexer& lex, std::string const& fn_name, Function& fn,
+                                     std::set<std::string>& deps, std::vector<Diagnostic>& diagnostics)
 {
+	lex_ = &lex;
+	deps_ = &deps;
+	fn_name_ = &fn_name;
+	fn_ = &fn;
+	diagnostics_ = &diagnostics;
+	return parse_();
+}
+
+void Parser::copy_operators(Parser const& other)
+{
+	operators_ = other.operators_;
+	user_operators_ = other.user_operators_;
+}
+
+void Parser::define_operator(char symbol, UserOperator op)
+{
+	if (!is_user_operator_symbol(symbol))
+		throw InvalidInput{"Operators must be one of "s + user_symbols};
+	if (op.precedence <= operator_precedence('=') || op.precedence >= unary_precedence)
+		throw InvalidInput{"Operator precedence must be between " + std::to_string(operator_precedence('=') + 1) +
+		                   " and " + std::to_string(unary_precedence - 1)};
+	if (op.associativity == Associativity::unknown)
+		throw InvalidInput{"Operator associativity must be left or right"};
+	auto fun_it = funs_.find(op.function);
+	if (fun_it == std::end(funs_) || fun_it->second->param_names.size() != 2)
+		throw InvalidInput{"Operator function must be a function of 2 arguments"};
+	if (user_operators_.find(symbol) != std::end(user_operators_))
+		output() << "Warning : overriding operator " << symbol << '\n';
+	operators_.binary[index(symbol)] = OpCarac{op.precedence, op.associativity};
+	user_operators_[symbol] = std::move(op);
+}
+
+void Parser::remove_operator(char symbol)
+{
+	if (user_operators_.erase(symbol) == 0)
+		throw InvalidInput{"No such operator : "s + symbol};
+	operators_.binary[index(symbol)] = builtin_table.binary[index(symbol)];
+}
+
+std::map<char, UserOperator> const& Parser::user_operators() const
+{
+	return user_operators_;
+}
+
+ExprNode Parser::parse_or_throw_()
+{
+	errors_.clear();
+	diagnostics_ = &errors_;
+	auto res = parse_();
+	if (!res)
+		throw InvalidInput{errors_.front().message};
+	return res;
+}
+
+void Parser::syntax_error_(std::string message)
+{
+	if (!recovering_)
+		report_(lex_->column(), std::move(message));
+	recovering_ = true;
+}
+
+void Parser::report_(std::size_t column, std::string message)
+{
+	diagnostics_->push_back(Diagnostic{column, std::move(message)});
+}
+
+ExprNode Parser::parse_()
+{
+	frames_.clear();
+	operands_.clear();
+	pending_.clear();
+	locals_.clear();
+	first_diagnostic_ = diagnostics_->size();
+	recovering_ = false;
+	frames_.push_back(Frame{Construct::top, 0, 0, {}, {}});
+	cur_tok_ = lex_->next();
+	auto expect_operand = true;
+	while (true)
+	{
+		if (expect_operand)
+		{
+			expect_operand = !parse_operand_();
+			continue;
+		}
+		auto const& op = operators_.binary[index(cur_tok_)];
+		if (op.precedence >= 0)
+		{
+			reduce_(op.precedence, op.associativity);
+			pending_.push_back(PendingOp{cur_tok_, false, lex_->column()});
+			cur_tok_ = lex_->next();
+			expect_operand = true;
+			continue;
+		}
+		// The expression of the innermost construct ends here.
+		reduce_(-1, Associativity::left);
+		if (frames_.size() == 1)
+		{
+			if (cur_tok_ == Token::eof)
+			{
+				assert(operands_.size() == 1);
+				if (diagnostics_->size() != first_diagnostic_)
+					return nullptr;
+				return std::move(operands_.back());
+			}
+			// A new expression starts at the unexpected token, or after it if it cannot start one.
+			syntax_error_("Ill-formed expression");
+			operands_.clear();
+			pending_.clear();
+			if (!starts_operand_())
+				cur_tok_ = lex_->next();
+			expect_operand = true;
+			continue;
+		}
+		expect_operand = end_construct_();
+	}
+}
+
+// Returns true if an operand was parsed, and false if it is still expected.
+bool Parser::parse_operand_()
+{
+	if (starts_operand_())
+		recovering_ = false;
 	switch (cur_tok_)
 	{
 		case Token::number:
-			return parse_number_();
+			operands_.emplace_back(std::make_unique<NumberTree>(lex_->number()));
+			cur_tok_ = lex_->next();
+			return true;
 		case Token::identifier:
-			return parse_identifier_(fn_name, fn);
+		{
+			auto column = lex_->column();
+			auto id = lex_->identifier();
+			cur_tok_ = lex_->next();
+			// let is only a keyword before a name.
+			if (id == "let" && cur_tok_ == Token::identifier)
+			{
+				frames_.push_back(Frame{Construct::let_value, pending_.size(), column, {}, {}});
+				if (parse_binding_())
+					return false;
+				frames_.pop_back();
+				operands_.emplace_back(placeholder());
+				return true;
+			}
+			if (cur_tok_ != '(')
+			{
+				operands_.emplace_back(make_identifier_(std::move(id)));
+				return true;
+			}
+			cur_tok_ = lex_->next();
+			if (cur_tok_ != ')')
+			{
+				frames_.push_back(Frame{Construct::call, pending_.size(), column, std::move(id), {}});
+				return false;
+			}
+			cur_tok_ = lex_->next();
+			operands_.emplace_back(make_call_(std::move(id), {}, column));
+			return true;
+		}
 		case '(':
-			return parse_paren_(fn_name, fn);
+			cur_tok_ = lex_->next();
+			frames_.push_back(Frame{Construct::paren, pending_.size(), 0, {}, {}});
+			return false;
+		case '[':
+			cur_tok_ = lex_->next();
+			if (cur_tok_ != ']')
+			{
+				frames_.push_back(Frame{Construct::array, pending_.size(), 0, {}, {}});
+				return false;
+			}
+			cur_tok_ = lex_->next();
+			operands_.emplace_back(std::make_unique<ArrayLiteralTree>(std::vector<ExprNode>{}));
+			return true;
+		case Token::error:
+			report_(lex_->column(), "Wrong number format");
+			cur_tok_ = lex_->next();
+			operands_.emplace_back(placeholder());
+			return true;
 		default:
-			throw InvalidInput{"Ill-formed expression"};
+			if (operators_.unary[index(cur_tok_)])
+			{
+				pending_.push_back(PendingOp{cur_tok_, true, lex_->column()});
+				cur_tok_ = lex_->next();
+				return false;
+			}
+			syntax_error_("Ill-formed expression");
+			// The operand is missing before the tokens ending expressions. Other tokens are skipped.
+			if (cur_tok_ == Token::eof || is_in(cur_tok_, {')', ']', ',', ':'}))
+			{
+				operands_.emplace_back(placeholder());
+				return true;
+			}
+			cur_tok_ = lex_->next();
+			return false;
 	}
 }
 
-ExprNode Parser::parse_number_()
+// Parses the name and the = of a binding of the innermost let. Returns false if they are missing.
+bool Parser::parse_binding_()
 {
-	auto res = std::make_unique<NumberTree>(lex_->number());
+	if (cur_tok_ != Token::identifier)
+	{
+		syntax_error_("Ill-formed let : expected a name");
+		return false;
+	}
+	frames_.back().callee = lex_->identifier();
+	cur_tok_ = lex_->next();
+	if (cur_tok_ != '=')
+	{
+		syntax_error_("Ill-formed let : expected '='");
+		return false;
+	}
 	cur_tok_ = lex_->next();
-	return std::move(res);
+	return true;
 }
 
-ExprNode Parser::parse_identifier_(std::string const* fn_name, Function* fn)
+bool Parser::starts_operand_() const
 {
-	auto id = lex_->identifier();
-	cur_tok_ = lex_->next();
-	if (cur_tok_ == '(')
+	return cur_tok_ == Token::number || cur_tok_ == Token::identifier || cur_tok_ == Token::error ||
+	       cur_tok_ == '(' || cur_tok_ == '[' || operators_.unary[index(cur_tok_)];
+}
+
+// Gives the expression which just ended to its construct. Returns true if the construct expects
+// another expression, and false if the construct is complete and is now an operand. A construct
+// which does not end as expected is closed where it stands.
+bool Parser::end_construct_()
+{
+	auto& frame = frames_.back();
+	auto expr = std::move(operands_.back());
+	operands_.pop_back();
+	auto closed = true;
+	auto fail = [&](std::string message)
 	{
-		cur_tok_ = lex_->next();
-		std::vector<ExprNode> fn_params;
-		while (cur_tok_ != ')')
-		{
-			auto param = parse_expr_(fn_name, fn);
-			fn_params.emplace_back(std::move(param));
-			if (cur_tok_ != ',' && cur_tok_ != ')')
-				throw InvalidInput{"Ill-formed expression"};
+		syntax_error_(std::move(message));
+		operands_.emplace_back(placeholder());
+		closed = false;
+	};
+	switch (frame.construct)
+	{
+		case Construct::paren:
+			if (cur_tok_ != ')')
+			{
+				fail("Ill-formed expression : expected ')'");
+				break;
+			}
+			operands_.emplace_back(std::move(expr));
+			break;
+		case Construct::call:
+			frame.items.emplace_back(std::move(expr));
 			if (cur_tok_ == ',')
 			{
 				cur_tok_ = lex_->next();
-				if (cur_tok_ == ')')
-					throw InvalidInput{"Ill-formed expression"};
+				if (cur_tok_ != ')')
+					return true;
+				syntax_error_("Ill-formed expression");
+				operands_.emplace_back(placeholder());
+				break;
+			}
+			if (cur_tok_ != ')')
+			{
+				fail("Ill-formed expression");
+				break;
+			}
+			operands_.emplace_back(make_call_(std::move(frame.callee), std::move(frame.items), frame.column));
+			break;
+		case Construct::array:
+			frame.items.emplace_back(std::move(expr));
+			if (cur_tok_ == ':' && frame.items.size() == 1)
+				frame.construct = Construct::range;
+			if (cur_tok_ == ':' || cur_tok_ == ',')
+			{
+				cur_tok_ = lex_->next();
+				return true;
+			}
+			if (cur_tok_ != ']')
+			{
+				fail("Ill-formed array : expected ']'");
+				break;
+			}
+			operands_.emplace_back(std::make_unique<ArrayLiteralTree>(std::move(frame.items)));
+			break;
+		case Construct::range:
+			frame.items.emplace_back(std::move(expr));
+			if (cur_tok_ == ':' && frame.items.size() == 2)
+			{
+				cur_tok_ = lex_->next();
+				return true;
+			}
+			if (cur_tok_ != ']')
+			{
+				fail("Ill-formed range : expected ']'");
+				break;
+			}
+			frame.items.resize(3);
+			operands_.emplace_back(std::make_unique<RangeTree>(std::move(frame.items[0]), std::move(frame.items[1]),
+			                                                   std::move(frame.items[2])));
+			break;
+		case Construct::let_value:
+		{
+			// Each binding is in scope in the next ones and in the body.
+			auto in = cur_tok_ == Token::identifier && lex_->identifier() == "in";
+			if (in || cur_tok_ == ',')
+			{
+				frame.items.emplace_back(std::make_unique<LetTree>(std::move(frame.callee), std::move(expr)));
+				locals_.push_back(static_cast<LetTree*>(frame.items.back().get()));
+				cur_tok_ = lex_->next();
+				if (in)
+					frame.construct = Construct::let_body;
+				if (in || parse_binding_())
+					return true;
 			}
+			locals_.resize(locals_.size() - frame.items.size());
+			fail("Ill-formed let : expected 'in'");
+			break;
 		}
-		cur_tok_ = lex_->next();
-		auto fun_it = funs_.find(id);
-		if (fn_name && fun_it != std::end(funs_) && *fn_name == id)
-			throw InvalidInput{"Recursive function calls are not allowed"};
-		return std::make_unique<FunctionCallTree>(std::move(id), std::move(fn_params), funs_, vars_);
+		case Construct::let_body:
+			// The body extends as far as possible, so the token ending it belongs to the enclosing
+			// construct.
+			locals_.resize(locals_.size() - frame.items.size());
+			while (!frame.items.empty())
+			{
+				static_cast<LetTree&>(*frame.items.back()).set_body(std::move(expr));
+				expr = std::move(frame.items.back());
+				frame.items.pop_back();
+			}
+			operands_.emplace_back(std::move(expr));
+			closed = false;
+			break;
+		case Construct::top:
+			assert(false);
 	}
-	if (fn)
+	if (closed)
+		cur_tok_ = lex_->next();
+	frames_.pop_back();
+	return false;
+}
+
+// Applies the pending operators of the innermost construct binding tighter than an operator of the
+// given precedence and associativity.
+void Parser::reduce_(int precedence, Associativity associativity)
+{
+	while (pending_.size() > frames_.back().operators_base)
 	{
-		if (is_in(id, fn->param_names))
-			return std::make_unique<FunctionParamTree>(std::move(id), fn);
+		auto const& op = pending_.back();
+		auto op_precedence = op.unary ? unary_precedence : operators_.binary[index(op.op)].precedence;
+		if (op_precedence < precedence || (op_precedence == precedence && associativity == Associativity::right))
+			return;
+		reduce_one_();
 	}
-	return std::make_unique<IdentifierTree>(std::move(id), vars_, funs_);
 }
 
-ExprNode Parser::parse_unary_(std::string const* fn_name, Function* fn)
+void Parser::reduce_one_()
 {
-	if (!is_in(cur_tok_, unary_operators))
-		return parse_top_(fn_name, fn);
-
-	auto un_op = cur_tok_;
-	cur_tok_ = lex_->next();
-	return std::make_unique<UnaryExprTree>(un_op, parse_unary_(fn_name, fn));
+	auto op = pending_.back();
+	pending_.pop_back();
+	auto rhs = std::move(operands_.back());
+	operands_.pop_back();
+	if (op.unary)
+	{
+		operands_.emplace_back(std::make_unique<UnaryExprTree>(op.op, std::move(rhs)));
+		return;
+	}
+	auto lhs = std::move(operands_.back());
+	operands_.pop_back();
+	auto user_it = user_operators_.find(op.op);
+	if (user_it != std::end(user_operators_))
+	{
+		std::vector<ExprNode> args;
+		args.emplace_back(std::move(lhs));
+		args.emplace_back(std::move(rhs));
+		operands_.emplace_back(make_call_(user_it->second.function, std::move(args), op.column));
+	}
+	else if (op.op == '=')
+	{
+		if (lhs->type == TreeType::identifier)
+			operands_.emplace_back(std::make_unique<AssignmentTree>(std::move(lhs), std::move(rhs)));
+		else
+		{
+			report_(op.column, "Expression is not assignable");
+			operands_.emplace_back(placeholder());
+		}
+	}
+	else
+		operands_.emplace_back(std::make_unique<BinaryExprTree>(op.op, std::move(lhs), std::move(rhs)));
 }
 
-ExprNode Parser::parse_paren_(std::string const* fn_name, Function* fn)
+ExprNode Parser::make_identifier_(std::string id)
 {
-	cur_tok_ = lex_->next();
-	auto ex = parse_expr_(fn_name, fn);
-	if (cur_tok_ != ')')
-		throw InvalidInput{"Ill-formed expression : expected ')'"};
-	cur_tok_ = lex_->next();
-	return ex;
+	for (auto it = locals_.rbegin() ; it != locals_.rend() ; ++it)
+	{
+		if ((*it)->name() == id)
+			return std::make_unique<LocalTree>(std::move(id), *it);
+	}
+	if (fn_ && is_in(id, fn_->param_names))
+		return std::make_unique<FunctionParamTree>(std::move(id), fn_);
+	if (deps_)
+		deps_->insert(id);
+	return std::make_unique<IdentifierTree>(std::move(id), vars_, funs_, arrays_, graph_);
 }
 
-ExprNode Parser::parse_binary_rhs_(int expr_prec, ExprNode lhs, std::string const* fn_name, Function* fn)
+ExprNode Parser::make_call_(std::string id, std::vector<ExprNode> params, std::size_t column)
 {
-	while (1)
+	if (is_reserved_name(id))
+		return make_construct_(id, std::move(params), column);
+	auto fun_it = funs_.find(id);
+	if (fun_it == std::end(funs_))
 	{
-		auto cur_prec = operator_precedence(cur_tok_);
-		if (cur_prec < expr_prec)
-			return lhs;
-		auto bin_op = cur_tok_;
-		cur_tok_ = lex_->next();
-
-		auto rhs = parse_unary_(fn_name, fn);
-		auto next_op = cur_tok_;
-		auto next_prec = operator_precedence(next_op);
-		while (cur_prec < next_prec ||
-			   (operator_associativity(next_op) == Associativity::right && cur_prec == next_prec))
-		{
-			rhs = parse_binary_rhs_(next_prec, std::move(rhs), fn_name, fn);
-			next_op = cur_tok_;
-			next_prec = operator_precedence(next_op);
-		}
+		auto err = ""s;
+		if (vars_.find(id) != std::end(vars_))
+			err = ". Maybe you meant to use the variable?";
+		report_(column, "Undeclared function : " + id + err);
+		return placeholder();
+	}
+	if (fn_name_ && *fn_name_ == id)
+	{
+		report_(column, "Recursive function calls are not allowed");
+		return placeholder();
+	}
+	auto param_count = fun_it->second->param_names.size();
+	if (param_count != params.size())
+	{
+		auto err = "Too "s + (param_count < params.size() ? "many" : "few") + " arguments in call to function " + id +
+		           ". Function takes " + std::to_string(param_count) + " argument";
+		if (param_count != 1)
+			err += 's';
+		report_(column, std::move(err));
+		return placeholder();
+	}
+	if (deps_)
+		deps_->insert(id);
+	return std::make_unique<FunctionCallTree>(std::move(id), std::move(params), funs_);
+}
 
-		if (bin_op == '=')
-			lhs = std::make_unique<AssignmentTree>(std::move(lhs), std::move(rhs));
-		else
-			lhs = std::make_unique<BinaryExprTree>(bin_op, std::move(lhs), std::move(rhs));
+// if, while and for are written like calls, but their arguments are not all computed.
+ExprNode Parser::make_construct_(std::string const& id, std::vector<ExprNode> params, std::size_t column)
+{
+	std::size_t param_count{id == "if" ? 3u : id == "while" ? 2u : 4u};
+	if (params.size() != param_count)
+	{
+		report_(column, id + " takes " + std::to_string(param_count) + " arguments");
+		return placeholder();
+	}
+	if (id == "if")
+		return std::make_unique<ConditionTree>(std::move(params[0]), std::move(params[1]), std::move(params[2]));
+	if (id == "while")
+		return std::make_unique<WhileTree>(std::move(params[0]), std::move(params[1]));
+	if (params[0]->type != TreeType::identifier)
+	{
+		report_(column, "The first argument of for must be a variable");
+		return placeholder();
 	}
+	return std::make_unique<ForTree>(std::move(params[0]), std::move(params[1]), std::move(params[2]),
+	                                 std::move(params[3]));
 }
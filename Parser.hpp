@@ -5,11 +5,16 @@
 
 #include <map>
 #include <memory>
+#include <set>
 #include <string>
+#include <vector>
 
+class DependencyGraph;
 class Lexer;
 class ExprTree;
+class LetTree;
 using ExprNode = std::unique_ptr<ExprTree>;
+struct Array;
 struct Function;
 
 enum class Associativity
@@ -25,13 +30,49 @@ struct OpCarac
 	Associativity associativity;
 };
 
+// Operators are single characters, so their characteristics are found with a single load in tables
+// indexed by character. Characters which are not binary operators have a precedence of -1.
+struct OperatorTable
+{
+	OpCarac binary[256];
+	bool unary[256];
+};
+
+// Precedence and associativity of the builtin operators.
 int operator_precedence(char);
 Associativity operator_associativity(char op);
+// Comparisons of two characters are single tokens.
+std::string operator_symbol(char);
+
+// Characters available for user-defined operators.
+bool is_user_operator_symbol(char);
+
+// if, while and for are written like calls, so no function can be named after them.
+bool is_reserved_name(std::string const&);
+
+// A user-defined operator applies a function of 2 parameters to its operands.
+struct UserOperator
+{
+	std::string function;
+	int precedence;
+	Associativity associativity;
+};
 
+// Error found in a line, at the given column, starting at 1.
+struct Diagnostic
+{
+	std::size_t column;
+	std::string message;
+};
+
+// Pratt parser. Nested expressions are parsed with an explicit stack instead of recursion, so the
+// length and depth of expressions are only limited by memory. Errors do not unwind the parser: they
+// are recorded, and parsing resumes after them with placeholder operands.
 class Parser
 {
 	public:
-	Parser(std::map<std::string, double>&, std::map<std::string, Function*>&);
+	Parser(std::map<std::string, double>&, std::map<std::string, Function*>&, std::map<std::string, Array>&,
+	       DependencyGraph&);
 
 	Parser(Parser const&) = delete;
 	Parser& operator=(Parser const&) = delete;
@@ -42,21 +83,87 @@ class Parser
 	~Parser() = default;
 
 	ExprNode parse(Lexer&);
-	ExprNode parse_function_body(Lexer&, std::string const&, Function&);
+	ExprNode parse_formula(Lexer&, std::set<std::string>&);
+	ExprNode parse_function_body(Lexer&, std::string const&, Function&, std::set<std::string>&);
+
+	// Same as above, without throwing. The errors of the line are all added to the diagnostics, and
+	// nullptr is returned if there are any.
+	ExprNode check(Lexer&, std::vector<Diagnostic>&);
+	ExprNode check_function_body(Lexer&, std::string const&, Function&, std::set<std::string>&,
+	                             std::vector<Diagnostic>&);
+
+	// Gives the parser the user-defined operators of another parser.
+	void copy_operators(Parser const&);
+	void define_operator(char, UserOperator);
+	void remove_operator(char);
+	std::map<char, UserOperator> const& user_operators() const;
 
 	private:
-	ExprNode parse_expr_(std::string const*, Function*);
-	ExprNode parse_top_(std::string const*, Function*);
-	ExprNode parse_number_();
-	ExprNode parse_identifier_(std::string const*, Function*);
-	ExprNode parse_unary_(std::string const*, Function*);
-	ExprNode parse_paren_(std::string const*, Function*);
-	ExprNode parse_binary_rhs_(int, ExprNode, std::string const*, Function*);
+	// Constructs waiting for the end of the expression parsed in them.
+	enum class Construct
+	{
+		top,
+		paren,
+		call,
+		array,
+		range,
+		let_value,
+		let_body
+	};
+
+	struct Frame
+	{
+		Construct construct;
+		std::size_t operators_base;
+		std::size_t column;
+		std::string callee;
+		std::vector<ExprNode> items;
+	};
+
+	struct PendingOp
+	{
+		char op;
+		bool unary;
+		std::size_t column;
+	};
+
+	ExprNode parse_();
+	// Throws the first error of the line.
+	ExprNode parse_or_throw_();
+	// Syntax errors following another one are usually caused by it, so they are not reported until an
+	// operand is parsed.
+	void syntax_error_(std::string);
+	void report_(std::size_t, std::string);
+	bool parse_operand_();
+	bool parse_binding_();
+	bool starts_operand_() const;
+	bool end_construct_();
+	void reduce_(int, Associativity);
+	void reduce_one_();
+	ExprNode make_identifier_(std::string);
+	ExprNode make_call_(std::string, std::vector<ExprNode>, std::size_t);
+	ExprNode make_construct_(std::string const&, std::vector<ExprNode>, std::size_t);
 
 	std::map<std::string, double>& vars_;
 	std::map<std::string, Function*>& funs_;
+	std::map<std::string, Array>& arrays_;
+	DependencyGraph& graph_;
+	std::set<std::string>* deps_;
+	std::string const* fn_name_;
+	Function* fn_;
 	Lexer* lex_;
 	char cur_tok_;
+	OperatorTable operators_;
+	std::map<char, UserOperator> user_operators_;
+	std::vector<Frame> frames_;
+	std::vector<ExprNode> operands_;
+	std::vector<PendingOp> pending_;
+	// Bindings of the enclosing lets, innermost last.
+	std::vector<LetTree*> locals_;
+	std::vector<Diagnostic>* diagnostics_;
+	std::vector<Diagnostic> errors_;
+	std::size_t first_diagnostic_;
+	bool recovering_;
 };
 
 #endif // Header guard
@@ -0,0 +1,426 @@
+// Copyright 2015 Benoît Vey
+
+#include "arrays.hpp"
+
+#include <algorithm>
+#include <cassert>
+#include <iostream>
+
+#include "dependency_graph.hpp"
+#include "jit.hpp"
+#include "output.hpp"
+#include "syntax_tree.hpp"
+#include "watchdog.hpp"
+
+namespace
+{
+
+thread_local ArrayLoop* current_loop{nullptr};
+thread_local bool length_mismatch{false};
+
+std::size_t const printed_elements{10};
+
+llvm::Function* declare_runtime(llvm::Module& module, std::string const& name, llvm::FunctionType* type)
+{
+	auto fn = module.getFunction(name);
+	if (!fn)
+		fn = llvm::Function::Create(type, llvm::Function::ExternalLinkage, name, &module);
+	return fn;
+}
+
+} // namespace
+
+void assign_array(Array& array, Array&& elements)
+{
+	array.single = elements.single;
+	array.values = std::move(elements.values);
+	array.singles = std::move(elements.singles);
+	if (array.single)
+	{
+		array.data = array.singles.data();
+		array.size = array.singles.size();
+	}
+	else
+	{
+		array.data = array.values.data();
+		array.size = array.values.size();
+	}
+}
+
+double array_element(Array const& array, std::uint64_t index)
+{
+	return array.single ? array.singles[index] : array.values[index];
+}
+
+llvm::Type* array_element_type(Array const& array)
+{
+	if (array.single)
+		return llvm::Type::getFloatTy(jit_context());
+	return llvm::Type::getDoubleTy(jit_context());
+}
+
+llvm::Value* host_address(llvm::IRBuilder<>& builder, void const* ptr, llvm::Type* type)
+{
+	auto address = llvm::ConstantInt::get(llvm::Type::getInt64Ty(jit_context()),
+	                                      reinterpret_cast<std::uintptr_t>(ptr));
+	return builder.CreateIntToPtr(address, type);
+}
+
+// Integers are signed, so that conversions stay exact for negative values.
+llvm::Value* convert_number(llvm::IRBuilder<>& builder, llvm::Value* value, llvm::Type* type)
+{
+	auto from = value->getType();
+	if (from == type)
+		return value;
+	if (from->isIntegerTy())
+		return builder.CreateSIToFP(value, type);
+	if (type->isIntegerTy())
+		return builder.CreateFPToSI(value, type);
+	if (from->getPrimitiveSizeInBits() < type->getPrimitiveSizeInBits())
+		return builder.CreateFPExt(value, type);
+	return builder.CreateFPTrunc(value, type);
+}
+
+llvm::Value* real_value(CheckedValue const& checked)
+{
+	return checked.overflow ? checked.real : checked.value;
+}
+
+ArrayLoop::ArrayLoop(llvm::Module& module, llvm::IRBuilder<>& builder, ArrayResults* results)
+	: module_{module}, builder_{builder}, results_{results}, outer_{current_loop}, length_{nullptr},
+	  index_{nullptr}, header_{nullptr}, exit_{nullptr}, in_body_{false}, draining_{false}
+{
+	if (numeric_mode() == NumericMode::float32)
+		element_ = llvm::Type::getFloatTy(jit_context());
+	else
+		element_ = llvm::Type::getDoubleTy(jit_context());
+	current_loop = this;
+}
+
+ArrayLoop::~ArrayLoop()
+{
+	current_loop = outer_;
+}
+
+ArrayLoop* ArrayLoop::current()
+{
+	return current_loop;
+}
+
+llvm::Type* ArrayLoop::element_type() const
+{
+	return element_;
+}
+
+// Inside the loop body, numbers are computed with the element type. Hoisted values are converted
+// where they are used.
+bool ArrayLoop::in_body() const
+{
+	return in_body_;
+}
+
+bool ArrayLoop::nested() const
+{
+	return outer_ != nullptr;
+}
+
+bool ArrayLoop::has_lengths() const
+{
+	return !lengths_.empty();
+}
+
+// The subtrees given by prepare_array are queued and prepared in order by the outermost call, so that
+// deep array expressions are prepared without recursion.
+void ArrayLoop::prepare(ExprTree& expr)
+{
+	preparing_.emplace_back(&expr);
+	if (draining_)
+		return;
+	expr.analyze_();
+	draining_ = true;
+	try
+	{
+		while (!preparing_.empty())
+		{
+			auto& next = *preparing_.back();
+			preparing_.pop_back();
+			if (!ExprTree::is_array_(next))
+			{
+				hoist(next);
+				continue;
+			}
+			auto queued = preparing_.size();
+			next.prepare_array(*this, module_, builder_);
+			std::reverse(std::begin(preparing_) + static_cast<std::ptrdiff_t>(queued), std::end(preparing_));
+		}
+	}
+	catch (...)
+	{
+		preparing_.clear();
+		draining_ = false;
+		throw;
+	}
+	draining_ = false;
+}
+
+// Scalar subtrees are computed once before the loop.
+CheckedValue ArrayLoop::hoist(ExprTree& expr)
+{
+	auto value = ExprTree::is_integer_(expr) ? expr.codegen_checked(module_, builder_)
+	                                         : CheckedValue{expr.codegen(module_, builder_), nullptr, nullptr};
+	hoisted_[&expr] = value;
+	return value;
+}
+
+void ArrayLoop::add_length(llvm::Value* length)
+{
+	lengths_.emplace_back(length);
+}
+
+void ArrayLoop::add_leaf(ExprTree const& expr, llvm::Value* value)
+{
+	leaves_[&expr] = value;
+}
+
+void ArrayLoop::add_target(std::string const& name)
+{
+	if (!results_)
+		throw InvalidInput{"Arrays can only be assigned outside of functions and reductions"};
+	(*results_)[name].single = element_->isFloatTy();
+	targets_[name] = nullptr;
+}
+
+llvm::Value* ArrayLoop::entry_alloca(llvm::Type* type, std::uint64_t count)
+{
+	auto& entry = builder_.GetInsertBlock()->getParent()->getEntryBlock();
+	llvm::IRBuilder<> entry_builder{&entry, entry.begin()};
+	return entry_builder.CreateAlloca(type, llvm::ConstantInt::get(llvm::Type::getInt64Ty(jit_context()),
+	                                                               count));
+}
+
+llvm::Value* ArrayLoop::length()
+{
+	assert(!lengths_.empty());
+	auto& ctx = jit_context();
+	auto fn = builder_.GetInsertBlock()->getParent();
+
+	auto n = lengths_.front();
+	if (lengths_.size() > 1)
+	{
+		llvm::Value* mismatch = builder_.getFalse();
+		for (auto it = std::begin(lengths_) + 1 ; it != std::end(lengths_) ; ++it)
+		{
+			mismatch = builder_.CreateOr(mismatch, builder_.CreateICmpNE(*it, n));
+			n = builder_.CreateSelect(builder_.CreateICmpULT(*it, n), *it, n, "len");
+		}
+		auto report = llvm::BasicBlock::Create(ctx, "mismatch", fn);
+		auto checked = llvm::BasicBlock::Create(ctx, "checked", fn);
+		builder_.CreateCondBr(mismatch, report, checked);
+		builder_.SetInsertPoint(report);
+		auto report_type = llvm::FunctionType::get(llvm::Type::getVoidTy(ctx), {}, false);
+		builder_.CreateCall(declare_runtime(module_, "calcrt_array_mismatch", report_type), {});
+		builder_.CreateBr(checked);
+		builder_.SetInsertPoint(checked);
+	}
+
+	if (!targets_.empty())
+	{
+		auto byte_ptr = llvm::Type::getInt8PtrTy(ctx);
+		auto alloc_type = llvm::FunctionType::get(byte_ptr, {byte_ptr, llvm::Type::getInt64Ty(ctx)}, false);
+		auto alloc = declare_runtime(module_, "calcrt_array_alloc", alloc_type);
+		for (auto& elem : targets_)
+		{
+			auto buffer = host_address(builder_, &(*results_)[elem.first], byte_ptr);
+			elem.second = builder_.CreatePointerCast(builder_.CreateCall(alloc, {buffer, n}),
+			                                         element_->getPointerTo(), "buffer");
+		}
+	}
+	return length_ = n;
+}
+
+// The elements are computed in blocks, and the watchdog is polled between the blocks, so that the
+// loop over a block can still be vectorized.
+void ArrayLoop::begin()
+{
+	assert(length_);
+	auto& ctx = jit_context();
+	auto int64_type = llvm::Type::getInt64Ty(ctx);
+	auto fn = builder_.GetInsertBlock()->getParent();
+	auto preheader = builder_.GetInsertBlock();
+	auto blocks = llvm::BasicBlock::Create(ctx, "loop.block", fn);
+	header_ = llvm::BasicBlock::Create(ctx, "loop", fn);
+	auto body = llvm::BasicBlock::Create(ctx, "body", fn);
+	auto block_exit = llvm::BasicBlock::Create(ctx, "loop.block.end", fn);
+	auto poll = llvm::BasicBlock::Create(ctx, "loop.poll", fn);
+	exit_ = llvm::BasicBlock::Create(ctx, "loop.end", fn);
+
+	builder_.CreateBr(blocks);
+	builder_.SetInsertPoint(blocks);
+	auto block = builder_.CreatePHI(int64_type, 2, "block");
+	block->addIncoming(llvm::ConstantInt::get(int64_type, 0), preheader);
+	auto remaining = builder_.CreateSub(length_, block, "remaining");
+	auto block_size = llvm::ConstantInt::get(int64_type, poll_iterations);
+	auto block_end = builder_.CreateAdd(block, builder_.CreateSelect(builder_.CreateICmpULT(remaining, block_size),
+	                                                                 remaining, block_size), "block.end");
+	builder_.CreateBr(header_);
+
+	builder_.SetInsertPoint(block_exit);
+	builder_.CreateCondBr(builder_.CreateICmpEQ(block_end, length_), exit_, poll);
+	builder_.SetInsertPoint(poll);
+	auto interrupted = codegen_poll(module_, builder_);
+	block->addIncoming(block_end, builder_.GetInsertBlock());
+	builder_.CreateCondBr(interrupted, exit_, blocks);
+
+	builder_.SetInsertPoint(header_);
+	index_ = builder_.CreatePHI(int64_type, 2, "i");
+	index_->addIncoming(block, blocks);
+	builder_.CreateCondBr(builder_.CreateICmpULT(index_, block_end), body, block_exit);
+	builder_.SetInsertPoint(body);
+	in_body_ = true;
+}
+
+void ArrayLoop::end()
+{
+	assert(index_);
+	auto next = builder_.CreateNUWAdd(index_, llvm::ConstantInt::get(llvm::Type::getInt64Ty(jit_context()), 1),
+	                                  "i.next");
+	index_->addIncoming(next, builder_.GetInsertBlock());
+	builder_.CreateBr(header_);
+	builder_.SetInsertPoint(exit_);
+	in_body_ = false;
+}
+
+llvm::Value* ArrayLoop::index() const
+{
+	assert(index_);
+	return index_;
+}
+
+CheckedValue const* ArrayLoop::hoisted(ExprTree const& expr) const
+{
+	auto it = hoisted_.find(&expr);
+	return it == std::end(hoisted_) ? nullptr : &it->second;
+}
+
+llvm::Value* ArrayLoop::leaf(ExprTree const& expr) const
+{
+	auto it = leaves_.find(&expr);
+	assert(it != std::end(leaves_));
+	return it->second;
+}
+
+llvm::Value* ArrayLoop::target(std::string const& name) const
+{
+	auto it = targets_.find(name);
+	assert(it != std::end(targets_) && it->second);
+	return it->second;
+}
+
+void codegen_array(ExprTree& expr, llvm::Module& module, llvm::IRBuilder<>& builder, ArrayResults& results)
+{
+	ArrayLoop loop{module, builder, &results};
+	loop.prepare(expr);
+	loop.add_target("");
+	loop.length();
+	loop.begin();
+	auto value = expr.codegen(module, builder);
+	builder.CreateStore(value, builder.CreateGEP(loop.target(""), loop.index()));
+	loop.end();
+}
+
+bool take_length_mismatch()
+{
+	auto mismatch = length_mismatch;
+	length_mismatch = false;
+	return mismatch;
+}
+
+void check_array_lengths()
+{
+	if (take_length_mismatch())
+		throw InvalidInput{"Array length mismatch"};
+}
+
+std::vector<std::string> commit_arrays(ArrayResults& results, std::map<std::string, Array>& arrays,
+                                       std::map<std::string, double>& vars, std::map<std::string, Function*>& funs,
+                                       DependencyGraph& graph)
+{
+	for (auto& elem : results)
+	{
+		auto arr_it = arrays.find(elem.first);
+		if ((arr_it != std::end(arrays) && arr_it->second.single != elem.second.single) ||
+		    vars.find(elem.first) != std::end(vars) || funs.find(elem.first) != std::end(funs))
+			check_replaceable(elem.first, graph, funs);
+	}
+	std::vector<std::string> res;
+	for (auto& elem : results)
+	{
+		if (elem.first.empty())
+			continue;
+		// Compiled functions read the elements with the precision the array had.
+		auto arr_it = arrays.find(elem.first);
+		if (arr_it != std::end(arrays) && arr_it->second.single != elem.second.single)
+			invalidate_dependents(elem.first, graph, funs);
+		auto var_it = vars.find(elem.first);
+		if (var_it != std::end(vars))
+		{
+			output() << "Warning : overriding variable " << elem.first << '\n';
+			vars.erase(var_it);
+			invalidate_dependents(elem.first, graph, funs);
+		}
+		auto fun_it = funs.find(elem.first);
+		if (fun_it != std::end(funs))
+		{
+			output() << "Warning : overriding function " << elem.first << '\n';
+			funs.erase(fun_it);
+			graph.remove(elem.first);
+			invalidate_dependents(elem.first, graph, funs);
+		}
+		assign_array(arrays[elem.first], std::move(elem.second));
+		res.emplace_back(elem.first);
+	}
+	return res;
+}
+
+void print_array(std::ostream& os, Array const& array)
+{
+	os << '[';
+	for (std::uint64_t i{0} ; i != array.size && i != printed_elements ; ++i)
+	{
+		if (i != 0)
+			os << ", ";
+		write_number(os, array_element(array, i));
+	}
+	if (array.size > printed_elements)
+		os << ", ...] (" << array.size << " elements)";
+	else
+		os << ']';
+}
+
+void write_array(std::ostream& os, Array const& array)
+{
+	if (!array.single)
+	{
+		write_binary(os, array.values.data(), array.size);
+		return;
+	}
+	std::vector<double> values{std::begin(array.singles), std::end(array.singles)};
+	write_binary(os, values.data(), values.size());
+}
+
+extern "C" void* calcrt_array_alloc(Array* array, std::uint64_t size)
+{
+	Array elements{};
+	elements.single = array->single;
+	if (elements.single)
+		elements.singles.assign(size, 0.0f);
+	else
+		elements.values.assign(size, 0.0);
+	assign_array(*array, std::move(elements));
+	return array->data;
+}
+
+extern "C" void calcrt_array_mismatch()
+{
+	length_mismatch = true;
+}
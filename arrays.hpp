@@ -0,0 +1,130 @@
+// Copyright 2015 Benoît Vey
+
+#ifndef CALC_ARRAYS_HPP_
+#define CALC_ARRAYS_HPP_
+
+#include <cstdint>
+#include <iosfwd>
+#include <map>
+#include <string>
+#include <vector>
+
+#include <llvm/IR/IRBuilder.h>
+#include <llvm/IR/Module.h>
+
+class DependencyGraph;
+class ExprTree;
+struct Function;
+
+// Compiled code reads data and size directly, so they must always describe the elements. Arrays
+// computed in float32 mode keep single precision elements in singles, the others in values.
+struct Array
+{
+	void* data;
+	std::uint64_t size;
+	bool single;
+	std::vector<double> values;
+	std::vector<float> singles;
+};
+
+void assign_array(Array&, Array&&);
+
+double array_element(Array const&, std::uint64_t);
+
+llvm::Type* array_element_type(Array const&);
+
+llvm::Value* host_address(llvm::IRBuilder<>&, void const*, llvm::Type*);
+
+llvm::Value* convert_number(llvm::IRBuilder<>&, llvm::Value*, llvm::Type*);
+
+using ArrayResults = std::map<std::string, Array>;
+
+// Integer subtrees are computed with 64 bits integers, and again with reals when that overflows. The
+// overflow is null for values which are not integers.
+struct CheckedValue
+{
+	llvm::Value* value;
+	llvm::Value* overflow;
+	llvm::Value* real;
+};
+
+// The value computed with reals if it may have overflowed, or the value.
+llvm::Value* real_value(CheckedValue const&);
+
+class ArrayLoop
+{
+	public:
+	ArrayLoop(llvm::Module&, llvm::IRBuilder<>&, ArrayResults* = nullptr);
+
+	ArrayLoop(ArrayLoop const&) = delete;
+	ArrayLoop& operator=(ArrayLoop const&) = delete;
+
+	ArrayLoop(ArrayLoop&&) = delete;
+	ArrayLoop& operator=(ArrayLoop&&) = delete;
+
+	~ArrayLoop();
+
+	static ArrayLoop* current();
+
+	llvm::Type* element_type() const;
+	bool in_body() const;
+	bool nested() const;
+	bool has_lengths() const;
+
+	void prepare(ExprTree&);
+	CheckedValue hoist(ExprTree&);
+	void add_length(llvm::Value*);
+	void add_leaf(ExprTree const&, llvm::Value*);
+	void add_target(std::string const&);
+	llvm::Value* entry_alloca(llvm::Type*, std::uint64_t);
+
+	llvm::Value* length();
+	void begin();
+	void end();
+
+	llvm::Value* index() const;
+	CheckedValue const* hoisted(ExprTree const&) const;
+	llvm::Value* leaf(ExprTree const&) const;
+	llvm::Value* target(std::string const&) const;
+
+	private:
+	llvm::Module& module_;
+	llvm::IRBuilder<>& builder_;
+	ArrayResults* results_;
+	ArrayLoop* outer_;
+	llvm::Type* element_;
+	std::map<ExprTree const*, CheckedValue> hoisted_;
+	std::map<ExprTree const*, llvm::Value*> leaves_;
+	std::map<std::string, llvm::Value*> targets_;
+	std::vector<llvm::Value*> lengths_;
+	std::vector<ExprTree*> preparing_;
+	llvm::Value* length_;
+	llvm::PHINode* index_;
+	llvm::BasicBlock* header_;
+	llvm::BasicBlock* exit_;
+	bool in_body_;
+	bool draining_;
+};
+
+void codegen_array(ExprTree&, llvm::Module&, llvm::IRBuilder<>&, ArrayResults&);
+
+// Whether the code run by the current thread since the last call computed arrays of different
+// lengths. Clears the flag.
+bool take_length_mismatch();
+
+// Throws InvalidInput if take_length_mismatch. Called after each run of compiled code, so that a
+// mismatch is not reported by a later run.
+void check_array_lengths();
+
+std::vector<std::string> commit_arrays(ArrayResults&, std::map<std::string, Array>&, std::map<std::string, double>&,
+                                       std::map<std::string, Function*>&, DependencyGraph&);
+
+void print_array(std::ostream&, Array const&);
+
+// Writes all the elements as native doubles.
+void write_array(std::ostream&, Array const&);
+
+extern "C" void* calcrt_array_alloc(Array*, std::uint64_t);
+extern "C" void calcrt_array_mismatch();
+
+#endif // Header guard
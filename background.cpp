@@ -0,0 +1,153 @@
+// Copyright 2015 Benoît Vey
+
+#include "background.hpp"
+
+#include <cassert>
+#include <exception>
+
+#include <llvm/IR/LLVMContext.h>
+
+#include "dependency_graph.hpp"
+#include "jit.hpp"
+#include "profile.hpp"
+#include "syntax_tree.hpp"
+#include "utility.hpp"
+
+BackgroundCompiler::BackgroundCompiler(std::map<std::string, double>& vars, std::map<std::string, Function*>& funs,
+                                       DependencyGraph& graph)
+	: vars_{vars}, funs_{funs}, graph_{graph}, mode_{BackgroundMode::on}, stopping_{false}
+{}
+
+BackgroundCompiler::~BackgroundCompiler()
+{
+	stop();
+}
+
+BackgroundMode BackgroundCompiler::mode() const
+{
+	return mode_;
+}
+
+void BackgroundCompiler::set_mode(BackgroundMode mode)
+{
+	mode_ = mode;
+}
+
+void BackgroundCompiler::submit(std::string const& name)
+{
+	if (mode_ == BackgroundMode::off)
+		return;
+	auto fun_it = funs_.find(name);
+	assert(fun_it != std::end(funs_) && fun_it->second->type == FunctionType::userdef);
+	auto fn = fun_it->second;
+	// A new version tells the job apart from the jobs of a function previously allocated at the same
+	// address.
+	discard_code(*fn);
+	{
+		std::lock_guard<std::mutex> lock{jobs_mutex_};
+		if (!worker_.joinable())
+			stopping_ = false;
+		jobs_.push_back(Job{name, fn, fn->version, numeric_mode(), algebra_mode(), profile_mode(),
+		                   mode_ == BackgroundMode::optimize});
+	}
+	jobs_changed_.notify_one();
+	if (!worker_.joinable())
+		worker_ = std::thread{&BackgroundCompiler::run_, this};
+}
+
+void BackgroundCompiler::stop()
+{
+	{
+		std::lock_guard<std::mutex> lock{jobs_mutex_};
+		stopping_ = true;
+		jobs_.clear();
+	}
+	jobs_changed_.notify_one();
+	if (worker_.joinable())
+		worker_.join();
+}
+
+std::vector<std::string> BackgroundCompiler::take_errors()
+{
+	std::lock_guard<std::mutex> lock{jobs_mutex_};
+	auto errors = std::move(errors_);
+	errors_.clear();
+	return errors;
+}
+
+void BackgroundCompiler::run_()
+{
+	while (true)
+	{
+		std::unique_lock<std::mutex> lock{jobs_mutex_};
+		jobs_changed_.wait(lock, [this] { return stopping_ || !jobs_.empty(); });
+		if (stopping_)
+			return;
+		auto job = std::move(jobs_.front());
+		jobs_.pop_front();
+		lock.unlock();
+		// An exception leaving the thread would terminate the program.
+		try
+		{
+			compile_(job);
+		}
+		catch (std::exception const& ex)
+		{
+			fail_(job, ex.what());
+		}
+		catch (...)
+		{
+			fail_(job, "Unknown error");
+		}
+	}
+}
+
+// The function is compiled on first use instead.
+void BackgroundCompiler::fail_(Job const& job, std::string const& message)
+{
+	set_jit_context(nullptr);
+	std::lock_guard<std::mutex> lock{jobs_mutex_};
+	errors_.emplace_back(job.name + " : " + message);
+}
+
+// Contexts are not thread safe. The global context, and the contexts of installed functions, are only
+// used with the JIT lock, so the code is built in a context only used by this job until it is
+// installed. The functions it calls are compiled in the global context.
+void BackgroundCompiler::compile_(Job const& job)
+{
+	std::unique_lock<std::mutex> lock{jit_mutex()};
+	auto fun_it = funs_.find(job.name);
+	if (fun_it == std::end(funs_) || fun_it->second != job.function || job.function->version != job.version ||
+	    job.function->address)
+		return;
+	set_numeric_mode(job.numeric_mode);
+	set_algebra_mode(job.algebra_mode);
+	set_profile_mode(job.profile_mode);
+	{
+		PreparedFunction prepared{};
+		try
+		{
+			for (auto& elem : graph_.dependencies(job.name))
+			{
+				auto callee_it = funs_.find(elem);
+				if (callee_it != std::end(funs_) && callee_it->second->type == FunctionType::userdef &&
+				    !callee_it->second->address)
+					compile_function(elem, *callee_it->second, vars_, funs_);
+			}
+			set_jit_context(std::make_shared<llvm::LLVMContext>());
+			prepared = prepare_function(job.name, *job.function, vars_, funs_);
+		}
+		catch (InvalidInput const&)
+		{
+			// Reported when the function is used.
+			set_jit_context(nullptr);
+			return;
+		}
+		lock.unlock();
+		build_function(prepared, job.optimize);
+		lock.lock();
+		install_function(prepared, funs_);
+	}
+	// The code which was not installed is destroyed before its context.
+	set_jit_context(nullptr);
+}
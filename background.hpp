@@ -0,0 +1,87 @@
+// Copyright 2015 Benoît Vey
+
+#ifndef CALC_BACKGROUND_HPP_
+#define CALC_BACKGROUND_HPP_
+
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <map>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+class DependencyGraph;
+struct Function;
+enum class NumericMode;
+enum class AlgebraMode;
+enum class ProfileMode;
+
+enum class BackgroundMode
+{
+	off,
+	on,
+	optimize
+};
+
+// Compiles the functions defined in a session on a worker thread. The IR is generated while holding
+// the JIT lock, and the machine code without it, in a context of its own. The code is installed
+// unless the function changed in the meantime. Until then, functions are compiled on first use as
+// usual. The worker is started by the first submitted function.
+class BackgroundCompiler
+{
+	public:
+	BackgroundCompiler(std::map<std::string, double>&, std::map<std::string, Function*>&, DependencyGraph&);
+
+	BackgroundCompiler(BackgroundCompiler const&) = delete;
+	BackgroundCompiler& operator=(BackgroundCompiler const&) = delete;
+
+	BackgroundCompiler(BackgroundCompiler&&) = delete;
+	BackgroundCompiler& operator=(BackgroundCompiler&&) = delete;
+
+	~BackgroundCompiler();
+
+	BackgroundMode mode() const;
+	void set_mode(BackgroundMode);
+
+	// Must be called with the JIT lock held.
+	void submit(std::string const&);
+
+	// Waits for the worker. Must be called without the JIT lock. The next submitted function starts it
+	// again.
+	void stop();
+
+	// Errors of the jobs which failed since the last call, other than the invalid functions which are
+	// reported when used.
+	std::vector<std::string> take_errors();
+
+	private:
+	struct Job
+	{
+		std::string name;
+		Function* function;
+		std::uint64_t version;
+		NumericMode numeric_mode;
+		AlgebraMode algebra_mode;
+		ProfileMode profile_mode;
+		bool optimize;
+	};
+
+	void run_();
+	void compile_(Job const&);
+	void fail_(Job const&, std::string const&);
+
+	std::map<std::string, double>& vars_;
+	std::map<std::string, Function*>& funs_;
+	DependencyGraph& graph_;
+	BackgroundMode mode_;
+	std::deque<Job> jobs_;
+	std::mutex jobs_mutex_;
+	std::condition_variable jobs_changed_;
+	bool stopping_;
+	std::vector<std::string> errors_;
+	std::thread worker_;
+};
+
+#endif // Header guard
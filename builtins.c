@@ -0,0 +1,68 @@
+/* Copyright 2015 Benoît Vey */
+
+/* Builtins without an LLVM intrinsic. This file is compiled in the library, and to LLVM bitcode
+ * embedded in the library. The bitcode is linked into the modules where the builtins can be inlined
+ * and folded like intrinsics. It is compiled without errno, so that the calls to the C library have
+ * no side effects. */
+
+#include <math.h>
+#include <stdint.h>
+
+double calcfn_tan(double x)
+{
+	return tan(x);
+}
+
+double calcfn_asin(double x)
+{
+	return asin(x);
+}
+
+double calcfn_acos(double x)
+{
+	return acos(x);
+}
+
+double calcfn_atan(double x)
+{
+	return atan(x);
+}
+
+double calcfn_gamma(double x)
+{
+	return tgamma(x);
+}
+
+/* Philox4x32-10 (Salmon et al., "Parallel random numbers: as easy as 1, 2, 3"). Each number is a
+ * function of the seed, a stream and a counter in the stream, so streams can be drawn independently
+ * by threads and by the lanes of vectorized loops. Returns 53 random bits in [0, 1). */
+double calcfn_uniform(uint64_t seed, uint64_t stream, uint64_t counter)
+{
+	uint32_t c0 = (uint32_t)counter;
+	uint32_t c1 = (uint32_t)(counter >> 32);
+	uint32_t c2 = (uint32_t)stream;
+	uint32_t c3 = (uint32_t)(stream >> 32);
+	uint32_t k0 = (uint32_t)seed;
+	uint32_t k1 = (uint32_t)(seed >> 32);
+	for (int i = 0 ; i < 10 ; ++i)
+	{
+		uint64_t p0 = (uint64_t)0xD2511F53u * c0;
+		uint64_t p1 = (uint64_t)0xCD9E8D57u * c2;
+		uint32_t n0 = (uint32_t)(p1 >> 32) ^ c1 ^ k0;
+		uint32_t n2 = (uint32_t)(p0 >> 32) ^ c3 ^ k1;
+		c1 = (uint32_t)p1;
+		c3 = (uint32_t)p0;
+		c0 = n0;
+		c2 = n2;
+		k0 += 0x9E3779B9u;
+		k1 += 0xBB67AE85u;
+	}
+	return (double)((((uint64_t)c0 << 32) | c1) >> 11) * 0x1.0p-53;
+}
+
+double calcfn_sample(double min, double max, uint64_t seed, uint64_t stream, uint64_t counter)
+{
+	if (max < min)
+		return NAN;
+	return min + (max - min) * calcfn_uniform(seed, stream, counter);
+}
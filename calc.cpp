@@ -1,128 +1,189 @@
 // Copyright 2015 Benoît Vey
 
-#include <cassert>
-#include <cmath>
+#include <algorithm>
+#include <atomic>
+#include <cstdlib>
 #include <iostream>
-#include <map>
-#include <sstream>
+#include <memory>
 #include <string>
+#include <thread>
+#include <vector>
 
-#include <llvm/IR/DerivedTypes.h>
-#include <llvm/IR/IRBuilder.h>
-#include <llvm/IR/LLVMContext.h>
-#include <llvm/IR/Module.h>
-#include <llvm/IR/Verifier.h>
-#include <llvm/IR/Intrinsics.h>
-#include <llvm/ExecutionEngine/ExecutionEngine.h>
-#include <llvm/ExecutionEngine/MCJIT.h>
-#include <llvm/ExecutionEngine/GenericValue.h>
-#include <llvm/Support/TargetSelect.h>
-
-#include "Lexer.hpp"
-#include "Parser.hpp"
-#include "command_handler.hpp"
-#include "syntax_tree.hpp"
+#include <signal.h>
+#include <unistd.h>
+
+#include "jit.hpp"
+#include "server.hpp"
+#include "session.hpp"
+#include "trace.hpp"
 #include "utility.hpp"
+#include "watchdog.hpp"
 
 using namespace std::string_literals;
 
 namespace
 {
 
-void update_vars(std::map<std::string, double>& variables, llvm::Module& module, llvm::ExecutionEngine& engine)
+std::size_t const output_buffer_size{1 << 16};
+
+std::atomic<Session*> interrupted_session{nullptr};
+
+void interrupt(int)
 {
-	for (auto& elem : variables)
+	auto session = interrupted_session.load();
+	if (session)
+		session->cancel();
+}
+
+// While it exists, Ctrl^C stops the line being executed instead of the program. Must be destroyed
+// before the session.
+class CancelOnInterrupt
+{
+	public:
+	explicit CancelOnInterrupt(Session& session)
 	{
-		if (!module.getGlobalVariable(elem.first))
-			continue;
-		auto var = engine.getGlobalValueAddress(elem.first);
-		elem.second = *reinterpret_cast<double*>(var);
+		interrupted_session = &session;
+		struct sigaction action{};
+		action.sa_handler = &interrupt;
+		action.sa_flags = SA_RESTART;
+		sigemptyset(&action.sa_mask);
+		sigaction(SIGINT, &action, nullptr);
 	}
+
+	CancelOnInterrupt(CancelOnInterrupt const&) = delete;
+	CancelOnInterrupt& operator=(CancelOnInterrupt const&) = delete;
+
+	CancelOnInterrupt(CancelOnInterrupt&&) = delete;
+	CancelOnInterrupt& operator=(CancelOnInterrupt&&) = delete;
+
+	~CancelOnInterrupt()
+	{
+		signal(SIGINT, SIG_DFL);
+		interrupted_session = nullptr;
+	}
+};
+
+int usage()
+{
+	std::cerr << "Usage : calc [--perf-map] [--gdb] [--timeout ms] [--server socket_path [--threads count] |\n"
+	             "        --apply formula path | --record trace | --replay trace]\n";
+	return EXIT_FAILURE;
 }
 
 } // namespace
 
-int main()
+int main(int argc, char** argv)
 {
-	llvm::InitializeNativeTarget();
-	llvm::InitializeNativeTargetAsmParser();
-	llvm::InitializeNativeTargetAsmPrinter();
-
-	llvm::IRBuilder<> builder{llvm::getGlobalContext()};
+	try
+	{
+		initialize_jit();
+	}
+	catch (InvalidInput const& ex)
+	{
+		std::cerr << ex.what() << '\n';
+		return EXIT_FAILURE;
+	}
 
-	std::map<std::string, double> variables;
-	std::map<std::string, Function*> functions;
+	std::vector<std::string> args;
+	for (int i{1} ; i < argc ; ++i)
+	{
+		if (argv[i] == "--perf-map"s)
+			enable_listener(JitListener::perf_map);
+		else if (argv[i] == "--gdb"s)
+			enable_listener(JitListener::gdb);
+		else if (argv[i] == "--timeout"s && i + 1 < argc)
+			set_default_time_limit(std::chrono::milliseconds{std::strtoul(argv[++i], nullptr, 10)});
+		else
+			args.emplace_back(argv[i]);
+	}
 
-	Lexer lex{};
-	Parser par{variables, functions};
-	std::string in{};
-	std::cout << "Use !help to print help.\n";
-	std::cout << "Use Ctrl^D or !quit to exit.\n";
-	bool stop{false};
-	while (!stop)
+	ExpressionCache cache;
+	if (!args.empty() && args[0] == "--apply")
+	{
+		if (args.size() != 3)
+			return usage();
+		std::ios::sync_with_stdio(false);
+		Session session{cache};
+		CancelOnInterrupt cancel{session};
+		try
+		{
+			session.apply(args[2], args[1], std::cout);
+		}
+		catch (InvalidInput const& ex)
+		{
+			std::cout.flush();
+			std::cerr << "Invalid input : " << ex.what() << '\n';
+			return EXIT_FAILURE;
+		}
+		return EXIT_SUCCESS;
+	}
+	if (!args.empty() && args[0] == "--replay")
+	{
+		if (args.size() != 2)
+			return usage();
+		Session session{cache};
+		CancelOnInterrupt cancel{session};
+		try
+		{
+			replay_trace(args[1], session, std::cout);
+		}
+		catch (InvalidInput const& ex)
+		{
+			std::cerr << "Invalid input : " << ex.what() << '\n';
+			return EXIT_FAILURE;
+		}
+		return EXIT_SUCCESS;
+	}
+	std::unique_ptr<TraceRecorder> recorder;
+	if (!args.empty() && args[0] == "--record")
 	{
+		if (args.size() != 2)
+			return usage();
 		try
 		{
-			std::cout << "> ";
-			std::getline(std::cin, in);
-			lex.newline(std::move(in));
-			try
-			{
-				if (lex.peek() == '!' || lex.peek() == Token::eof)
-				{
-					auto c = parse_command(lex);
-					switch (c.type)
-					{
-						case CommandType::help:
-							execute_help(c.args.empty() ? nullptr : &c.args[0]);
-							break;
-						case CommandType::quit:
-							stop = true;
-							break;
-						case CommandType::env:
-							execute_env(c.args, variables, functions);
-							break;
-						case CommandType::import:
-							execute_import(c.args, variables, functions);
-							break;
-						case CommandType::del:
-							execute_del(c.args, variables, functions);
-							break;
-						case CommandType::def:
-							execute_def(c.args, variables, functions, par, lex);
-							break;
-					}
-					continue;
-				}
-			}
-			catch (InvalidInput const& ex)
-			{
-				std::cout << "Invalid command : " << ex.what() << '\n';
-				continue;
-			}
-			auto ast = par.parse(lex);
-
-			auto module = std::make_unique<llvm::Module>("CalcMain", llvm::getGlobalContext());
-			auto main_ref = module.get();
-			auto calc_type = llvm::FunctionType::get(llvm::Type::getDoubleTy(llvm::getGlobalContext()), {}, false);
-			auto calc_main = llvm::Function::Create(calc_type, llvm::Function::ExternalLinkage, "cmain", main_ref);
-
-			auto block = llvm::BasicBlock::Create(llvm::getGlobalContext(), "entry", calc_main);
-			builder.SetInsertPoint(block);
-			builder.CreateRet(ast->codegen(*main_ref, builder));
-
-			llvm::verifyFunction(*calc_main);
-
-			std::unique_ptr<llvm::ExecutionEngine> engine{llvm::EngineBuilder{std::move(module)}.create()};
-			engine->finalizeObject();
-
-			std::cout << engine->runFunction(calc_main, {}).DoubleVal << '\n';
-
-			update_vars(variables, *main_ref, *engine);
+			recorder.reset(new TraceRecorder{args[1]});
 		}
 		catch (InvalidInput const& ex)
 		{
-			std::cout << "Invalid input : " << ex.what() << '\n';
+			std::cerr << "Invalid input : " << ex.what() << '\n';
+			return EXIT_FAILURE;
 		}
 	}
+	else if (!args.empty())
+	{
+		if (args[0] != "--server" || args.size() < 2)
+			return usage();
+		std::size_t threads{std::max(std::thread::hardware_concurrency(), 1u)};
+		if (args.size() == 4 && args[2] == "--threads")
+			threads = std::strtoul(args[3].c_str(), nullptr, 10);
+		else if (args.size() != 2)
+			return usage();
+		if (threads == 0)
+			return usage();
+		return run_server(args[1], threads, cache);
+	}
+
+	// Results are written in large blocks. Batch input does not need the output flushed before each
+	// line is read.
+	static char output_buffer[output_buffer_size];
+	std::ios::sync_with_stdio(false);
+	std::cout.rdbuf()->pubsetbuf(output_buffer, output_buffer_size);
+	if (!isatty(STDIN_FILENO))
+		std::cin.tie(nullptr);
+
+	Session session{cache};
+	CancelOnInterrupt cancel{session};
+	std::string in{};
+	std::cout << "Use !help to print help.\n";
+	std::cout << "Use Ctrl^D or !quit to exit.\n";
+	bool stop{false};
+	while (!stop)
+	{
+		std::cout << "> ";
+		std::getline(std::cin, in);
+		if (recorder)
+			stop = !recorder->execute(std::move(in), session, std::cout);
+		else
+			stop = !session.execute(std::move(in), std::cout);
+	}
 }
@@ -0,0 +1,185 @@
+// Copyright 2015 Benoît Vey
+
+#include "cells.hpp"
+
+#include <algorithm>
+#include <iostream>
+
+#include <llvm/IR/Verifier.h>
+#include <llvm/ExecutionEngine/ExecutionEngine.h>
+#include <llvm/ExecutionEngine/MCJIT.h>
+
+#include "arrays.hpp"
+#include "dependency_graph.hpp"
+#include "jit.hpp"
+#include "output.hpp"
+#include "syntax_tree.hpp"
+#include "watchdog.hpp"
+
+Cells::Cells(std::map<std::string, double>& vars, std::map<std::string, Function*>& funs,
+             std::map<std::string, Array>& arrays, DependencyGraph& graph)
+	: vars_{vars}, funs_{funs}, arrays_{arrays}, graph_{graph}
+{}
+
+Cells::~Cells() = default;
+
+void Cells::define(std::string const& name, ExprNode formula, std::set<std::string> deps)
+{
+	for (auto& elem : deps)
+	{
+		if (elem == name || graph_.depends_on(elem, name))
+			throw InvalidInput{"Circular cell reference : " + elem + " depends on " + name};
+		if (vars_.find(elem) == std::end(vars_) && funs_.find(elem) == std::end(funs_) &&
+		    arrays_.find(elem) == std::end(arrays_))
+			throw InvalidInput{"Undeclared identifier : " + elem};
+	}
+	if (formula->is_array())
+		throw InvalidInput{"Cell " + name + " must be a number"};
+	if (arrays_.find(name) != std::end(arrays_))
+		throw InvalidInput{"Cannot define cell over array " + name + ". Use !del first"};
+	if (funs_.find(name) != std::end(funs_))
+		check_replaceable(name, graph_, funs_);
+
+	auto created = vars_.find(name) == std::end(vars_);
+	if (created)
+		vars_[name] = 0.0;
+	ExprNode old_formula;
+	std::set<std::string> old_deps;
+	auto cell_it = formulas_.find(name);
+	if (cell_it != std::end(formulas_))
+	{
+		old_formula = std::move(cell_it->second);
+		old_deps = graph_.dependencies(name);
+	}
+	else if (funs_.find(name) != std::end(funs_))
+		old_deps = graph_.dependencies(name);
+
+	formulas_[name] = std::move(formula);
+	graph_.set_dependencies(name, std::move(deps));
+	try
+	{
+		recompute_dependents_({name});
+	}
+	catch (InvalidInput const&)
+	{
+		if (old_formula)
+			formulas_[name] = std::move(old_formula);
+		else
+			formulas_.erase(name);
+		graph_.set_dependencies(name, std::move(old_deps));
+		if (created)
+			vars_.erase(name);
+		throw;
+	}
+
+	auto fun_it = funs_.find(name);
+	if (fun_it != std::end(funs_))
+	{
+		output() << "Warning : overriding function " << name << '\n';
+		funs_.erase(fun_it);
+		invalidate_dependents(name, graph_, funs_);
+	}
+	output() << name << " = ";
+	write_number(output(), vars_[name]);
+	output() << '\n';
+}
+
+void Cells::touch(std::string const& name)
+{
+	dirty_.insert(name);
+}
+
+void Cells::update()
+{
+	auto changed = std::move(dirty_);
+	dirty_.clear();
+	// The cells assigned, deleted or replaced since the last update are not cells anymore.
+	for (auto& elem : changed)
+	{
+		if (formulas_.find(elem) == std::end(formulas_))
+			continue;
+		if (vars_.find(elem) != std::end(vars_))
+			output() << "Warning : overriding cell " << elem << '\n';
+		drop_(elem);
+	}
+	if (!changed.empty())
+		recompute_dependents_(changed);
+}
+
+std::map<std::string, ExprNode> const& Cells::formulas() const
+{
+	return formulas_;
+}
+
+void Cells::drop_(std::string const& name)
+{
+	if (funs_.find(name) == std::end(funs_))
+		graph_.remove(name);
+	formulas_.erase(name);
+}
+
+void Cells::recompute_dependents_(std::set<std::string> const& changed)
+{
+	std::vector<std::string> order;
+	for (auto& elem : graph_.sorted_dependents(changed))
+	{
+		if (formulas_.find(elem) == std::end(formulas_))
+			continue;
+		auto& deps = graph_.dependencies(elem);
+		auto missing_it = std::find_if(std::begin(deps), std::end(deps), [this](std::string const& dep)
+		{
+			return vars_.find(dep) == std::end(vars_) && funs_.find(dep) == std::end(funs_) &&
+			       arrays_.find(dep) == std::end(arrays_);
+		});
+		if (missing_it != std::end(deps))
+		{
+			output() << "Warning : cell " << elem << " uses undeclared identifier " << *missing_it << '\n';
+			continue;
+		}
+		order.emplace_back(elem);
+	}
+	if (!order.empty())
+		recompute_(order);
+}
+
+void Cells::recompute_(std::vector<std::string> const& order)
+{
+	auto module = std::make_unique<llvm::Module>("CalcCells", jit_context());
+	auto module_ref = module.get();
+	auto update_type = llvm::FunctionType::get(llvm::Type::getVoidTy(jit_context()), {}, false);
+	auto cell_update = llvm::Function::Create(update_type, llvm::Function::ExternalLinkage, "cupdate", module_ref);
+
+	llvm::IRBuilder<> builder{jit_context()};
+	auto block = llvm::BasicBlock::Create(jit_context(), "entry", cell_update);
+	builder.SetInsertPoint(block);
+	for (auto& elem : order)
+		builder.CreateStore(formulas_[elem]->codegen(*module_ref, builder), declare_variable(*module_ref, elem));
+	builder.CreateRetVoid();
+
+	llvm::verifyFunction(*cell_update);
+
+	auto engine = create_engine(std::move(module));
+	link_symbols(*module_ref, *engine, vars_, funs_);
+	engine->finalizeObject();
+
+	// The cells keep their values if their code fails.
+	std::vector<double> previous;
+	for (auto& elem : order)
+		previous.emplace_back(vars_[elem]);
+	auto compiled = reinterpret_cast<void(*)()>(engine->getFunctionAddress("cupdate"));
+	{
+		JitUnlock unlock;
+		compiled();
+	}
+	try
+	{
+		check_array_lengths();
+		check_watchdog();
+	}
+	catch (InvalidInput const&)
+	{
+		for (std::size_t i{0} ; i < order.size() ; ++i)
+			vars_[order[i]] = previous[i];
+		throw;
+	}
+}
@@ -0,0 +1,54 @@
+// Copyright 2015 Benoît Vey
+
+#ifndef CALC_CELLS_HPP_
+#define CALC_CELLS_HPP_
+
+#include <map>
+#include <memory>
+#include <set>
+#include <string>
+#include <vector>
+
+class DependencyGraph;
+class ExprTree;
+struct Array;
+using ExprNode = std::unique_ptr<ExprTree>;
+struct Function;
+
+// Cells are variables recomputed from their formula after each line changing the identifiers they
+// depend on, directly or through other cells. The lines touch the identifiers they assign, define or
+// delete, and update then recomputes their dependents. Touching a cell turns it into a variable.
+class Cells
+{
+	public:
+	Cells(std::map<std::string, double>&, std::map<std::string, Function*>&, std::map<std::string, Array>&,
+	      DependencyGraph&);
+
+	Cells(Cells const&) = delete;
+	Cells& operator=(Cells const&) = delete;
+
+	Cells(Cells&&) = default;
+	Cells& operator=(Cells&&) = default;
+
+	~Cells();
+
+	void define(std::string const&, ExprNode, std::set<std::string>);
+	void touch(std::string const&);
+	void update();
+
+	std::map<std::string, ExprNode> const& formulas() const;
+
+	private:
+	void drop_(std::string const&);
+	void recompute_dependents_(std::set<std::string> const&);
+	void recompute_(std::vector<std::string> const&);
+
+	std::map<std::string, double>& vars_;
+	std::map<std::string, Function*>& funs_;
+	std::map<std::string, Array>& arrays_;
+	DependencyGraph& graph_;
+	std::map<std::string, ExprNode> formulas_;
+	std::set<std::string> dirty_;
+};
+
+#endif // Header guard
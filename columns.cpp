@@ -0,0 +1,109 @@
+// Copyright 2015 Benoît Vey
+
+#include "columns.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <cassert>
+#include <thread>
+
+#include <llvm/IR/Verifier.h>
+#include <llvm/ExecutionEngine/ExecutionEngine.h>
+#include <llvm/ExecutionEngine/MCJIT.h>
+
+#include "arrays.hpp"
+#include "jit.hpp"
+#include "syntax_tree.hpp"
+#include "watchdog.hpp"
+
+namespace
+{
+
+char const columns_prefix[] = "calccol_";
+
+// Smaller chunks are not worth a thread.
+std::uint64_t const min_chunk_rows{1 << 16};
+
+} // namespace
+
+void compile_columns(std::string const& name, Function& fn, std::map<std::string, double>& vars,
+                     std::map<std::string, Function*>& funs)
+{
+	assert(fn.type == FunctionType::columnar);
+	auto& ctx = jit_context();
+	auto module = std::make_unique<llvm::Module>("CalcColumns_" + name, ctx);
+	auto module_ref = module.get();
+	auto column_type = llvm::Type::getDoublePtrTy(ctx);
+	auto kernel_type = llvm::FunctionType::get(llvm::Type::getVoidTy(ctx),
+	                                           {column_type->getPointerTo(), column_type, llvm::Type::getInt64Ty(ctx)},
+	                                           false);
+	auto kernel = llvm::Function::Create(kernel_type, llvm::Function::ExternalLinkage, columns_prefix + name,
+	                                     module_ref);
+	auto arg_it = kernel->arg_begin();
+	auto columns = &*arg_it++;
+	auto out = &*arg_it++;
+	auto rows = &*arg_it;
+	columns->setName("columns");
+	out->setName("out");
+	rows->setName("rows");
+
+	llvm::IRBuilder<> builder{ctx};
+	auto block = llvm::BasicBlock::Create(ctx, "entry", kernel);
+	builder.SetInsertPoint(block);
+	fn.param_values.clear();
+	for (std::size_t i{0} ; i != fn.param_names.size() ; ++i)
+		fn.param_values.emplace_back(builder.CreateLoad(builder.CreateConstGEP1_64(columns, i), fn.param_names[i]));
+
+	{
+		ArrayLoop loop{*module_ref, builder};
+		loop.prepare(*fn.body);
+		// Other arrays would restart at each chunk.
+		if (loop.has_lengths())
+			throw InvalidInput{"Only columns can be used as arrays in columnar formulas"};
+		loop.add_length(rows);
+		loop.length();
+		loop.begin();
+		auto value = convert_number(builder, fn.body->codegen(*module_ref, builder), llvm::Type::getDoubleTy(ctx));
+		builder.CreateStore(value, builder.CreateGEP(out, loop.index()));
+		loop.end();
+	}
+	builder.CreateRetVoid();
+
+	llvm::verifyFunction(*kernel);
+
+	auto engine = create_engine(std::move(module));
+	link_symbols(*module_ref, *engine, vars, funs);
+	engine->finalizeObject();
+
+	fn.address = engine->getFunctionAddress(columns_prefix + name);
+	fn.engine = std::move(engine);
+}
+
+void apply_columns(ColumnKernel kernel, std::vector<double const*> const& columns, double* out, std::uint64_t rows,
+                   std::size_t threads)
+{
+	auto chunks = std::max<std::uint64_t>(std::min<std::uint64_t>(threads, rows / min_chunk_rows), 1);
+	auto chunk_rows = (rows + chunks - 1) / chunks;
+	auto watchdog = current_watchdog();
+	std::atomic<bool> mismatch{false};
+	auto run_chunk = [&](std::uint64_t first)
+	{
+		set_current_watchdog(watchdog);
+		auto count = std::min(chunk_rows, rows - first);
+		std::vector<double const*> chunk_columns;
+		for (auto& elem : columns)
+			chunk_columns.emplace_back(elem + first);
+		kernel(chunk_columns.data(), out + first, count);
+		if (take_length_mismatch())
+			mismatch = true;
+	};
+
+	std::vector<std::thread> workers;
+	for (std::uint64_t first{chunk_rows} ; first < rows ; first += chunk_rows)
+		workers.emplace_back(run_chunk, first);
+	run_chunk(0);
+	for (auto& elem : workers)
+		elem.join();
+	if (mismatch)
+		calcrt_array_mismatch();
+}
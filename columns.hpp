@@ -0,0 +1,25 @@
+// Copyright 2015 Benoît Vey
+
+#ifndef CALC_COLUMNS_HPP_
+#define CALC_COLUMNS_HPP_
+
+#include <cstdint>
+#include <map>
+#include <string>
+#include <vector>
+
+struct Function;
+
+// Evaluates a columnar function on each row of its columns. Takes one pointer per parameter, the
+// output buffer and the number of rows.
+using ColumnKernel = void (*)(double const* const*, double*, std::uint64_t);
+
+void compile_columns(std::string const&, Function&, std::map<std::string, double>&,
+                     std::map<std::string, Function*>&);
+
+// Splits the rows in contiguous chunks evaluated on up to the given number of threads, which watch
+// the watchdog of the calling thread. Array length mismatches of the threads are reported by the next
+// check_array_lengths of the calling thread.
+void apply_columns(ColumnKernel, std::vector<double const*> const&, double*, std::uint64_t, std::size_t);
+
+#endif // Header guard
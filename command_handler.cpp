@@ -5,14 +5,33 @@
 #include <algorithm>
 #include <array>
 #include <cassert>
+#include <cctype>
+#include <chrono>
 #include <cmath>
+#include <fstream>
 #include <iostream>
-#include <random>
+#include <iterator>
+#include <limits>
+#include <sstream>
+#include <thread>
 
 #include "Lexer.hpp"
 #include "Parser.hpp"
+#include "arrays.hpp"
+#include "background.hpp"
+#include "cells.hpp"
+#include "columns.hpp"
+#include "csv.hpp"
+#include "dependency_graph.hpp"
+#include "export.hpp"
+#include "jit.hpp"
+#include "library.hpp"
+#include "output.hpp"
+#include "profile.hpp"
+#include "random.hpp"
 #include "syntax_tree.hpp"
 #include "utility.hpp"
+#include "watchdog.hpp"
 
 using namespace std::string_literals;
 
@@ -43,9 +62,41 @@ std::map<std::string, std::size_t> builtin_funs
 	 {"acos", 14},
 	 {"atan", 15},
 	 {"gamma", 16},
-	 {"rand", 17}};
+	 {"rand", 17},
+	 {"sum", 18},
+	 {"mean", 19},
+	 {"dot", 20},
+	 {"len", 21}};
 
-std::array<Function, 18> bf_impl
+std::vector<std::pair<std::string, NumericMode>> const numeric_modes
+	{{"float64", NumericMode::float64},
+	 {"int64", NumericMode::int64},
+	 {"float32", NumericMode::float32}};
+
+std::vector<std::pair<std::string, AlgebraMode>> const algebra_modes
+	{{"exact", AlgebraMode::exact},
+	 {"fast", AlgebraMode::fast}};
+
+std::vector<std::pair<std::string, BackgroundMode>> const background_modes
+	{{"off", BackgroundMode::off},
+	 {"on", BackgroundMode::on},
+	 {"optimize", BackgroundMode::optimize}};
+
+std::vector<std::pair<std::string, ProfileMode>> const profile_modes
+	{{"off", ProfileMode::off},
+	 {"on", ProfileMode::calls},
+	 {"cycles", ProfileMode::cycles}};
+
+std::size_t const reported_functions{20};
+
+std::chrono::milliseconds const bench_duration{200};
+std::size_t const max_bench_runs{1000000};
+
+int const max_format_digits{17};
+
+// Sample indices stay exact in the numbers of the expressions.
+double const max_samples{9007199254740992.0};
+std::array<Function, 22> bf_impl
 	{{{nullptr, {"x"}, {}, llvm::Intrinsic::sqrt, FunctionType::intrinsic},
 	  {nullptr, {"x"}, {}, llvm::Intrinsic::ceil, FunctionType::intrinsic},
 	  {nullptr, {"x"}, {}, llvm::Intrinsic::floor, FunctionType::intrinsic},
@@ -63,46 +114,11 @@ std::array<Function, 18> bf_impl
 	  {nullptr, {"x"}, {}, llvm::Intrinsic::not_intrinsic, FunctionType::builtin},
 	  {nullptr, {"x"}, {}, llvm::Intrinsic::not_intrinsic, FunctionType::builtin},
 	  {nullptr, {"x"}, {}, llvm::Intrinsic::not_intrinsic, FunctionType::builtin},
-	  {nullptr, {"min", "max"}, {}, llvm::Intrinsic::not_intrinsic, FunctionType::builtin}}};
-
-} // namespace
-
-extern "C" double calcfn_tan(double x)
-{
-	return std::tan(x);
-}
-
-extern "C" double calcfn_asin(double x)
-{
-	return std::asin(x);
-}
-
-extern "C" double calcfn_acos(double x)
-{
-	return std::acos(x);
-}
-
-extern "C" double calcfn_atan(double x)
-{
-	return std::atan(x);
-}
-
-extern "C" double calcfn_gamma(double x)
-{
-	return std::tgamma(x);
-}
-
-extern "C" double calcfn_rand(double min, double max)
-{
-	static std::mt19937 engine{std::random_device{}()};
-	if (max < min)
-		return std::numeric_limits<double>::quiet_NaN();
-	std::uniform_real_distribution<> dist{min, max};
-	return dist(engine);
-}
-
-namespace
-{
+	  {nullptr, {"min", "max"}, {}, llvm::Intrinsic::not_intrinsic, FunctionType::builtin},
+	  {nullptr, {"a"}, {}, llvm::Intrinsic::not_intrinsic, FunctionType::reduction},
+	  {nullptr, {"a"}, {}, llvm::Intrinsic::not_intrinsic, FunctionType::reduction},
+	  {nullptr, {"a", "b"}, {}, llvm::Intrinsic::not_intrinsic, FunctionType::reduction},
+	  {nullptr, {"a"}, {}, llvm::Intrinsic::not_intrinsic, FunctionType::reduction}}};
 
 char const* help_doc()
 {
@@ -160,7 +176,12 @@ char const* import_doc()
 	"\t\t\tmin(x, y) : Smaller of x and y.\n"
 	"\t\t\tmax(x, y) : Greater of x and y.\n"
 	"\t\t\tgamma(x) : Gamma function of x.\n"
-	"\t\t\trand(min, max) : Random number between min and max.\n";
+	"\t\t\trand(min, max) : Random number between min and max.\n"
+	"\t\tReductions :\n"
+	"\t\t\tsum(a) : Sum of the elements of array a.\n"
+	"\t\t\tmean(a) : Arithmetic mean of the elements of array a.\n"
+	"\t\t\tdot(a, b) : Dot product of arrays a and b.\n"
+	"\t\t\tlen(a) : Number of elements of array a.\n";
 }
 
 char const* del_doc()
@@ -177,16 +198,317 @@ char const* def_doc()
 	"Def command :\n"
 	"\tSyntax : !def name([params...]) = body\n"
 	"\tDefine new functions. Body can be any valid expression.\n"
+	"\tlet name = value, ... in expression computes a value once and names it in\n"
+	"\tthe expression.\n"
+	"\tFunctions are compiled in the background once defined, or on first use if\n"
+	"\tthey are used before (see !background). Redefining or deleting an identifier\n"
+	"\tonly recompiles the functions depending on it.\n"
 	"\tNote : Recursive function calls are not allowed.\n";
 }
 
+char const* load_doc()
+{
+	return
+	"Load command :\n"
+	"\tSyntax : !load paths...\n"
+	"\tDefine the functions of library files. Each line of a file is a !def\n"
+	"\tcommand, an empty line or a comment starting with #. Functions can call\n"
+	"\tthe functions of any file, in any order. The files are parsed and the\n"
+	"\tfunctions compiled on all processors. Functions assigning variables or\n"
+	"\tusing undeclared identifiers are compiled on first use.\n"
+	"\tNothing is defined if a line is invalid.\n";
+}
+
+char const* background_doc()
+{
+	return
+	"Background command :\n"
+	"\tSyntax : !background [off|on|optimize]\n"
+	"\tChoose how functions defined with !def are compiled. Without arguments,\n"
+	"\tprint the current choice.\n"
+	"\tChoices :\n"
+	"\t\toff : Functions are compiled on first use.\n"
+	"\t\ton : Functions are compiled on another thread once defined. Functions\n"
+	"\t\t     used before are compiled on first use.\n"
+	"\t\toptimize : Same as on, and the code is fully optimized.\n";
+}
+
+char const* profile_doc()
+{
+	return
+	"Profile command :\n"
+	"\tSyntax : !profile [off|on|cycles|report|reset]\n"
+	"\tCount the calls to functions, builtins and operators calling the math\n"
+	"\tlibrary. Without arguments, print the current choice.\n"
+	"\tChoices :\n"
+	"\t\toff : Calls are not counted.\n"
+	"\t\ton : Calls are counted.\n"
+	"\t\tcycles : Calls are counted, with the processor cycles spent in them.\n"
+	"\tFunctions are recompiled for the new choice on their next use.\n"
+	"\treport : Print the most expensive functions, counted for the whole program.\n"
+	"\treset : Start counting from zero.\n";
+}
+
+char const* seed_doc()
+{
+	return
+	"Seed command :\n"
+	"\tSyntax : !seed [number]\n"
+	"\tSet the seed of rand for the whole program. Each thread then draws its\n"
+	"\tnumbers from the beginning of a new stream, so the numbers drawn by a\n"
+	"\tsession are reproducible. Without arguments, print the current seed.\n";
+}
+
+char const* timeout_doc()
+{
+	return
+	"Timeout command :\n"
+	"\tSyntax : !timeout [milliseconds]\n"
+	"\tSet the time a line can run before being stopped, 0 for no limit. Loops\n"
+	"\tcheck it every few thousand iterations, and the stopped line does not change\n"
+	"\tthe environment. Ctrl^C stops the running line too. Without arguments, print\n"
+	"\tthe current limit.\n";
+}
+
+char const* montecarlo_doc()
+{
+	return
+	"Montecarlo command :\n"
+	"\tSyntax : !montecarlo expression samples\n"
+	"\tEvaluate the expression for the given number of samples, on all processors,\n"
+	"\tand print the mean with its standard error. Each call to rand in the\n"
+	"\texpression draws from a stream of its own, at the index of the sample, so\n"
+	"\tthe samples are vectorized and the result only depends on the seed.\n"
+	"\tThe expression and its functions cannot assign variables, and rand cannot\n"
+	"\tbe called in arrays or by the functions.\n"
+	"\tExample : !montecarlo 4 * sqrt(1 - rand(0, 1)^2) 1e9\n";
+}
+
+char const* check_doc()
+{
+	return
+	"Check command :\n"
+	"\tSyntax : !check paths...\n"
+	"\tReport the errors of files of input lines without executing them, with\n"
+	"\ttheir line and column. All the errors of each line are reported. Calls are\n"
+	"\tchecked against the functions of the environment, and the functions defined\n"
+	"\tand imported by the previous lines.\n";
+}
+
+char const* apply_doc()
+{
+	return
+	"Apply command :\n"
+	"\tSyntax : !apply path formula\n"
+	"\tEvaluate the formula on each row of a CSV file of numbers, and print the\n"
+	"\tresults in the order of the rows, one per line. The first line of the file\n"
+	"\tnames the columns, which are the variables of the formula. Empty fields are\n"
+	"\tnan. The file is streamed in chunks evaluated on all processors, so its size\n"
+	"\tis not limited by memory. The formula cannot assign variables.\n"
+	"\tExample : !apply trades.csv price * quantity\n";
+}
+
+char const* format_doc()
+{
+	return
+	"Format command :\n"
+	"\tSyntax : !format [digits|shortest|binary]\n"
+	"\tChoose how numbers are printed. Without arguments, print the current choice.\n"
+	"\tChoices :\n"
+	"\t\tdigits : Numbers are rounded to the given number of significant digits,\n"
+	"\t\t         between 1 and 17. The default is 6.\n"
+	"\t\tshortest : Numbers are printed with the fewest digits reading back to the\n"
+	"\t\t           same number.\n"
+	"\t\tbinary : Results are written as native doubles, arrays with all their\n"
+	"\t\t         elements, without separators. Other numbers are printed as in\n"
+	"\t\t         shortest.\n";
+}
+
+char const* cell_doc()
+{
+	return
+	"Cell command :\n"
+	"\tSyntax : !cell name = formula\n"
+	"\tDefine a variable computed from a formula. Body can be any valid expression.\n"
+	"\tEach time a variable, cell or function used by the formula changes, the cell\n"
+	"\tand the cells depending on it are recomputed.\n"
+	"\tAssigning a value to a cell turns it back into a regular variable.\n";
+}
+
+char const* mode_doc()
+{
+	return
+	"Mode command :\n"
+	"\tSyntax : !mode [float64|int64|float32]\n"
+	"\tSet how numbers are computed. Without arguments, print the current mode.\n"
+	"\tModes :\n"
+	"\t\tfloat64 : Every number is a double precision floating point number.\n"
+	"\t\tint64 : Expressions made of integer literals and ranges with +, -, *, % by a\n"
+	"\t\t        constant and ^ by a constant are computed with 64 bits integers.\n"
+	"\t\t        Computations overflowing 64 bits are done again with doubles.\n"
+	"\t\tfloat32 : Arrays are stored and computed in single precision. Array\n"
+	"\t\t          computations are up to twice as fast but much less precise.\n"
+	"\tFunctions are recompiled for the new mode on their next use.\n";
+}
+
+char const* algebra_doc()
+{
+	return
+	"Algebra command :\n"
+	"\tSyntax : !algebra [exact|fast]\n"
+	"\tSet how expressions are rewritten before being compiled. Without arguments,\n"
+	"\tprint the current mode.\n"
+	"\tModes :\n"
+	"\t\texact : Results are the same as without rewriting. x ^ 0.5 is a square root,\n"
+	"\t\t        x ^ 2 and x ^ -1 are a multiplication and a division, and\n"
+	"\t\t        divisions by powers of two are multiplications.\n"
+	"\t\tfast : Results may differ in the last digits. Powers by integers up to 32\n"
+	"\t\t       are chains of multiplications, x ^ -0.5 is the inverse of a square\n"
+	"\t\t       root, divisions by constants are multiplications by their inverse\n"
+	"\t\t       and polynomials of a single variable are computed in Horner form.\n"
+	"\tThe default is exact. Functions are recompiled for the new mode on their next\n"
+	"\tuse.\n";
+}
+
+char const* bench_doc()
+{
+	return
+	"Bench command :\n"
+	"\tSyntax : !bench expression\n"
+	"\tCompile and run the expression repeatedly in each numeric mode, and print\n"
+	"\tthe average time of a run. Array assignments are discarded, but variable\n"
+	"\tassignments happen on each run.\n";
+}
+
+char const* map_doc()
+{
+	return
+	"Map command :\n"
+	"\tSyntax : !map name = formula\n"
+	"\tEvaluate the formula on each element of the arrays it uses, and store the\n"
+	"\tresult in the array name. The arrays are split in chunks evaluated on all\n"
+	"\tprocessors. The arrays must have the same length and double precision.\n"
+	"\tThe formula cannot assign variables, even through the functions it calls.\n";
+}
+
+char const* export_doc()
+{
+	return
+	"Export command :\n"
+	"\tSyntax : !export path [cpu]\n"
+	"\tCompile every function to an object file, or to a shared library if path\n"
+	"\tends with .so, along with a C header declaring them. The code is optimized\n"
+	"\tfor the given CPU, or for this CPU by default, and only needs the C math\n"
+	"\tlibrary. A function f is exported as calcdef_f and a variable v used by the\n"
+	"\tfunctions as calcvar_v, initialized with its current value.\n"
+	"\tFunctions using rand or arrays of the environment cannot be exported.\n";
+}
+
+char const* mem_doc()
+{
+	return
+	"Mem command :\n"
+	"\tSyntax : !mem [limit]\n"
+	"\tPrint the memory used by syntax trees, the environment, the IR kept by the\n"
+	"\tcompiled modules and the compiled code. Syntax trees and compiled code are\n"
+	"\tcounted for the whole program.\n"
+	"\tWith an argument, set the limit of compiled code and data for the whole\n"
+	"\tprogram, in bytes or with a K, M or G suffix. Over the limit, the least\n"
+	"\trecently used functions and cached expressions are evicted and compiled\n"
+	"\tagain on their next use. Each session evicts its own functions, and keeps\n"
+	"\tthe code used by its current line. 0 removes the limit.\n";
+}
+
+char const* op_doc()
+{
+	return
+	"Op command :\n"
+	"\tSyntax : !op [symbol [precedence associativity function]]\n"
+	"\tDefine the binary operator symbol as a call to the given function of 2\n"
+	"\targuments. The symbol is one of & | < > @ $ # ~ ?, the precedence is between\n"
+	"\t6 and 39 (+ is 10, * is 20 and ^ is 30) and the associativity is left or\n"
+	"\tright. With only a symbol, remove the operator. Without arguments, list the\n"
+	"\tuser-defined operators.\n"
+	"\tExample : !op @ 15 left hypot\n";
+}
+
 std::map<std::string, CommandCarac> commands
 	{{"help", {CommandType::help, EqMinMax::max, 1, help_doc()}},
 	 {"quit", {CommandType::quit, EqMinMax::equal, 0, quit_doc()}},
 	 {"env", {CommandType::env, EqMinMax::min, 0, env_doc()}},
 	 {"import", {CommandType::import, EqMinMax::min, 1, import_doc()}},
 	 {"del", {CommandType::del, EqMinMax::min, 1, del_doc()}},
-	 {"def", {CommandType::def, EqMinMax::min, 0, def_doc()}}};
+	 {"def", {CommandType::def, EqMinMax::min, 0, def_doc()}},
+	 {"cell", {CommandType::cell, EqMinMax::equal, 1, cell_doc()}},
+	 {"mode", {CommandType::mode, EqMinMax::max, 1, mode_doc()}},
+	 {"algebra", {CommandType::algebra, EqMinMax::max, 1, algebra_doc()}},
+	 {"bench", {CommandType::bench, EqMinMax::min, 0, bench_doc()}},
+	 {"map", {CommandType::map, EqMinMax::equal, 1, map_doc()}},
+	 {"export", {CommandType::export_, EqMinMax::min, 1, export_doc()}},
+	 {"mem", {CommandType::mem, EqMinMax::max, 1, mem_doc()}},
+	 {"op", {CommandType::op, EqMinMax::max, 4, op_doc()}},
+	 {"load", {CommandType::load, EqMinMax::min, 1, load_doc()}},
+	 {"background", {CommandType::background, EqMinMax::max, 1, background_doc()}},
+	 {"profile", {CommandType::profile, EqMinMax::max, 1, profile_doc()}},
+	 {"seed", {CommandType::seed, EqMinMax::max, 1, seed_doc()}},
+	 {"timeout", {CommandType::timeout, EqMinMax::max, 1, timeout_doc()}},
+	 {"montecarlo", {CommandType::montecarlo, EqMinMax::min, 0, montecarlo_doc()}},
+	 {"format", {CommandType::format, EqMinMax::max, 1, format_doc()}},
+	 {"apply", {CommandType::apply, EqMinMax::min, 0, apply_doc()}},
+	 {"check", {CommandType::check, EqMinMax::min, 1, check_doc()}}};
+
+std::string format_bytes(std::size_t bytes)
+{
+	char const* units[] = {"B", "KB", "MB", "GB"};
+	auto value = static_cast<double>(bytes);
+	std::size_t unit{0};
+	for ( ; value >= 1024 && unit < 3 ; ++unit)
+		value /= 1024;
+	std::ostringstream formatted;
+	formatted.precision(unit == 0 ? 4 : 3);
+	formatted << value << ' ' << units[unit];
+	return formatted.str();
+}
+
+std::size_t parse_bytes(std::string const& text)
+{
+	// stoull skips spaces and accepts signs, negating the value.
+	if (text.empty() || !std::isdigit(static_cast<unsigned char>(text[0])))
+		throw InvalidInput{"Invalid size : " + text};
+	std::size_t end{0};
+	unsigned long long value{0};
+	try
+	{
+		value = std::stoull(text, &end);
+	}
+	catch (std::exception const&)
+	{
+		throw InvalidInput{"Invalid size : " + text};
+	}
+	auto suffix = text.substr(end);
+	auto scale = std::string{"BKMG"}.find(suffix.empty() ? 'B' : std::toupper(suffix[0]));
+	if (suffix.size() > 1 || scale == std::string::npos)
+		throw InvalidInput{"Invalid size : " + text};
+	if (value > (std::numeric_limits<std::size_t>::max() >> (10 * scale)))
+		throw InvalidInput{"Size too large : " + text};
+	return static_cast<std::size_t>(value) << (10 * scale);
+}
+
+// Names are short strings stored in the nodes of the maps, which cost about 4 pointers each. Longer
+// names than the capacity of an empty string are allocated apart.
+template <typename T>
+std::size_t map_bytes(std::map<std::string, T> const& env)
+{
+	auto inline_capacity = std::string{}.capacity();
+	std::size_t bytes{0};
+	for (auto& elem : env)
+	{
+		bytes += sizeof(elem) + 4 * sizeof(void*);
+		if (elem.first.capacity() > inline_capacity)
+			bytes += elem.first.capacity() + 1;
+	}
+	return bytes;
+}
 
 Command parse_function_def(Command& fn, Lexer& lex)
 {
@@ -224,6 +546,21 @@ Command parse_function_def(Command& fn, Lexer& lex)
 	return fn;
 }
 
+Command parse_cell_def(Command& cell, Lexer& lex)
+{
+	auto cur_tok = lex.next();
+	if (cur_tok == Token::eof)
+		throw InvalidInput{"Expected cell definition"};
+	if (cur_tok != Token::identifier)
+		throw InvalidInput{"Invalid cell name"};
+	cell.args.emplace_back(lex.identifier());
+	cur_tok = lex.next();
+	if (cur_tok != '=')
+		throw InvalidInput{"Expected '='"};
+
+	return cell;
+}
+
 } // namespace
 
 Command parse_command(Lexer& lex)
@@ -242,13 +579,28 @@ Command parse_command(Lexer& lex)
 	c.type = commands[com_name].type;
 	if (c.type == CommandType::def)
 		return parse_function_def(c, lex);
-	cur_tok = lex.next();
-	while (cur_tok != Token::eof)
+	if (c.type == CommandType::cell || c.type == CommandType::map)
+		return parse_cell_def(c, lex);
+	if (c.type == CommandType::bench || c.type == CommandType::montecarlo || c.type == CommandType::apply)
+		return c;
+	if (c.type == CommandType::export_ || c.type == CommandType::mem || c.type == CommandType::op ||
+	    c.type == CommandType::load || c.type == CommandType::seed || c.type == CommandType::timeout ||
+	    c.type == CommandType::format || c.type == CommandType::check)
+	{
+		// Paths, sizes, numbers and operators are not identifiers.
+		std::istringstream words{lex.remaining()};
+		c.args.assign(std::istream_iterator<std::string>{words}, std::istream_iterator<std::string>{});
+	}
+	else
 	{
-		if (cur_tok != Token::identifier)
-			throw InvalidInput{"Wrong argument format"};
-		c.args.emplace_back(lex.identifier());
 		cur_tok = lex.next();
+		while (cur_tok != Token::eof)
+		{
+			if (cur_tok != Token::identifier)
+				throw InvalidInput{"Wrong argument format"};
+			c.args.emplace_back(lex.identifier());
+			cur_tok = lex.next();
+		}
 	}
 	auto err_str = [&com_name]{return "Wrong argument count. Command " + com_name + " takes ";};
 	auto count_str = [&com_name]{return std::to_string(commands[com_name].args_count);};
@@ -278,34 +630,55 @@ Command parse_command(Lexer& lex)
 }
 
 void execute_env(std::vector<std::string> const& args, std::map<std::string, double> const& var_env,
-                 std::map<std::string, Function*> const& fun_env)
+                 std::map<std::string, Function*> const& fun_env, std::map<std::string, Array> const& arr_env,
+                 Cells const& cells)
 {
 	if (args.empty())
 	{
 		if (!var_env.empty())
-			std::cout << "Variables :\n";
+			output() << "Variables :\n";
 		for (auto& elem : var_env)
-			std::cout << elem.first << " = " << elem.second << '\n';
+		{
+			output() << elem.first << " = ";
+			write_number(output(), elem.second);
+			output() << '\n';
+		}
+		if (!arr_env.empty())
+			output() << "Arrays :\n";
+		for (auto& elem : arr_env)
+		{
+			output() << elem.first << " = ";
+			print_array(output(), elem.second);
+			output() << '\n';
+		}
 		if (!fun_env.empty())
-			std::cout << "Functions :\n";
+			output() << "Functions :\n";
 		for (auto& elem : fun_env)
 		{
-			std::cout << elem.first << '(';
+			output() << elem.first << '(';
 			for (auto it = std::begin(elem.second->param_names) ; it != std::end(elem.second->param_names) ; ++it)
 			{
-				std::cout << *it;
+				output() << *it;
 				if (it != std::end(elem.second->param_names) - 1)
-					std::cout << ", ";
+					output() << ", ";
 			}
-			std::cout << ')';
+			output() << ')';
 			if (elem.second->type != FunctionType::userdef)
-				std::cout << " (builtin)";
+				output() << " (builtin)";
 			else
 			{
-				std::cout << " = ";
-				elem.second->body->print(std::cout);
+				output() << " = ";
+				elem.second->body->print(output());
 			}
-			std::cout << '\n';
+			output() << '\n';
+		}
+		if (!cells.formulas().empty())
+			output() << "Cells :\n";
+		for (auto& elem : cells.formulas())
+		{
+			output() << elem.first << " = ";
+			elem.second->print(output());
+			output() << '\n';
 		}
 		return;
 	}
@@ -317,7 +690,24 @@ void execute_env(std::vector<std::string> const& args, std::map<std::string, dou
 		auto var_it = var_env.find(elem);
 		if (var_it != std::end(var_env))
 		{
-			to_print << var_it->first << " = " << var_it->second << '\n';
+			to_print << var_it->first << " = ";
+			write_number(to_print, var_it->second);
+			auto cell_it = cells.formulas().find(elem);
+			if (cell_it != std::end(cells.formulas()))
+			{
+				to_print << " (cell : ";
+				cell_it->second->print(to_print);
+				to_print << ')';
+			}
+			to_print << '\n';
+			continue;
+		}
+		auto arr_it = arr_env.find(elem);
+		if (arr_it != std::end(arr_env))
+		{
+			to_print << arr_it->first << " = ";
+			print_array(to_print, arr_it->second);
+			to_print << '\n';
 			continue;
 		}
 		auto fun_it = fun_env.find(elem);
@@ -336,16 +726,17 @@ void execute_env(std::vector<std::string> const& args, std::map<std::string, dou
 			to_print << " (builtin)";
 		else
 		{
-			std::cout << " = ";
+			to_print << " = ";
 			fun_it->second->body->print(to_print);
 		}
 		to_print << '\n';
 	}
-	std::cout << to_print.str();
+	output() << to_print.str();
 }
 
 void execute_import(std::vector<std::string> const& args, std::map<std::string, double>& var_env,
-                    std::map<std::string, Function*>& fun_env)
+                    std::map<std::string, Function*>& fun_env, std::map<std::string, Array>& arr_env,
+                    DependencyGraph& graph)
 {
 	std::map<std::string, double> values;
 	std::map<std::string, Function*> funs;
@@ -353,15 +744,20 @@ void execute_import(std::vector<std::string> const& args, std::map<std::string,
 	{
 		if (std::count(std::begin(args), std::end(args), elem) > 1)
 			throw InvalidInput{"Multiple uses of " + elem};
+		if (is_reserved_name(elem))
+			throw InvalidInput{elem + " is a reserved name"};
 		auto var_it = builtin_vars.find(elem);
 		if (var_it != std::end(builtin_vars))
 		{
+			if (fun_env.find(elem) != std::end(fun_env) || arr_env.find(elem) != std::end(arr_env))
+				check_replaceable(elem, graph, fun_env);
 			values[elem] = var_it->second;
 			continue;
 		}
 		auto fun_it = builtin_funs.find(elem);
 		if (fun_it == std::end(builtin_funs))
 			throw InvalidInput{elem + " is not in builtin list"};
+		check_replaceable(elem, graph, fun_env);
 		funs[elem] = &bf_impl[fun_it->second];
 	}
 	for (auto& elem : values)
@@ -369,10 +765,21 @@ void execute_import(std::vector<std::string> const& args, std::map<std::string,
 		auto fun_it = fun_env.find(elem.first);
 		if (fun_it != std::end(fun_env))
 		{
-			std::cout << "Warning : overriding function " << elem.first << '\n';
+			output() << "Warning : overriding function " << elem.first << '\n';
 		    fun_env.erase(fun_it);
+			graph.remove(elem.first);
+			invalidate_dependents(elem.first, graph, fun_env);
 		}
-		std::cout << elem.first << " = " << elem.second << '\n';
+		auto arr_it = arr_env.find(elem.first);
+		if (arr_it != std::end(arr_env))
+		{
+			output() << "Warning : overriding array " << elem.first << '\n';
+			arr_env.erase(arr_it);
+			invalidate_dependents(elem.first, graph, fun_env);
+		}
+		output() << elem.first << " = ";
+		write_number(output(), elem.second);
+		output() << '\n';
 		var_env[elem.first] = elem.second;
 	}
 	for (auto& elem : funs)
@@ -380,73 +787,129 @@ void execute_import(std::vector<std::string> const& args, std::map<std::string,
 		auto var_it = var_env.find(elem.first);
 		if (var_it != std::end(var_env))
 		{
-			std::cout << "Warning : overriding variable " << elem.first << '\n';
+			output() << "Warning : overriding variable " << elem.first << '\n';
 		    var_env.erase(var_it);
+			invalidate_dependents(elem.first, graph, fun_env);
+		}
+		auto arr_it = arr_env.find(elem.first);
+		if (arr_it != std::end(arr_env))
+		{
+			output() << "Warning : overriding array " << elem.first << '\n';
+			arr_env.erase(arr_it);
+			invalidate_dependents(elem.first, graph, fun_env);
 		}
 		if (fun_env.find(elem.first) != std::end(fun_env))
-			std::cout << "Warning : redefining function " << elem.first << '\n';
-		std::cout << "Function " + elem.first << '(';
+		{
+			output() << "Warning : redefining function " << elem.first << '\n';
+			graph.remove(elem.first);
+			invalidate_dependents(elem.first, graph, fun_env);
+		}
+		output() << "Function " + elem.first << '(';
 		for (auto par_it = std::begin(elem.second->param_names) ;
 		     par_it != std::end(elem.second->param_names) ; ++par_it)
 		{
-			std::cout << *par_it;
+			output() << *par_it;
 			if (par_it != std::end(elem.second->param_names) - 1)
-				std::cout << ", ";
+				output() << ", ";
 		}
-		std::cout << ")\n";
+		output() << ")\n";
 		fun_env[elem.first] = elem.second;
 	}
 }
 
 void execute_del(std::vector<std::string> const& args, std::map<std::string, double>& var_env,
-                 std::map<std::string, Function*>& fun_env)
+                 std::map<std::string, Function*>& fun_env, std::map<std::string, Array>& arr_env,
+                 DependencyGraph& graph)
 {
 	std::vector<std::remove_reference<decltype(var_env)>::type::iterator> vars_to_del;
 	std::vector<std::remove_reference<decltype(fun_env)>::type::iterator> funs_to_del;
-	
+	std::vector<std::remove_reference<decltype(arr_env)>::type::iterator> arrs_to_del;
+
 	for (auto& elem : args)
 	{
 		if (std::count(std::begin(args), std::end(args), elem) > 1)
 			throw InvalidInput{"Multiple uses of " + elem};
+		check_replaceable(elem, graph, fun_env);
 		auto var_it = var_env.find(elem);
 		if (var_it != std::end(var_env))
 		{
 			vars_to_del.emplace_back(var_it);
 			continue;
 		}
+		auto arr_it = arr_env.find(elem);
+		if (arr_it != std::end(arr_env))
+		{
+			arrs_to_del.emplace_back(arr_it);
+			continue;
+		}
 		auto fun_it = fun_env.find(elem);
 		if (fun_it == std::end(fun_env))
 			throw InvalidInput{elem + " is not in current environment"};
 		funs_to_del.emplace_back(fun_it);
 	}
 	for (auto elem : vars_to_del)
+	{
+		invalidate_dependents(elem->first, graph, fun_env);
 		var_env.erase(elem);
+	}
+	for (auto elem : arrs_to_del)
+	{
+		invalidate_dependents(elem->first, graph, fun_env);
+		arr_env.erase(elem);
+	}
 	for (auto elem : funs_to_del)
+	{
+		graph.remove(elem->first);
+		invalidate_dependents(elem->first, graph, fun_env);
 		fun_env.erase(elem);
+	}
 }
 
 void execute_def(std::vector<std::string>& args, std::map<std::string, double>& var_env,
-                 std::map<std::string, Function*>& fun_env, Parser& par, Lexer& lex)
+                 std::map<std::string, Function*>& fun_env, std::map<std::string, Array>& arr_env,
+                 DependencyGraph& graph, std::map<Function*, std::unique_ptr<Function>>& functions,
+                 Parser& par, Lexer& lex)
 {
-	static std::map<Function*, std::unique_ptr<Function>> functions;
-
 	auto fn_name = args[0];
 	args.erase(std::begin(args));
 	std::unique_ptr<Function> function{new Function{nullptr, std::move(args), {},
 	                                   llvm::Intrinsic::not_intrinsic, FunctionType::userdef}};
-	function->body = par.parse_function_body(lex, fn_name, *function);
+	std::set<std::string> deps;
+	function->body = par.parse_function_body(lex, fn_name, *function, deps);
+	for (auto& elem : deps)
+	{
+		if (graph.depends_on(elem, fn_name))
+			throw InvalidInput{"Recursive function calls are not allowed : " + elem + " calls " + fn_name};
+	}
+	add_definition(fn_name, std::move(function), std::move(deps), var_env, fun_env, arr_env, graph, functions);
+}
 
+void add_definition(std::string const& fn_name, std::unique_ptr<Function> function, std::set<std::string> deps,
+                    std::map<std::string, double>& var_env, std::map<std::string, Function*>& fun_env,
+                    std::map<std::string, Array>& arr_env, DependencyGraph& graph,
+                    std::map<Function*, std::unique_ptr<Function>>& functions)
+{
+	if (is_reserved_name(fn_name))
+		throw InvalidInput{"Cannot define a function named " + fn_name + " : it is a reserved name"};
+	check_replaceable(fn_name, graph, fun_env);
 	auto var_it = var_env.find(fn_name);
 	if (var_it != std::end(var_env))
 	{
-		std::cout << "Warning : overriding variable " << fn_name << '\n';
+		output() << "Warning : overriding variable " << fn_name << '\n';
 		var_env.erase(var_it);
 	}
+	auto arr_it = arr_env.find(fn_name);
+	if (arr_it != std::end(arr_env))
+	{
+		output() << "Warning : overriding array " << fn_name << '\n';
+		arr_env.erase(arr_it);
+	}
+	invalidate_dependents(fn_name, graph, fun_env);
 
 	auto fun_it = fun_env.find(fn_name);
 	if (fun_it != std::end(fun_env))
 	{
-		std::cout << "Warning : redefining function " << fn_name << '\n';
+		output() << "Warning : redefining function " << fn_name << '\n';
 		auto fn = fun_it->second;
 		auto def_fun_it = functions.find(fn);
 		fun_env.erase(fun_it);
@@ -457,13 +920,578 @@ void execute_def(std::vector<std::string>& args, std::map<std::string, double>&
 	auto fn_ptr = function.get();
 	functions.insert(std::make_pair(fn_ptr, std::move(function)));
 	fun_env.insert(std::make_pair(fn_name, fn_ptr));
+	graph.set_dependencies(fn_name, std::move(deps));
+}
+
+std::vector<std::string> execute_load(std::vector<std::string> const& args, std::map<std::string, double>& var_env,
+                                      std::map<std::string, Function*>& fun_env, std::map<std::string, Array>& arr_env,
+                                      DependencyGraph& graph, std::map<Function*, std::unique_ptr<Function>>& functions,
+                                      Parser& par)
+{
+	return load_libraries(args, var_env, fun_env, arr_env, graph, functions, par);
+}
+
+void execute_check(std::vector<std::string> const& args, std::map<std::string, double>& var_env,
+                   std::map<std::string, Function*> const& fun_env, std::map<std::string, Array>& arr_env,
+                   Parser const& par)
+{
+	// The definitions of the files go to a copy of the environment.
+	auto funs = fun_env;
+	std::vector<std::unique_ptr<Function>> defined;
+	DependencyGraph graph;
+	Parser checker{var_env, funs, arr_env, graph};
+	checker.copy_operators(par);
+
+	std::size_t lines{0};
+	std::size_t errors{0};
+	for (auto& path : args)
+	{
+		std::ifstream file{path};
+		if (!file)
+			throw InvalidInput{"Cannot open " + path};
+		std::string line;
+		for (std::size_t number{1} ; std::getline(file, line) ; ++number)
+		{
+			auto first = line.find_first_not_of(" \t\r");
+			if (first == std::string::npos || line[first] == '#')
+				continue;
+			++lines;
+			Lexer lex;
+			lex.newline(std::move(line));
+			std::vector<Diagnostic> diagnostics;
+			if (lex.peek() != '!')
+				checker.check(lex, diagnostics);
+			else
+			{
+				// Commands are validated by the code executing them, which throws.
+				try
+				{
+					auto command = parse_command(lex);
+					if (command.type == CommandType::def)
+					{
+						auto name = command.args[0];
+						command.args.erase(std::begin(command.args));
+						std::unique_ptr<Function> fn{new Function{nullptr, std::move(command.args), {},
+						                             llvm::Intrinsic::not_intrinsic, FunctionType::userdef}};
+						std::set<std::string> deps;
+						checker.check_function_body(lex, name, *fn, deps, diagnostics);
+						funs[name] = fn.get();
+						defined.emplace_back(std::move(fn));
+					}
+					else if (command.type == CommandType::cell || command.type == CommandType::map ||
+					         command.type == CommandType::bench)
+						checker.check(lex, diagnostics);
+					else if (command.type == CommandType::import)
+					{
+						for (auto& elem : command.args)
+						{
+							auto fun_it = builtin_funs.find(elem);
+							if (fun_it != std::end(builtin_funs))
+								funs[elem] = &bf_impl[fun_it->second];
+							else if (builtin_vars.find(elem) == std::end(builtin_vars))
+								throw InvalidInput{elem + " is not in builtin list"};
+						}
+					}
+					else if (command.type == CommandType::op && !command.args.empty())
+						execute_op(command.args, checker);
+				}
+				catch (InvalidInput const& ex)
+				{
+					diagnostics.push_back(Diagnostic{lex.column(), ex.what()});
+				}
+			}
+			for (auto& elem : diagnostics)
+				output() << path << ':' << number << ':' << elem.column << " : " << elem.message << '\n';
+			errors += diagnostics.size();
+		}
+	}
+	output() << lines << " lines checked, " << errors << (errors == 1 ? " error\n" : " errors\n");
+}
+
+void execute_cell(std::vector<std::string> const& args, Cells& cells, Parser& par, Lexer& lex)
+{
+	std::set<std::string> deps;
+	auto formula = par.parse_formula(lex, deps);
+	cells.define(args[0], std::move(formula), std::move(deps));
+}
+
+void execute_mode(std::vector<std::string> const& args, std::map<std::string, Function*>& fun_env)
+{
+	if (args.empty())
+	{
+		for (auto& elem : numeric_modes)
+		{
+			if (elem.second == numeric_mode())
+				output() << "Numeric mode : " << elem.first << '\n';
+		}
+		return;
+	}
+	auto mode_it = std::find_if(std::begin(numeric_modes), std::end(numeric_modes),
+	                            [&args](std::pair<std::string, NumericMode> const& mode)
+	{
+		return mode.first == args[0];
+	});
+	if (mode_it == std::end(numeric_modes))
+		throw InvalidInput{"No such numeric mode : " + args[0]};
+	invalidate_functions(fun_env);
+	set_numeric_mode(mode_it->second);
+}
+
+void execute_algebra(std::vector<std::string> const& args, std::map<std::string, Function*>& fun_env)
+{
+	if (args.empty())
+	{
+		for (auto& elem : algebra_modes)
+		{
+			if (elem.second == algebra_mode())
+				output() << "Algebra mode : " << elem.first << '\n';
+		}
+		return;
+	}
+	auto mode_it = std::find_if(std::begin(algebra_modes), std::end(algebra_modes),
+	                            [&args](std::pair<std::string, AlgebraMode> const& mode)
+	{
+		return mode.first == args[0];
+	});
+	if (mode_it == std::end(algebra_modes))
+		throw InvalidInput{"No such algebra mode : " + args[0]};
+	invalidate_functions(fun_env);
+	set_algebra_mode(mode_it->second);
+}
+
+void execute_background(std::vector<std::string> const& args, BackgroundCompiler& background)
+{
+	if (args.empty())
+	{
+		for (auto& elem : background_modes)
+		{
+			if (elem.second == background.mode())
+				output() << "Background compilation : " << elem.first << '\n';
+		}
+		return;
+	}
+	auto mode_it = std::find_if(std::begin(background_modes), std::end(background_modes),
+	                            [&args](std::pair<std::string, BackgroundMode> const& mode)
+	{
+		return mode.first == args[0];
+	});
+	if (mode_it == std::end(background_modes))
+		throw InvalidInput{"No such background compilation : " + args[0]};
+	background.set_mode(mode_it->second);
+}
+
+void execute_profile(std::vector<std::string> const& args, std::map<std::string, Function*>& fun_env)
+{
+	if (args.empty())
+	{
+		for (auto& elem : profile_modes)
+		{
+			if (elem.second == profile_mode())
+				output() << "Profiling : " << elem.first << '\n';
+		}
+		return;
+	}
+	if (args[0] == "reset")
+	{
+		reset_profile();
+		return;
+	}
+	if (args[0] == "report")
+	{
+		auto entries = profile_report();
+		if (entries.empty())
+			output() << "No calls counted\n";
+		for (std::size_t i{0} ; i < entries.size() && i < reported_functions ; ++i)
+		{
+			auto& entry = entries[i];
+			output() << entry.name << " : " << entry.calls << " calls";
+			if (entry.cycles)
+				output() << ", " << entry.cycles << " cycles, " << entry.cycles / entry.calls << " per call";
+			output() << '\n';
+		}
+		if (entries.size() > reported_functions)
+			output() << entries.size() - reported_functions << " more functions\n";
+		return;
+	}
+	auto mode_it = std::find_if(std::begin(profile_modes), std::end(profile_modes),
+	                            [&args](std::pair<std::string, ProfileMode> const& mode)
+	{
+		return mode.first == args[0];
+	});
+	if (mode_it == std::end(profile_modes))
+		throw InvalidInput{"No such profiling choice : " + args[0]};
+	invalidate_functions(fun_env);
+	set_profile_mode(mode_it->second);
+}
+
+void execute_format(std::vector<std::string> const& args)
+{
+	if (args.empty())
+	{
+		auto format = number_format();
+		output() << "Number format : ";
+		if (format.style == NumberStyle::precision)
+			output() << format.precision << " digits\n";
+		else
+			output() << (format.style == NumberStyle::shortest ? "shortest" : "binary") << '\n';
+		return;
+	}
+	if (args[0] == "shortest")
+	{
+		set_number_format({NumberStyle::shortest, 0});
+		return;
+	}
+	if (args[0] == "binary")
+	{
+		set_number_format({NumberStyle::binary, 0});
+		return;
+	}
+	std::size_t end{0};
+	int digits{0};
+	try
+	{
+		digits = std::stoi(args[0], &end);
+	}
+	catch (std::exception const&)
+	{}
+	if (end != args[0].size() || digits < 1 || digits > max_format_digits)
+		throw InvalidInput{"Invalid number format : " + args[0]};
+	set_number_format({NumberStyle::precision, digits});
+}
+
+void execute_export(std::vector<std::string> const& args, std::map<std::string, double>& var_env,
+                    std::map<std::string, Function*>& fun_env)
+{
+	if (args.size() > 2)
+		throw InvalidInput{"Wrong argument count. Command export takes at most 2 arguments"};
+	export_functions(args[0], args.size() == 2 ? args[1] : "", var_env, fun_env);
+}
+
+void execute_mem(std::vector<std::string> const& args, std::map<std::string, double> const& var_env,
+                 std::map<std::string, Function*> const& fun_env, std::map<std::string, Array> const& arr_env)
+{
+	if (!args.empty())
+	{
+		set_code_limit(parse_bytes(args[0]));
+		return;
+	}
+
+	std::size_t elements_bytes{0};
+	for (auto& elem : arr_env)
+		elements_bytes += elem.second.size * (elem.second.single ? sizeof(float) : sizeof(double));
+	std::size_t compiled{0};
+	std::size_t functions_code{0};
+	for (auto& elem : fun_env)
+	{
+		if (elem.second->type != FunctionType::userdef || !elem.second->address)
+			continue;
+		++compiled;
+		functions_code += elem.second->code_size;
+	}
+	auto trees = tree_memory();
+	auto jit = jit_memory();
+
+	output() << "Syntax trees : " << trees.nodes << " nodes, " << format_bytes(trees.bytes) << '\n';
+	output() << "Environment : " << var_env.size() << " variables, " << fun_env.size() << " functions, "
+	         << arr_env.size() << " arrays, "
+	         << format_bytes(map_bytes(var_env) + map_bytes(fun_env) + map_bytes(arr_env)) << " of symbols, "
+	         << format_bytes(elements_bytes) << " of array elements\n";
+	output() << "IR : " << jit.ir_instructions << " instructions kept by " << jit.engines << " modules\n";
+	output() << "Compiled code : " << format_bytes(jit.code_bytes) << " of code, " << format_bytes(jit.data_bytes)
+	         << " of data, ";
+	if (code_limit() == 0)
+		output() << "no limit\n";
+	else
+		output() << "limit " << format_bytes(code_limit()) << '\n';
+	output() << "Functions : " << compiled << " compiled with " << format_bytes(functions_code) << " of code and data, "
+	         << jit.evictions << " evicted\n";
+}
+
+void execute_op(std::vector<std::string> const& args, Parser& par)
+{
+	if (args.empty())
+	{
+		for (auto& elem : par.user_operators())
+		{
+			output() << "x " << elem.first << " y = " << elem.second.function << "(x, y) - precedence "
+			         << elem.second.precedence << ", "
+			         << (elem.second.associativity == Associativity::left ? "left" : "right") << "-associative\n";
+		}
+		return;
+	}
+	if (args[0].size() != 1)
+		throw InvalidInput{"Operators are single characters"};
+	if (args.size() == 1)
+	{
+		par.remove_operator(args[0][0]);
+		return;
+	}
+	if (args.size() != 4)
+		throw InvalidInput{"Wrong argument count. Command op takes 0, 1 or 4 arguments"};
+
+	UserOperator op{args[3], 0, Associativity::unknown};
+	try
+	{
+		std::size_t end{0};
+		op.precedence = std::stoi(args[1], &end);
+		if (end != args[1].size())
+			throw std::invalid_argument{""};
+	}
+	catch (std::exception const&)
+	{
+		throw InvalidInput{"Wrong precedence format"};
+	}
+	if (args[2] == "left")
+		op.associativity = Associativity::left;
+	else if (args[2] == "right")
+		op.associativity = Associativity::right;
+	par.define_operator(args[0][0], std::move(op));
+}
+
+std::vector<std::string> execute_map(std::vector<std::string> const& args, std::map<std::string, double>& var_env,
+                                     std::map<std::string, Function*>& fun_env, std::map<std::string, Array>& arr_env,
+                                     DependencyGraph& graph, Parser& par, Lexer& lex)
+{
+	// The arrays named by the formula become the columns of a columnar function. They are found by
+	// lexing the formula, so that it is parsed once, with its columns.
+	auto text = lex.remaining();
+	Lexer formula_lex;
+	formula_lex.newline(std::string{text});
+	std::set<std::string> names;
+	for (auto tok = formula_lex.next() ; tok != Token::eof ; tok = formula_lex.next())
+	{
+		if (tok == Token::identifier && arr_env.find(formula_lex.identifier()) != std::end(arr_env))
+			names.insert(formula_lex.identifier());
+	}
+
+	Function formula{nullptr, {}, {}, llvm::Intrinsic::not_intrinsic, FunctionType::columnar};
+	std::vector<double const*> columns;
+	std::uint64_t rows{0};
+	for (auto& elem : names)
+	{
+		auto arr_it = arr_env.find(elem);
+		if (arr_it->second.single)
+			throw InvalidInput{"Array " + elem + " does not have double precision"};
+		if (!columns.empty() && arr_it->second.size != rows)
+			throw InvalidInput{"Array length mismatch"};
+		formula.param_names.emplace_back(elem);
+		columns.emplace_back(arr_it->second.values.data());
+		rows = arr_it->second.size;
+	}
+	if (columns.empty())
+		throw InvalidInput{"Formula does not use arrays"};
+	formula_lex.newline(std::move(text));
+	std::set<std::string> deps;
+	formula.body = par.parse_function_body(formula_lex, "", formula, deps);
+	// The chunks are evaluated on several threads at once.
+	if (assigns_variables(*formula.body, deps, fun_env, graph))
+		throw InvalidInput{"Mapped formulas cannot assign variables"};
+	compile_columns(args[0], formula, var_env, fun_env);
+
+	ArrayResults results;
+	auto& result = results[args[0]];
+	result.values.resize(rows);
+	{
+		JitUnlock unlock;
+		apply_columns(reinterpret_cast<ColumnKernel>(formula.address), columns, result.values.data(), rows,
+		              std::max(std::thread::hardware_concurrency(), 1u));
+	}
+	check_array_lengths();
+	check_watchdog();
+	assign_array(result, Array{nullptr, 0, false, std::move(result.values), {}});
+	output() << args[0] << " = ";
+	print_array(output(), result);
+	output() << '\n';
+	return commit_arrays(results, arr_env, var_env, fun_env, graph);
+}
+
+void execute_seed(std::vector<std::string> const& args)
+{
+	if (args.empty())
+	{
+		output() << "Seed : " << random_seed() << '\n';
+		return;
+	}
+	std::size_t end{0};
+	unsigned long long value{0};
+	try
+	{
+		value = std::stoull(args[0], &end);
+	}
+	catch (std::exception const&)
+	{
+		throw InvalidInput{"Invalid seed : " + args[0]};
+	}
+	if (end != args[0].size())
+		throw InvalidInput{"Invalid seed : " + args[0]};
+	set_random_seed(value);
+}
+
+void execute_timeout(std::vector<std::string> const& args)
+{
+	if (args.empty())
+	{
+		if (time_limit().count() == 0)
+			output() << "Time limit : none\n";
+		else
+			output() << "Time limit : " << time_limit().count() << " ms\n";
+		return;
+	}
+	std::size_t end{0};
+	unsigned long long value{0};
+	try
+	{
+		value = std::stoull(args[0], &end);
+	}
+	catch (std::exception const&)
+	{
+		throw InvalidInput{"Invalid time limit : " + args[0]};
+	}
+	if (end != args[0].size())
+		throw InvalidInput{"Invalid time limit : " + args[0]};
+	set_time_limit(std::chrono::milliseconds{value});
+}
+
+void execute_montecarlo(std::map<std::string, double>& var_env, std::map<std::string, Function*>& fun_env,
+                        DependencyGraph const& graph, Parser& par, Lexer& lex)
+{
+	using clock = std::chrono::steady_clock;
+	using seconds = std::chrono::duration<double>;
+
+	// The number of samples is the last word, so that it can follow any expression.
+	auto text = lex.remaining();
+	auto last = text.find_last_not_of(" \t");
+	auto split = last == std::string::npos ? last : text.find_last_of(" \t", last);
+	if (split == std::string::npos)
+		throw InvalidInput{"Expected an expression and a number of samples"};
+	auto count = text.substr(split + 1, last - split);
+	std::size_t end{0};
+	double samples{0.0};
+	try
+	{
+		samples = std::stod(count, &end);
+	}
+	catch (std::exception const&)
+	{}
+	if (end != count.size() || !(samples >= 1.0 && samples <= max_samples) || std::floor(samples) != samples)
+		throw InvalidInput{"Invalid number of samples : " + count};
+
+	Lexer expr_lex;
+	expr_lex.newline(text.substr(0, split));
+	std::set<std::string> deps;
+	auto expr = par.parse_formula(expr_lex, deps);
+	// Samples are drawn on several threads at once.
+	if (assigns_variables(*expr, deps, fun_env, graph))
+		throw InvalidInput{"Monte Carlo expressions cannot assign variables"};
+	// User functions draw the numbers of the thread running them, which depend on the scheduling.
+	for (auto& elem : deps)
+	{
+		if (elem != "rand" && graph.depends_on(elem, "rand"))
+			throw InvalidInput{"Monte Carlo expressions cannot call rand through " + elem};
+	}
+
+	auto start = clock::now();
+	auto sampler = compile_sampler(*expr, var_env, fun_env);
+	SampleEstimate estimate{};
+	{
+		JitUnlock unlock;
+		estimate = run_sampler(sampler.entry, static_cast<std::uint64_t>(samples),
+		                       std::max(std::thread::hardware_concurrency(), 1u));
+	}
+	check_array_lengths();
+	check_watchdog();
+	write_number(output(), estimate.mean);
+	output() << " +/- ";
+	write_number(output(), estimate.error);
+	output() << " (" << static_cast<std::uint64_t>(samples) << " samples in " << seconds{clock::now() - start}.count()
+	         << " s)\n";
+}
+
+void execute_apply(std::map<std::string, double>& var_env, std::map<std::string, Function*>& fun_env,
+                   DependencyGraph const& graph, Parser& par, Lexer& lex)
+{
+	// The path is the first word, so that it can precede any formula.
+	auto text = lex.remaining();
+	auto first = text.find_first_not_of(" \t");
+	auto split = first == std::string::npos ? first : text.find_first_of(" \t", first);
+	if (split == std::string::npos)
+		throw InvalidInput{"Expected a path and a formula"};
+	apply_csv(text.substr(first, split - first), text.substr(split + 1), var_env, fun_env, graph, par, output());
+}
+
+std::set<std::string> execute_bench(std::map<std::string, double>& var_env, std::map<std::string, Function*>& fun_env,
+                                    DependencyGraph const& graph, Parser& par, Lexer& lex)
+{
+	using clock = std::chrono::steady_clock;
+	using milliseconds = std::chrono::duration<double, std::milli>;
+
+	std::set<std::string> deps;
+	auto expr = par.parse_formula(lex, deps);
+	auto old_mode = numeric_mode();
+	double reference{0.0};
+	// Fails before changing the mode if the code given to the user of the library calls functions.
+	invalidate_functions(fun_env);
+	try
+	{
+		for (auto& elem : numeric_modes)
+		{
+			set_numeric_mode(elem.second);
+			invalidate_functions(fun_env);
+			ArrayResults results;
+			auto start = clock::now();
+			auto compiled = compile_expression(*expr, var_env, fun_env, results);
+			auto compile_time = milliseconds{clock::now() - start};
+
+			double res;
+			std::size_t runs{0};
+			auto elapsed = clock::duration::zero();
+			{
+				JitUnlock unlock;
+				res = compiled.entry();
+				check_array_lengths();
+				check_watchdog();
+				start = clock::now();
+				while (elapsed < bench_duration && runs != max_bench_runs)
+				{
+					compiled.entry();
+					++runs;
+					elapsed = clock::now() - start;
+				}
+			}
+			check_array_lengths();
+			check_watchdog();
+			auto run_time = milliseconds{elapsed}.count() / runs;
+			if (elem.second == NumericMode::float64)
+				reference = run_time;
+
+			output() << elem.first << " : " << run_time << " ms per run (" << runs << " runs, compiled in "
+			          << compile_time.count() << " ms";
+			if (elem.second != NumericMode::float64)
+				output() << ", x" << reference / run_time;
+			output() << ") = ";
+			if (expr->is_array())
+				print_array(output(), results[""]);
+			else
+				write_number(output(), res);
+			output() << '\n';
+		}
+	}
+	catch (InvalidInput const&)
+	{
+		set_numeric_mode(old_mode);
+		invalidate_functions(fun_env);
+		throw;
+	}
+	set_numeric_mode(old_mode);
+	invalidate_functions(fun_env);
+	return assigned_variables(*expr, deps, fun_env, graph);
 }
 
 void execute_help(std::string const* arg)
 {
 	if (!arg)
 	{
-		std::cout <<
+		output() <<
 			"Expression syntax :\n"
 			"\tNumber format :\n"
 			"\t\t42\n"
@@ -477,7 +1505,21 @@ void execute_help(std::string const* arg)
 			"\t\tx % y : modulation - left-associative\n"
 			"\t\tx ^ y : exponentiation - right-associative\n"
 			"\t\tx = y : assignment - right-associative\n"
+			"\t\tx < y : comparison, 1 or 0, also >, <=, >=, == and != - left-associative\n"
 			"\t\t  -x  : negation\n"
+			"\t\tOther binary operators can be defined with !op.\n"
+			"\tConstructs :\n"
+			"\t\tif(condition, then, else) : then if condition is not 0, else otherwise\n"
+			"\t\twhile(condition, body) : computes body while condition is not 0\n"
+			"\t\tfor(i, first, last, body) : computes body for i from first to last\n"
+			"\t\tlet name = value in expression : value computed once, named in expression\n"
+			"\tArrays :\n"
+			"\t\t[x, y, z] : array of the given elements\n"
+			"\t\t[first : last] : range from first to last by steps of 1\n"
+			"\t\t[first : last : step] : range from first to last by steps of step\n"
+			"\t\tOperators and functions apply to each element of arrays. Arrays used\n"
+			"\t\ttogether must have the same length. The parts of an array expression\n"
+			"\t\tnot involving arrays are evaluated only once.\n"
 			"Commands :\n"
 			"\tSyntax : !command [args]\n\n"
 			"\thelp :\n"
@@ -492,12 +1534,46 @@ void execute_help(std::string const* arg)
 			"\tdel :\n"
 			"\t\tDelete elements from the environment.\n"
 			"\tdef :\n"
-			"\t\tDefine new functions.\n";
+			"\t\tDefine new functions.\n"
+			"\tload :\n"
+			"\t\tDefine the functions of library files.\n"
+			"\tbackground :\n"
+			"\t\tChoose how functions are compiled once defined.\n"
+			"\tcell :\n"
+			"\t\tDefine variables recomputed when their inputs change.\n"
+			"\tmode :\n"
+			"\t\tChoose between double, integer and single precision computations.\n"
+			"\talgebra :\n"
+			"\t\tAllow rewrites of expressions which are faster but less precise.\n"
+			"\tbench :\n"
+			"\t\tCompare the speed of an expression in each numeric mode.\n"
+			"\tseed :\n"
+			"\t\tSet the seed of rand.\n"
+			"\ttimeout :\n"
+			"\t\tLimit the time a line can run.\n"
+			"\tmontecarlo :\n"
+			"\t\tEstimate the mean of a random expression on all processors.\n"
+			"\tcheck :\n"
+			"\t\tReport all the errors of files of input lines without executing them.\n"
+			"\tapply :\n"
+			"\t\tEvaluate a formula on each row of a CSV file using all processors.\n"
+			"\tformat :\n"
+			"\t\tChoose the precision of the printed numbers, or binary output.\n"
+			"\tprofile :\n"
+			"\t\tCount the calls to functions and report the most expensive ones.\n"
+			"\tmap :\n"
+			"\t\tEvaluate a formula on arrays using all processors.\n"
+			"\texport :\n"
+			"\t\tCompile the functions to an object file or a shared library.\n"
+			"\tmem :\n"
+			"\t\tShow memory usage and limit the memory of compiled code.\n"
+			"\top :\n"
+			"\t\tDefine binary operators calling functions.\n";
 		return;
 	}
 
 	auto it = commands.find(*arg);
 	if (it == std::end(commands))
 		throw InvalidInput{"No such command : " + *arg};
-	std::cout << it->second.doc;
+	output() << it->second.doc;
 }
@@ -4,11 +4,17 @@
 #define CALC_COMMAND_HANDLER_HPP_
 
 #include <map>
+#include <memory>
+#include <set>
 #include <string>
 #include <vector>
 
+class BackgroundCompiler;
+class Cells;
+class DependencyGraph;
 class Lexer;
 class Parser;
+struct Array;
 struct Function;
 
 enum class CommandType
@@ -18,7 +24,24 @@ enum class CommandType
 	env,
 	import,
 	del,
-	def
+	def,
+	cell,
+	mode,
+	algebra,
+	bench,
+	map,
+	export_,
+	mem,
+	op,
+	load,
+	background,
+	profile,
+	seed,
+	timeout,
+	montecarlo,
+	format,
+	apply,
+	check
 };
 
 enum class EqMinMax
@@ -47,15 +70,75 @@ Command parse_command(Lexer&);
 void execute_help(std::string const*);
 
 void execute_env(std::vector<std::string> const&, std::map<std::string, double> const&,
-                 std::map<std::string, Function*> const&);
+                 std::map<std::string, Function*> const&, std::map<std::string, Array> const&, Cells const&);
 
 void execute_import(std::vector<std::string> const&, std::map<std::string, double>&,
-                    std::map<std::string, Function*>&);
+                    std::map<std::string, Function*>&, std::map<std::string, Array>&, DependencyGraph&);
 
 void execute_del(std::vector<std::string> const&, std::map<std::string, double>&,
-                 std::map<std::string, Function*>&);
+                 std::map<std::string, Function*>&, std::map<std::string, Array>&, DependencyGraph&);
 
 void execute_def(std::vector<std::string>&, std::map<std::string, double>&,
-                 std::map<std::string, Function*>&, Parser&, Lexer&);
+                 std::map<std::string, Function*>&, std::map<std::string, Array>&, DependencyGraph&,
+                 std::map<Function*, std::unique_ptr<Function>>&, Parser&, Lexer&);
+
+// Adds a parsed user function to the environment, in place of the identifier of the same name.
+void add_definition(std::string const&, std::unique_ptr<Function>, std::set<std::string>,
+                    std::map<std::string, double>&, std::map<std::string, Function*>&, std::map<std::string, Array>&,
+                    DependencyGraph&, std::map<Function*, std::unique_ptr<Function>>&);
+
+std::vector<std::string> execute_load(std::vector<std::string> const&, std::map<std::string, double>&,
+                                      std::map<std::string, Function*>&, std::map<std::string, Array>&,
+                                      DependencyGraph&, std::map<Function*, std::unique_ptr<Function>>&, Parser&);
+
+void execute_check(std::vector<std::string> const&, std::map<std::string, double>&,
+                   std::map<std::string, Function*> const&, std::map<std::string, Array>&, Parser const&);
+
+void execute_cell(std::vector<std::string> const&, Cells&, Parser&, Lexer&);
+
+void execute_mode(std::vector<std::string> const&, std::map<std::string, Function*>&);
+
+void execute_algebra(std::vector<std::string> const&, std::map<std::string, Function*>&);
+
+std::vector<std::string> execute_map(std::vector<std::string> const&, std::map<std::string, double>&,
+                                     std::map<std::string, Function*>&, std::map<std::string, Array>&, DependencyGraph&,
+                                     Parser&, Lexer&);
+
+void execute_export(std::vector<std::string> const&, std::map<std::string, double>&, std::map<std::string, Function*>&);
+
+void execute_mem(std::vector<std::string> const&, std::map<std::string, double> const&,
+                 std::map<std::string, Function*> const&, std::map<std::string, Array> const&);
+
+void execute_op(std::vector<std::string> const&, Parser&);
+
+void execute_background(std::vector<std::string> const&, BackgroundCompiler&);
+
+void execute_format(std::vector<std::string> const&);
+
+void execute_profile(std::vector<std::string> const&, std::map<std::string, Function*>&);
+
+// Returns the variables the expression assigns.
+std::set<std::string> execute_bench(std::map<std::string, double>&, std::map<std::string, Function*>&,
+                                    DependencyGraph const&, Parser&, Lexer&);
+
+void execute_seed(std::vector<std::string> const&);
+
+void execute_timeout(std::vector<std::string> const&);
+
+void execute_montecarlo(std::map<std::string, double>&, std::map<std::string, Function*>&, DependencyGraph const&,
+                        Parser&, Lexer&);
+
+void execute_apply(std::map<std::string, double>&, std::map<std::string, Function*>&, DependencyGraph const&,
+                   Parser&, Lexer&);
+
+// Defined in builtins.c.
+extern "C" double calcfn_tan(double);
+extern "C" double calcfn_asin(double);
+extern "C" double calcfn_acos(double);
+extern "C" double calcfn_atan(double);
+extern "C" double calcfn_gamma(double);
+
+// Defined in random.cpp.
+extern "C" double calcfn_rand(double, double);
 
 #endif // Header guard
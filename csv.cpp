@@ -0,0 +1,418 @@
+// Copyright 2015 Benoît Vey
+
+#include "csv.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <condition_variable>
+#include <cstdlib>
+#include <cstring>
+#include <limits>
+#include <mutex>
+#include <ostream>
+#include <set>
+#include <thread>
+#include <vector>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "Lexer.hpp"
+#include "Parser.hpp"
+#include "arrays.hpp"
+#include "columns.hpp"
+#include "jit.hpp"
+#include "output.hpp"
+#include "syntax_tree.hpp"
+#include "utility.hpp"
+#include "watchdog.hpp"
+
+namespace
+{
+
+// Large enough to amortize the synchronisation, small enough to keep a few chunks per thread in
+// flight.
+std::size_t const chunk_bytes{1 << 22};
+
+std::size_t const max_fallback_chars{64};
+
+double const exact_powers[] = {1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11, 1e12, 1e13, 1e14,
+                               1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22};
+
+class MappedFile
+{
+	public:
+	explicit MappedFile(std::string const& path) : data_{nullptr}, size_{0}
+	{
+		auto fd = open(path.c_str(), O_RDONLY);
+		if (fd == -1)
+			throw InvalidInput{"Cannot open " + path};
+		struct stat info;
+		if (fstat(fd, &info) == -1 || info.st_size == 0)
+		{
+			close(fd);
+			throw InvalidInput{path + " is empty"};
+		}
+		size_ = static_cast<std::size_t>(info.st_size);
+		auto data = mmap(nullptr, size_, PROT_READ, MAP_PRIVATE, fd, 0);
+		close(fd);
+		if (data == MAP_FAILED)
+			throw InvalidInput{"Cannot map " + path};
+		data_ = static_cast<char const*>(data);
+		madvise(data, size_, MADV_SEQUENTIAL);
+	}
+
+	MappedFile(MappedFile const&) = delete;
+	MappedFile& operator=(MappedFile const&) = delete;
+
+	MappedFile(MappedFile&&) = delete;
+	MappedFile& operator=(MappedFile&&) = delete;
+
+	~MappedFile()
+	{
+		munmap(const_cast<char*>(data_), size_);
+	}
+
+	char const* begin() const
+	{
+		return data_;
+	}
+
+	char const* end() const
+	{
+		return data_ + size_;
+	}
+
+	// The pages of a parsed chunk are not needed anymore.
+	void release(char const* first, char const* last) const
+	{
+		auto page = static_cast<std::size_t>(sysconf(_SC_PAGESIZE));
+		auto from = (static_cast<std::size_t>(first - data_) + page - 1) / page * page;
+		auto to = static_cast<std::size_t>(last - data_) / page * page;
+		if (from < to)
+			madvise(const_cast<char*>(data_) + from, to - from, MADV_DONTNEED);
+	}
+
+	private:
+	char const* data_;
+	std::size_t size_;
+};
+
+bool is_blank(char c)
+{
+	return c == ' ' || c == '\t';
+}
+
+bool is_digit(char c)
+{
+	return c >= '0' && c <= '9';
+}
+
+char const* line_end(char const* first, char const* last)
+{
+	auto newline = static_cast<char const*>(std::memchr(first, '\n', static_cast<std::size_t>(last - first)));
+	return newline ? newline : last;
+}
+
+std::vector<std::string> read_header(char const* first, char const* last)
+{
+	std::vector<std::string> names;
+	while (true)
+	{
+		auto comma = std::find(first, last, ',');
+		auto name_first = first;
+		auto name_last = comma;
+		while (name_first != name_last && (is_blank(*name_first) || *name_first == '"'))
+			++name_first;
+		while (name_last != name_first && (is_blank(name_last[-1]) || name_last[-1] == '"' || name_last[-1] == '\r'))
+			--name_last;
+		names.emplace_back(name_first, name_last);
+		if (comma == last)
+			return names;
+		first = comma + 1;
+	}
+}
+
+// Plain decimals of at most 19 significant digits, scaled by at most 10^22, are converted exactly by
+// a single rounded operation. The others go through strtod.
+bool parse_decimal(char const* first, char const* last, double& value)
+{
+	auto negative = false;
+	if (first != last && (*first == '-' || *first == '+'))
+		negative = *first++ == '-';
+	std::uint64_t mantissa{0};
+	int digits{0};
+	int exponent{0};
+	auto any_digit = false;
+	for ( ; first != last && is_digit(*first) ; ++first)
+	{
+		mantissa = mantissa * 10 + static_cast<std::uint64_t>(*first - '0');
+		digits += mantissa != 0;
+		any_digit = true;
+	}
+	if (first != last && *first == '.')
+	{
+		for (++first ; first != last && is_digit(*first) ; ++first)
+		{
+			mantissa = mantissa * 10 + static_cast<std::uint64_t>(*first - '0');
+			digits += mantissa != 0;
+			--exponent;
+			any_digit = true;
+		}
+	}
+	if (!any_digit || digits > 19)
+		return false;
+	if (first != last && (*first == 'e' || *first == 'E'))
+	{
+		++first;
+		auto exp_negative = false;
+		if (first != last && (*first == '-' || *first == '+'))
+			exp_negative = *first++ == '-';
+		if (first == last)
+			return false;
+		int exp{0};
+		for ( ; first != last && is_digit(*first) ; ++first)
+			exp = std::min(exp * 10 + (*first - '0'), 10000);
+		exponent += exp_negative ? -exp : exp;
+	}
+	if (first != last)
+		return false;
+	if (mantissa == 0)
+		exponent = 0;
+	if (mantissa > (std::uint64_t{1} << 53) || exponent < -22 || exponent > 22)
+		return false;
+	value = static_cast<double>(mantissa);
+	value = exponent < 0 ? value / exact_powers[-exponent] : value * exact_powers[exponent];
+	if (negative)
+		value = -value;
+	return true;
+}
+
+// Empty fields are missing values.
+double parse_field(char const* first, char const* last, char const* file)
+{
+	while (first != last && is_blank(*first))
+		++first;
+	while (last != first && (is_blank(last[-1]) || last[-1] == '\r'))
+		--last;
+	if (first == last)
+		return std::numeric_limits<double>::quiet_NaN();
+	double value{0.0};
+	if (parse_decimal(first, last, value))
+		return value;
+	auto length = static_cast<std::size_t>(last - first);
+	char text[max_fallback_chars];
+	if (length < max_fallback_chars)
+	{
+		std::memcpy(text, first, length);
+		text[length] = '\0';
+		char* end{nullptr};
+		value = std::strtod(text, &end);
+		if (end == text + length)
+			return value;
+	}
+	throw InvalidInput{"Invalid number at byte " + std::to_string(first - file) + " : " +
+	                   std::string{first, std::min(length, max_fallback_chars)}};
+}
+
+struct Chunk
+{
+	char const* first;
+	char const* last;
+};
+
+// Chunks end after a newline, so that no line is split.
+std::vector<Chunk> split_chunks(char const* first, char const* last)
+{
+	std::vector<Chunk> chunks;
+	while (first != last)
+	{
+		auto split = static_cast<std::size_t>(last - first) > chunk_bytes ? line_end(first + chunk_bytes, last) : last;
+		if (split != last)
+			++split;
+		chunks.emplace_back(Chunk{first, split});
+		first = split;
+	}
+	return chunks;
+}
+
+// The buffers of a worker are reused for each of its chunks.
+struct ChunkBuffers
+{
+	std::vector<std::vector<double>> columns;
+	std::vector<double const*> column_data;
+	std::vector<double> results;
+	std::string text;
+};
+
+// Reads the used fields of the rows in their columns. Blank lines are skipped.
+std::uint64_t parse_chunk(Chunk const& chunk, std::vector<int> const& slots, ChunkBuffers& buffers,
+                          char const* file)
+{
+	for (auto& elem : buffers.columns)
+		elem.clear();
+	std::uint64_t rows{0};
+	for (auto first = chunk.first ; first < chunk.last ; )
+	{
+		auto last = line_end(first, chunk.last);
+		auto next = last + 1;
+		if (last != first && last[-1] == '\r')
+			--last;
+		if (std::all_of(first, last, is_blank))
+		{
+			first = next;
+			continue;
+		}
+		std::size_t field{0};
+		while (true)
+		{
+			auto comma = static_cast<char const*>(std::memchr(first, ',', static_cast<std::size_t>(last - first)));
+			auto field_last = comma ? comma : last;
+			if (field == slots.size())
+				throw InvalidInput{"Too many fields at byte " + std::to_string(first - file)};
+			if (slots[field] != -1)
+				buffers.columns[static_cast<std::size_t>(slots[field])].push_back(parse_field(first, field_last, file));
+			++field;
+			if (!comma)
+				break;
+			first = comma + 1;
+		}
+		if (field != slots.size())
+			throw InvalidInput{"Missing fields at byte " + std::to_string(first - file)};
+		++rows;
+		first = next;
+	}
+	return rows;
+}
+
+void format_results(std::uint64_t rows, ChunkBuffers& buffers)
+{
+	auto& text = buffers.text;
+	text.clear();
+	if (number_format().style == NumberStyle::binary)
+	{
+		text.append(reinterpret_cast<char const*>(buffers.results.data()), rows * sizeof(double));
+		return;
+	}
+	char number[max_number_chars];
+	for (std::uint64_t i{0} ; i != rows ; ++i)
+	{
+		text.append(number, format_number(buffers.results[i], number));
+		text.push_back('\n');
+	}
+}
+
+} // namespace
+
+std::uint64_t apply_csv(std::string const& path, std::string const& formula, std::map<std::string, double>& vars,
+                        std::map<std::string, Function*>& funs, DependencyGraph const& graph, Parser& par,
+                        std::ostream& os)
+{
+	MappedFile file{path};
+	auto header_last = line_end(file.begin(), file.end());
+	auto names = read_header(file.begin(), header_last);
+
+	// The identifiers of the formula naming columns become the parameters of a columnar function.
+	std::set<std::string> identifiers;
+	{
+		Lexer lex;
+		lex.newline(std::string{formula});
+		for (auto tok = lex.next() ; tok != Token::eof ; tok = lex.next())
+		{
+			if (tok == Token::identifier)
+				identifiers.insert(lex.identifier());
+		}
+	}
+	Function fn{nullptr, {}, {}, llvm::Intrinsic::not_intrinsic, FunctionType::columnar};
+	std::vector<int> slots(names.size(), -1);
+	for (std::size_t i{0} ; i != names.size() ; ++i)
+	{
+		if (identifiers.find(names[i]) == std::end(identifiers))
+			continue;
+		if (is_in(names[i], fn.param_names))
+			throw InvalidInput{"Duplicate column " + names[i]};
+		slots[i] = static_cast<int>(fn.param_names.size());
+		fn.param_names.emplace_back(names[i]);
+	}
+	{
+		Lexer lex;
+		lex.newline(std::string{formula});
+		std::set<std::string> deps;
+		fn.body = par.parse_function_body(lex, "", fn, deps);
+		// The rows are evaluated on several threads at once.
+		if (assigns_variables(*fn.body, deps, funs, graph))
+			throw InvalidInput{"Formulas applied to files cannot assign variables"};
+	}
+	if (fn.body->is_array())
+		throw InvalidInput{"Formula must return a number"};
+	compile_columns("apply", fn, vars, funs);
+	auto kernel = reinterpret_cast<ColumnKernel>(fn.address);
+
+	auto chunks = split_chunks(header_last == file.end() ? header_last : header_last + 1, file.end());
+	auto format = number_format();
+	std::atomic<std::size_t> next{0};
+	std::atomic<std::uint64_t> total_rows{0};
+	// The results of a chunk are written once the previous chunks are, so the chunks in flight are
+	// bounded by the number of workers.
+	std::mutex written_mutex;
+	std::condition_variable written_changed;
+	std::size_t written{0};
+	std::string error;
+	auto watchdog = current_watchdog();
+	auto work = [&]
+	{
+		set_number_format(format);
+		set_current_watchdog(watchdog);
+		ChunkBuffers buffers;
+		buffers.columns.resize(fn.param_names.size());
+		for (auto i = next++ ; i < chunks.size() ; i = next++)
+		{
+			try
+			{
+				auto rows = parse_chunk(chunks[i], slots, buffers, file.begin());
+				file.release(chunks[i].first, chunks[i].last);
+				buffers.column_data.clear();
+				for (auto& elem : buffers.columns)
+					buffers.column_data.emplace_back(elem.data());
+				buffers.results.resize(rows);
+				kernel(buffers.column_data.data(), buffers.results.data(), rows);
+				check_array_lengths();
+				check_watchdog();
+				format_results(rows, buffers);
+				total_rows += rows;
+			}
+			catch (InvalidInput const& ex)
+			{
+				std::lock_guard<std::mutex> lock{written_mutex};
+				if (error.empty())
+					error = path + " : " + ex.what();
+				written_changed.notify_all();
+				return;
+			}
+			std::unique_lock<std::mutex> lock{written_mutex};
+			written_changed.wait(lock, [&] { return written == i || !error.empty(); });
+			if (!error.empty())
+				return;
+			os.write(buffers.text.data(), static_cast<std::streamsize>(buffers.text.size()));
+			++written;
+			written_changed.notify_all();
+		}
+	};
+
+	{
+		JitUnlock unlock;
+		auto threads = std::min<std::size_t>(std::max(std::thread::hardware_concurrency(), 1u), chunks.size());
+		std::vector<std::thread> workers;
+		for (std::size_t i{1} ; i < threads ; ++i)
+			workers.emplace_back(work);
+		work();
+		for (auto& elem : workers)
+			elem.join();
+	}
+	if (!error.empty())
+		throw InvalidInput{error};
+	return total_rows;
+}
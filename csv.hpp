@@ -0,0 +1,25 @@
+// Copyright 2015 Benoît Vey
+
+#ifndef CALC_CSV_HPP_
+#define CALC_CSV_HPP_
+
+#include <cstdint>
+#include <iosfwd>
+#include <map>
+#include <string>
+
+class DependencyGraph;
+class Parser;
+struct Function;
+
+// Evaluates a formula on each row of a CSV file of numbers, whose first line names the columns. The
+// columns used by the formula are its variables, and shadow the variables of the environment. The
+// file is mapped and split in chunks of lines, parsed and evaluated on all processors. The results
+// are written to the stream in the order of the rows, one per line, with the current number format.
+// Memory use does not depend on the size of the file. Must be called with the JIT lock held, which
+// is released while the rows are evaluated. Returns the number of rows. Throws InvalidInput if the
+// formula, or a function it calls, assigns variables.
+std::uint64_t apply_csv(std::string const& path, std::string const& formula, std::map<std::string, double>&,
+                        std::map<std::string, Function*>&, DependencyGraph const&, Parser&, std::ostream&);
+
+#endif // Header guard
@@ -0,0 +1,123 @@
+// Copyright 2015 Benoît Vey
+
+#include "dependency_graph.hpp"
+
+#include <algorithm>
+#include <utility>
+
+namespace
+{
+
+std::set<std::string> const no_deps;
+
+} // namespace
+
+void DependencyGraph::set_dependencies(std::string const& name, std::set<std::string> deps)
+{
+	remove(name);
+	for (auto& elem : deps)
+		users_[elem].insert(name);
+	deps_[name] = std::move(deps);
+}
+
+void DependencyGraph::remove(std::string const& name)
+{
+	auto it = deps_.find(name);
+	if (it == std::end(deps_))
+		return;
+	for (auto& elem : it->second)
+	{
+		auto users_it = users_.find(elem);
+		users_it->second.erase(name);
+		if (users_it->second.empty())
+			users_.erase(users_it);
+	}
+	deps_.erase(it);
+}
+
+std::set<std::string> const& DependencyGraph::dependencies(std::string const& name) const
+{
+	auto it = deps_.find(name);
+	if (it == std::end(deps_))
+		return no_deps;
+	return it->second;
+}
+
+bool DependencyGraph::depends_on(std::string const& name, std::string const& dep) const
+{
+	std::set<std::string> visited{name};
+	std::vector<std::string const*> to_visit{&name};
+	while (!to_visit.empty())
+	{
+		auto cur = to_visit.back();
+		to_visit.pop_back();
+		auto it = deps_.find(*cur);
+		if (it == std::end(deps_))
+			continue;
+		for (auto& elem : it->second)
+		{
+			if (elem == dep)
+				return true;
+			if (visited.insert(elem).second)
+				to_visit.emplace_back(&elem);
+		}
+	}
+	return false;
+}
+
+std::vector<std::string> DependencyGraph::dependents(std::string const& name) const
+{
+	std::vector<std::string> res;
+	std::set<std::string> visited{name};
+	std::vector<std::string const*> to_visit{&name};
+	while (!to_visit.empty())
+	{
+		auto cur = to_visit.back();
+		to_visit.pop_back();
+		auto it = users_.find(*cur);
+		if (it == std::end(users_))
+			continue;
+		for (auto& elem : it->second)
+		{
+			if (!visited.insert(elem).second)
+				continue;
+			res.emplace_back(elem);
+			to_visit.emplace_back(&elem);
+		}
+	}
+	return res;
+}
+
+std::vector<std::string> DependencyGraph::sorted_dependents(std::set<std::string> const& names) const
+{
+	// Reverse postorder of a depth-first walk on the users edges, so every identifier comes
+	// before the identifiers using it. The given names are part of the result.
+	std::vector<std::string> res;
+	std::set<std::string> visited;
+	std::vector<std::pair<std::string const*, bool>> to_visit;
+	for (auto& elem : names)
+		to_visit.emplace_back(&elem, false);
+	while (!to_visit.empty())
+	{
+		auto cur = to_visit.back();
+		to_visit.pop_back();
+		if (cur.second)
+		{
+			res.emplace_back(*cur.first);
+			continue;
+		}
+		if (!visited.insert(*cur.first).second)
+			continue;
+		to_visit.emplace_back(cur.first, true);
+		auto it = users_.find(*cur.first);
+		if (it == std::end(users_))
+			continue;
+		for (auto& elem : it->second)
+		{
+			if (visited.find(elem) == std::end(visited))
+				to_visit.emplace_back(&elem, false);
+		}
+	}
+	std::reverse(std::begin(res), std::end(res));
+	return res;
+}
@@ -0,0 +1,37 @@
+// Copyright 2015 Benoît Vey
+
+#ifndef CALC_DEPENDENCY_GRAPH_HPP_
+#define CALC_DEPENDENCY_GRAPH_HPP_
+
+#include <map>
+#include <set>
+#include <string>
+#include <vector>
+
+class DependencyGraph
+{
+	public:
+	DependencyGraph() = default;
+
+	DependencyGraph(DependencyGraph const&) = delete;
+	DependencyGraph& operator=(DependencyGraph const&) = delete;
+
+	DependencyGraph(DependencyGraph&&) = default;
+	DependencyGraph& operator=(DependencyGraph&&) = default;
+
+	~DependencyGraph() = default;
+
+	void set_dependencies(std::string const&, std::set<std::string>);
+	void remove(std::string const&);
+
+	std::set<std::string> const& dependencies(std::string const&) const;
+	bool depends_on(std::string const&, std::string const&) const;
+	std::vector<std::string> dependents(std::string const&) const;
+	std::vector<std::string> sorted_dependents(std::set<std::string> const&) const;
+
+	private:
+	std::map<std::string, std::set<std::string>> deps_;
+	std::map<std::string, std::set<std::string>> users_;
+};
+
+#endif // Header guard
@@ -0,0 +1,20 @@
+# Copyright 2015 Benoît Vey
+
+# Writes the bytes of the file INPUT as the array NAME, and its size as NAME_size, in the C++ source
+# OUTPUT. Without INPUT, the array is empty.
+
+if(INPUT)
+	file(READ ${INPUT} bytes HEX)
+	string(REGEX REPLACE "([0-9a-f][0-9a-f])" "0x\\1," bytes ${bytes})
+	set(size "sizeof(${NAME})")
+	set(source "${INPUT}")
+else()
+	set(bytes "0")
+	set(size "0")
+	set(source "nothing")
+endif()
+file(WRITE ${OUTPUT}
+     "// Generated from ${source}\n\n"
+     "#include <cstddef>\n\n"
+     "extern unsigned char const ${NAME}[] = {${bytes}};\n"
+     "extern std::size_t const ${NAME}_size = ${size};\n")
@@ -0,0 +1,204 @@
+// Copyright 2015 Benoît Vey
+
+#include "export.hpp"
+
+#include <cctype>
+#include <cstdio>
+#include <fstream>
+#include <vector>
+
+#include <spawn.h>
+#include <sys/wait.h>
+
+#include <llvm/IR/LegacyPassManager.h>
+#include <llvm/Support/FileSystem.h>
+#include <llvm/Support/Host.h>
+#include <llvm/Support/TargetRegistry.h>
+#include <llvm/Support/raw_ostream.h>
+#include <llvm/Target/TargetMachine.h>
+#include <llvm/Target/TargetOptions.h>
+
+#include "jit.hpp"
+#include "profile.hpp"
+#include "syntax_tree.hpp"
+#include "utility.hpp"
+#include "watchdog.hpp"
+
+extern char** environ;
+
+using namespace std::string_literals;
+
+namespace
+{
+
+char const variable_prefix[] = "calcvar_";
+// Parameter names may be C keywords or macros.
+char const parameter_prefix[] = "calcarg_";
+
+bool ends_with(std::string const& str, std::string const& suffix)
+{
+	return str.size() >= suffix.size() && str.compare(str.size() - suffix.size(), suffix.size(), suffix) == 0;
+}
+
+std::string header_path(std::string const& path)
+{
+	auto name_pos = path.find_last_of('/');
+	auto dot_pos = path.find_last_of('.');
+	if (dot_pos == std::string::npos || (name_pos != std::string::npos && dot_pos < name_pos))
+		return path + ".h";
+	return path.substr(0, dot_pos) + ".h";
+}
+
+// Session arrays are accessed through their address in this process, and the array runtime and rand
+// live in the program.
+void check_exportable(std::string const& name, llvm::Function const& fn)
+{
+	for (auto& block : fn)
+	{
+		for (auto& inst : block)
+		{
+			if (auto call = llvm::dyn_cast<llvm::CallInst>(&inst))
+			{
+				auto callee = call->getCalledFunction();
+				if (callee && callee->getName() == "calcfn_rand")
+					throw InvalidInput{"Function " + name + " uses rand and cannot be exported"};
+				if (callee && callee->getName().startswith("calcrt_"))
+					throw InvalidInput{"Function " + name + " uses arrays of the session and cannot be exported"};
+			}
+			for (auto& op : inst.operands())
+			{
+				auto expr = llvm::dyn_cast<llvm::ConstantExpr>(op.get());
+				if (llvm::isa<llvm::IntToPtrInst>(inst) || (expr && expr->getOpcode() == llvm::Instruction::IntToPtr))
+					throw InvalidInput{"Function " + name + " uses arrays of the session and cannot be exported"};
+			}
+		}
+	}
+}
+
+std::unique_ptr<llvm::TargetMachine> create_target(std::string const& cpu)
+{
+	auto triple = llvm::sys::getDefaultTargetTriple();
+	std::string error;
+	auto target = llvm::TargetRegistry::lookupTarget(triple, error);
+	if (!target)
+		throw InvalidInput{error};
+	// Position independent code can be linked in shared libraries too.
+	return std::unique_ptr<llvm::TargetMachine>{target->createTargetMachine(triple, cpu, "", llvm::TargetOptions{},
+	                                                                         llvm::Reloc::PIC_)};
+}
+
+void emit_object(llvm::Module& module, llvm::TargetMachine& target, std::string const& path)
+{
+	std::error_code error;
+	llvm::raw_fd_ostream stream{path, error, llvm::sys::fs::F_None};
+	if (error)
+		throw InvalidInput{"Cannot open " + path + " : " + error.message()};
+	llvm::legacy::PassManager passes;
+	if (target.addPassesToEmitFile(passes, stream, llvm::TargetMachine::CGFT_ObjectFile))
+		throw InvalidInput{"Target cannot emit object files"};
+	passes.run(module);
+}
+
+void link_shared(std::string const& object, std::string const& path)
+{
+	std::vector<char const*> args{"cc", "-shared", "-o", path.c_str(), object.c_str(), "-lm", nullptr};
+	pid_t pid;
+	auto status = 0;
+	auto spawned = posix_spawnp(&pid, "cc", nullptr, nullptr, const_cast<char* const*>(args.data()), environ) == 0;
+	if (spawned)
+		spawned = waitpid(pid, &status, 0) == pid;
+	std::remove(object.c_str());
+	if (!spawned || !WIFEXITED(status) || WEXITSTATUS(status) != 0)
+		throw InvalidInput{"Cannot link " + path + " with cc"};
+}
+
+void write_header(std::string const& path, std::vector<std::string> const& variables,
+                  std::vector<std::pair<std::string, Function*>> const& functions)
+{
+	auto guard = "CALC_"s;
+	auto name_pos = path.find_last_of('/');
+	for (auto c : path.substr(name_pos == std::string::npos ? 0 : name_pos + 1))
+		guard += std::isalnum(static_cast<unsigned char>(c)) ? static_cast<char>(std::toupper(c)) : '_';
+	guard += '_';
+
+	std::ofstream header{path};
+	if (!header)
+		throw InvalidInput{"Cannot open " + path};
+	header << "/* Generated by calc. Link with -lm. */\n\n"
+	       << "#ifndef " << guard << "\n#define " << guard << "\n\n"
+	       << "#ifdef __cplusplus\nextern \"C\" {\n#endif\n\n";
+	for (auto& elem : variables)
+		header << "extern double " << variable_prefix << elem << ";\n";
+	if (!variables.empty())
+		header << '\n';
+	for (auto& elem : functions)
+	{
+		header << "double " << compiled_name(elem.first) << '(';
+		auto& params = elem.second->param_names;
+		if (params.empty())
+			header << "void";
+		for (auto it = std::begin(params) ; it != std::end(params) ; ++it)
+			header << (it == std::begin(params) ? "" : ", ") << "double " << parameter_prefix << *it;
+		header << ");\n";
+	}
+	header << "\n#ifdef __cplusplus\n}\n#endif\n\n#endif\n";
+}
+
+} // namespace
+
+void export_functions(std::string const& path, std::string const& cpu, std::map<std::string, double>& vars,
+                      std::map<std::string, Function*>& funs)
+{
+	std::vector<std::pair<std::string, Function*>> functions;
+	for (auto& elem : funs)
+	{
+		if (elem.second->type == FunctionType::userdef)
+			functions.emplace_back(elem.first, elem.second);
+	}
+	if (functions.empty())
+		throw InvalidInput{"No functions to export"};
+
+	auto target = create_target(cpu.empty() ? llvm::sys::getHostCPUName().str() : cpu);
+	llvm::Module module{"CalcExport", jit_context()};
+	module.setDataLayout(target->createDataLayout());
+	module.setTargetTriple(target->getTargetTriple().str());
+	// The exported code does not count its calls, and cannot be interrupted.
+	auto old_profile = profile_mode();
+	set_profile_mode(ProfileMode::off);
+	set_polls_enabled(false);
+	try
+	{
+		for (auto& elem : functions)
+			check_exportable(elem.first, *define_function(module, elem.first, *elem.second));
+	}
+	catch (InvalidInput const&)
+	{
+		set_profile_mode(old_profile);
+		set_polls_enabled(true);
+		throw;
+	}
+	set_profile_mode(old_profile);
+	set_polls_enabled(true);
+
+	link_builtins(module);
+	std::vector<std::string> variables;
+	for (auto it = module.global_begin() ; it != module.global_end() ; ++it)
+	{
+		auto name = it->getName().str();
+		it->setInitializer(llvm::ConstantFP::get(llvm::Type::getDoubleTy(jit_context()), vars.at(name)));
+		it->setName(variable_prefix + name);
+		variables.emplace_back(std::move(name));
+	}
+	optimize(module, *target);
+
+	if (ends_with(path, ".so"))
+	{
+		emit_object(module, *target, path + ".o");
+		link_shared(path + ".o", path);
+	}
+	else
+		emit_object(module, *target, path);
+	write_header(header_path(path), variables, functions);
+	output() << "Exported " << functions.size() << " function" << (functions.size() == 1 ? "" : "s") << " to "
+	         << path << " and " << header_path(path) << '\n';
+}
@@ -0,0 +1,18 @@
+// Copyright 2015 Benoît Vey
+
+#ifndef CALC_EXPORT_HPP_
+#define CALC_EXPORT_HPP_
+
+#include <map>
+#include <string>
+
+struct Function;
+
+// Compiles every user function ahead of time for the CPU, into an object file or into a shared library
+// if the path ends with ".so". A C header declaring the functions is written next to it. The
+// functions are exported as calcdef_name and the variables they use as calcvar_name, initialized
+// with their current value. The exported code only depends on the C math library.
+void export_functions(std::string const& path, std::string const& cpu, std::map<std::string, double>&,
+                      std::map<std::string, Function*>&);
+
+#endif // Header guard
@@ -0,0 +1,736 @@
+// Copyright 2015 Benoît Vey
+
+#include "jit.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <cassert>
+#include <fstream>
+#include <unordered_set>
+#include <vector>
+
+#include <unistd.h>
+
+#include <llvm/ADT/Triple.h>
+#include <llvm/Analysis/TargetLibraryInfo.h>
+#include <llvm/Analysis/TargetTransformInfo.h>
+#include <llvm/Bitcode/ReaderWriter.h>
+#include <llvm/Config/llvm-config.h>
+#include <llvm/IR/LegacyPassManager.h>
+#include <llvm/IR/Verifier.h>
+#include <llvm/ExecutionEngine/ExecutionEngine.h>
+#include <llvm/ExecutionEngine/JITEventListener.h>
+#include <llvm/ExecutionEngine/MCJIT.h>
+#include <llvm/ExecutionEngine/SectionMemoryManager.h>
+#include <llvm/Linker/Linker.h>
+#include <llvm/Object/SymbolSize.h>
+#include <llvm/Support/ErrorHandling.h>
+#include <llvm/Support/Host.h>
+#include <llvm/Support/MemoryBuffer.h>
+#include <llvm/Support/TargetSelect.h>
+#include <llvm/Target/TargetMachine.h>
+#include <llvm/Transforms/IPO.h>
+#include <llvm/Transforms/IPO/InferFunctionAttrs.h>
+#include <llvm/Transforms/IPO/PassManagerBuilder.h>
+#include <llvm/Transforms/Scalar.h>
+#include <llvm/Transforms/Utils/Cloning.h>
+
+#include "arrays.hpp"
+#include "command_handler.hpp"
+#include "dependency_graph.hpp"
+#include "profile.hpp"
+#include "random.hpp"
+#include "syntax_tree.hpp"
+#include "watchdog.hpp"
+
+// Generated from builtins.c at build time.
+extern unsigned char const builtins_bitcode[];
+extern std::size_t const builtins_bitcode_size;
+
+namespace
+{
+
+char const compiled_prefix[] = "calcdef_";
+char const library_code_prefix{'#'};
+
+// The optimizing code generator takes a time quadratic in the length of very long expressions. Bigger
+// modules are compiled by the fast code generator, in linear time.
+std::size_t const max_optimized_instructions{1 << 14};
+
+// Mapped explicitly, so that they are found even when the program does not export its symbols.
+std::map<std::string, void*> const runtime_functions
+	{{"calcrt_array_alloc", reinterpret_cast<void*>(&calcrt_array_alloc)},
+	 {"calcrt_array_mismatch", reinterpret_cast<void*>(&calcrt_array_mismatch)},
+	 {"calcrt_profile", reinterpret_cast<void*>(&calcrt_profile)},
+	 {"calcrt_poll", reinterpret_cast<void*>(&calcrt_poll)},
+	 {"calcrt_loop_limit", reinterpret_cast<void*>(&calcrt_loop_limit)},
+	 {"calcfn_tan", reinterpret_cast<void*>(&calcfn_tan)},
+	 {"calcfn_asin", reinterpret_cast<void*>(&calcfn_asin)},
+	 {"calcfn_acos", reinterpret_cast<void*>(&calcfn_acos)},
+	 {"calcfn_atan", reinterpret_cast<void*>(&calcfn_atan)},
+	 {"calcfn_gamma", reinterpret_cast<void*>(&calcfn_gamma)},
+	 {"calcfn_rand", reinterpret_cast<void*>(&calcfn_rand)},
+	 {"calcfn_sample", reinterpret_cast<void*>(&calcfn_sample)}};
+
+std::atomic<std::size_t> live_engines{0};
+std::atomic<std::size_t> ir_instructions{0};
+std::atomic<std::size_t> code_bytes{0};
+std::atomic<std::size_t> data_bytes{0};
+std::atomic<std::size_t> evictions{0};
+std::atomic<std::size_t> limit{0};
+std::atomic<std::uint64_t> use_clock{0};
+
+std::atomic<std::uint64_t> versions{0};
+
+thread_local std::shared_ptr<llvm::LLVMContext> thread_context;
+// Sections are allocated by the thread finalizing the engine, so the sections of a function are
+// measured on its thread even when other threads compile at the same time.
+thread_local std::size_t thread_section_bytes{0};
+
+// Counts the pages of the sections of an engine, and the IR it keeps, until the engine is destroyed.
+// Each engine maps its code, read-only data and writable data in separate pages.
+class AccountedMemoryManager : public llvm::SectionMemoryManager
+{
+	public:
+	AccountedMemoryManager(std::size_t instructions)
+		: instructions_{instructions}, code_{0}, read_only_{0}, writable_{0}
+	{
+		++live_engines;
+		ir_instructions += instructions_;
+	}
+
+	~AccountedMemoryManager() override
+	{
+		--live_engines;
+		ir_instructions -= instructions_;
+		code_bytes -= pages(code_);
+		data_bytes -= pages(read_only_) + pages(writable_);
+	}
+
+	std::uint8_t* allocateCodeSection(std::uintptr_t size, unsigned alignment, unsigned id,
+	                                  llvm::StringRef name) override
+	{
+		auto added = pages(code_ + size) - pages(code_);
+		code_bytes += added;
+		thread_section_bytes += added;
+		code_ += size;
+		return llvm::SectionMemoryManager::allocateCodeSection(size, alignment, id, name);
+	}
+
+	std::uint8_t* allocateDataSection(std::uintptr_t size, unsigned alignment, unsigned id,
+	                                  llvm::StringRef name, bool read_only) override
+	{
+		auto& group = read_only ? read_only_ : writable_;
+		auto added = pages(group + size) - pages(group);
+		data_bytes += added;
+		thread_section_bytes += added;
+		group += size;
+		return llvm::SectionMemoryManager::allocateDataSection(size, alignment, id, name, read_only);
+	}
+
+	private:
+	static std::size_t pages(std::size_t bytes)
+	{
+		static std::size_t const page_size = static_cast<std::size_t>(sysconf(_SC_PAGESIZE));
+		return (bytes + page_size - 1) / page_size * page_size;
+	}
+
+	std::size_t instructions_;
+	std::size_t code_;
+	std::size_t read_only_;
+	std::size_t writable_;
+};
+
+// Writes the address, size and name of each emitted function to /tmp/perf-<pid>.map, where perf looks
+// for the code which is not in a mapped file. Engines are finalized by several threads at once.
+class PerfMapListener : public llvm::JITEventListener
+{
+	public:
+	PerfMapListener()
+		: file_{"/tmp/perf-" + std::to_string(getpid()) + ".map"}
+	{}
+
+	void NotifyObjectEmitted(llvm::object::ObjectFile const& object,
+	                         llvm::RuntimeDyld::LoadedObjectInfo const& info) override
+	{
+		// The sections of the debug object are at their loaded addresses.
+		auto debug_object = info.getObjectForDebug(object);
+		if (!debug_object.getBinary())
+			return;
+		std::lock_guard<std::mutex> lock{mutex_};
+		for (auto& elem : llvm::object::computeSymbolSizes(*debug_object.getBinary()))
+		{
+			auto& symbol = elem.first;
+			if (symbol.getType() != llvm::object::SymbolRef::ST_Function || elem.second == 0)
+				continue;
+			auto name = symbol.getName();
+			auto address = symbol.getAddress();
+			if (!name || !address)
+				continue;
+			file_ << std::hex << *address << ' ' << elem.second << std::dec << ' ' << name->str() << '\n';
+		}
+		file_.flush();
+	}
+
+	private:
+	std::ofstream file_;
+	std::mutex mutex_;
+};
+
+std::vector<llvm::JITEventListener*> listeners;
+
+std::size_t instruction_count(llvm::Module const& module)
+{
+	std::size_t count{0};
+	for (auto& fn : module)
+	{
+		for (auto& block : fn)
+			count += block.size();
+	}
+	return count;
+}
+
+// Plain expressions are compiled as they are. Modules containing loops are worth optimizing
+// for the host CPU so that the loops get vectorized. Loops branch back to an earlier block, while
+// long expressions are only split in consecutive blocks.
+bool has_loops(llvm::Module const& module)
+{
+	for (auto& fn : module)
+	{
+		std::unordered_set<llvm::BasicBlock const*> seen;
+		for (auto& block : fn)
+		{
+			seen.insert(&block);
+			auto terminator = block.getTerminator();
+			if (!terminator)
+				continue;
+			for (unsigned i = 0 ; i < terminator->getNumSuccessors() ; ++i)
+			{
+				if (seen.count(terminator->getSuccessor(i)))
+					return true;
+			}
+		}
+	}
+	return false;
+}
+
+// Bitcode written by a clang of another LLVM version cannot be read.
+std::unique_ptr<llvm::Module> parse_builtins(llvm::LLVMContext& ctx)
+{
+	llvm::StringRef bitcode{reinterpret_cast<char const*>(builtins_bitcode), builtins_bitcode_size};
+	auto parsed = llvm::parseBitcodeFile(llvm::MemoryBufferRef{bitcode, "builtins"}, ctx);
+	if (!parsed)
+		throw InvalidInput{"Cannot read the builtins bitcode, which must be compiled by the clang of LLVM "
+		                   LLVM_VERSION_STRING " : " + parsed.getError().message()};
+	return std::move(parsed.get());
+}
+
+// Parsed by initialize_jit, or nullptr when the library was built without clang. Owned by the global
+// context, which deletes its modules when it is destroyed.
+llvm::Module* builtins{nullptr};
+
+bool is_builtin(llvm::Function const& fn)
+{
+	if (!builtins)
+		return false;
+	auto builtin = builtins->getFunction(fn.getName());
+	return builtin && !builtin->isDeclaration();
+}
+
+// Inlining the builtins is worth its compilation time when the calls can be folded or vectorized.
+// Otherwise, the builtins compiled in the library are called.
+bool should_link_builtins(llvm::Module const& module)
+{
+	if (has_loops(module))
+		return true;
+	for (auto& fn : module)
+	{
+		for (auto& block : fn)
+		{
+			for (auto& inst : block)
+			{
+				auto call = llvm::dyn_cast<llvm::CallInst>(&inst);
+				if (!call || !call->getCalledFunction() || !is_builtin(*call->getCalledFunction()))
+					continue;
+				auto constant = true;
+				for (unsigned i = 0 ; i < call->getNumArgOperands() ; ++i)
+					constant = constant && llvm::isa<llvm::Constant>(call->getArgOperand(i));
+				if (constant)
+					return true;
+			}
+		}
+	}
+	return false;
+}
+
+// The previous engine may live in the previous context.
+void install_code(PreparedFunction& prepared)
+{
+	auto& fn = *prepared.function;
+	fn.address = prepared.address;
+	fn.engine = std::move(prepared.engine);
+	fn.context = thread_context;
+	fn.code_size = prepared.code_size;
+	fn.last_use = ++use_clock;
+}
+
+} // namespace
+
+void optimize(llvm::Module& module, llvm::TargetMachine& target)
+{
+	llvm::PassManagerBuilder pm_builder;
+	pm_builder.OptLevel = 2;
+	pm_builder.LoopVectorize = true;
+	pm_builder.SLPVectorize = true;
+
+	llvm::legacy::FunctionPassManager fn_passes{&module};
+	llvm::legacy::PassManager module_passes;
+	fn_passes.add(llvm::createTargetTransformInfoWrapperPass(target.getTargetIRAnalysis()));
+	module_passes.add(llvm::createTargetTransformInfoWrapperPass(target.getTargetIRAnalysis()));
+	pm_builder.populateFunctionPassManager(fn_passes);
+	pm_builder.populateModulePassManager(module_passes);
+
+	fn_passes.doInitialization();
+	for (auto& elem : module)
+		fn_passes.run(elem);
+	fn_passes.doFinalization();
+	module_passes.run(module);
+}
+
+void initialize_jit()
+{
+	llvm::InitializeNativeTarget();
+	llvm::InitializeNativeTargetAsmParser();
+	llvm::InitializeNativeTargetAsmPrinter();
+	if (builtins_bitcode_size != 0)
+		builtins = parse_builtins(llvm::getGlobalContext()).release();
+}
+
+JitMemory jit_memory()
+{
+	return {live_engines, ir_instructions, code_bytes, data_bytes, evictions};
+}
+
+std::size_t code_limit()
+{
+	return limit;
+}
+
+void set_code_limit(std::size_t bytes)
+{
+	limit = bytes;
+}
+
+std::mutex& jit_mutex()
+{
+	static std::mutex mutex;
+	return mutex;
+}
+
+JitUnlock::JitUnlock()
+{
+	jit_mutex().unlock();
+}
+
+JitUnlock::~JitUnlock()
+{
+	jit_mutex().lock();
+}
+
+llvm::LLVMContext& jit_context()
+{
+	return thread_context ? *thread_context : llvm::getGlobalContext();
+}
+
+void set_jit_context(std::shared_ptr<llvm::LLVMContext> ctx)
+{
+	thread_context = std::move(ctx);
+}
+
+void enable_listener(JitListener listener)
+{
+	static PerfMapListener perf_map;
+	auto added = listener == JitListener::perf_map ? &perf_map
+	                                                : llvm::JITEventListener::createGDBRegistrationListener();
+	if (std::find(std::begin(listeners), std::end(listeners), added) == std::end(listeners))
+		listeners.emplace_back(added);
+}
+
+std::string expression_name(std::size_t line)
+{
+	return line ? "cmain_" + std::to_string(line) : "cmain";
+}
+
+std::string compiled_name(std::string const& fn_name)
+{
+	return compiled_prefix + fn_name;
+}
+
+llvm::GlobalVariable* declare_variable(llvm::Module& module, std::string const& label)
+{
+	auto var = module.getGlobalVariable(label);
+	if (!var)
+		var = new llvm::GlobalVariable{module, llvm::Type::getDoubleTy(jit_context()), false,
+		                               llvm::GlobalVariable::ExternalLinkage, nullptr, label};
+	return var;
+}
+
+void link_builtins(llvm::Module& module)
+{
+	if (std::none_of(std::begin(module), std::end(module), is_builtin))
+		return;
+
+	// The module of the global context cannot be cloned in other contexts, which parse their own copy.
+	auto& ctx = module.getContext();
+	auto linked = &ctx == &llvm::getGlobalContext() ? llvm::CloneModule(builtins) : parse_builtins(ctx);
+	linked->setDataLayout(module.getDataLayout());
+	linked->setTargetTriple(module.getTargetTriple());
+	llvm::Linker::linkModules(module, std::move(linked), llvm::Linker::Flags::LinkOnlyNeeded);
+	for (auto& elem : module)
+	{
+		if (!is_builtin(elem))
+			continue;
+		elem.setLinkage(llvm::Function::InternalLinkage);
+		elem.addFnAttr(llvm::Attribute::AlwaysInline);
+	}
+
+	// Calls with constant arguments are folded once inlined, and the builtins are then removed.
+	llvm::legacy::PassManager passes;
+	passes.add(new llvm::TargetLibraryInfoWrapperPass{llvm::Triple{module.getTargetTriple()}});
+	passes.add(llvm::createInferFunctionAttrsLegacyPass());
+	passes.add(llvm::createAlwaysInlinerPass());
+	passes.add(llvm::createInstructionCombiningPass());
+	passes.add(llvm::createGlobalDCEPass());
+	passes.run(module);
+}
+
+std::unique_ptr<llvm::ExecutionEngine> create_engine(std::unique_ptr<llvm::Module> module, bool optimized)
+{
+	auto module_ref = module.get();
+	llvm::EngineBuilder engine_builder{std::move(module)};
+	engine_builder.setMCPU(llvm::sys::getHostCPUName());
+	if (optimized)
+		engine_builder.setOptLevel(llvm::CodeGenOpt::Aggressive);
+	auto target = engine_builder.selectTarget();
+	module_ref->setDataLayout(target->createDataLayout());
+	module_ref->setTargetTriple(target->getTargetTriple().str());
+	if (optimized || should_link_builtins(*module_ref))
+		link_builtins(*module_ref);
+	if (optimized || has_loops(*module_ref))
+		optimize(*module_ref, *target);
+	auto instructions = instruction_count(*module_ref);
+	if (instructions > max_optimized_instructions)
+		target->setOptLevel(llvm::CodeGenOpt::None);
+	engine_builder.setMCJITMemoryManager(std::make_unique<AccountedMemoryManager>(instructions));
+	std::unique_ptr<llvm::ExecutionEngine> engine{engine_builder.create(target)};
+	for (auto elem : listeners)
+		engine->RegisterJITEventListener(elem);
+	return engine;
+}
+
+llvm::Function* define_function(llvm::Module& module, std::string const& name, Function& fn)
+{
+	assert(fn.type == FunctionType::userdef);
+	if (fn.body->is_array())
+		throw InvalidInput{"Function " + name + " must return a number"};
+
+	std::vector<llvm::Type*> args_type{fn.param_names.size(), llvm::Type::getDoubleTy(jit_context())};
+	auto fn_type = llvm::FunctionType::get(llvm::Type::getDoubleTy(jit_context()), args_type, false);
+	// Other functions of the module may already have declared it.
+	auto function = module.getFunction(compiled_name(name));
+	if (!function)
+		function = llvm::Function::Create(fn_type, llvm::Function::ExternalLinkage, compiled_name(name), &module);
+
+	fn.param_values.clear();
+	auto name_it = std::begin(fn.param_names);
+	for (auto arg_it = function->arg_begin() ; arg_it != function->arg_end() ; ++arg_it, ++name_it)
+	{
+		arg_it->setName(*name_it);
+		fn.param_values.emplace_back(&*arg_it);
+	}
+
+	llvm::IRBuilder<> builder{jit_context()};
+	auto block = llvm::BasicBlock::Create(jit_context(), "entry", function);
+	builder.SetInsertPoint(block);
+	builder.CreateRet(fn.body->codegen(module, builder));
+
+	llvm::verifyFunction(*function);
+	return function;
+}
+
+void compile_function(std::string const& name, Function& fn, std::map<std::string, double>& vars,
+                      std::map<std::string, Function*>& funs)
+{
+	auto prepared = prepare_function(name, fn, vars, funs);
+	build_function(prepared, false);
+	install_code(prepared);
+}
+
+PreparedFunction prepare_function(std::string const& name, Function& fn, std::map<std::string, double>& vars,
+                                  std::map<std::string, Function*>& funs)
+{
+	auto module = std::make_unique<llvm::Module>("CalcDef_" + name, jit_context());
+	define_function(*module, name, fn);
+	auto symbols = find_symbols(*module, vars, funs);
+	return {name, &fn, fn.version, std::move(module), std::move(symbols), nullptr, 0, 0};
+}
+
+void build_function(PreparedFunction& prepared, bool optimized)
+{
+	auto module_ref = prepared.module.get();
+	prepared.engine = create_engine(std::move(prepared.module), optimized);
+	map_symbols(*module_ref, *prepared.engine, prepared.symbols);
+	// The functions it calls are compiled by prepare_function, so this is the code of this function only.
+	auto sections_before = thread_section_bytes;
+	prepared.engine->finalizeObject();
+	prepared.address = prepared.engine->getFunctionAddress(compiled_name(prepared.name));
+	prepared.code_size = thread_section_bytes - sections_before;
+}
+
+bool install_function(PreparedFunction& prepared, std::map<std::string, Function*> const& funs)
+{
+	auto fun_it = funs.find(prepared.name);
+	if (fun_it == std::end(funs) || fun_it->second != prepared.function)
+		return false;
+	if (prepared.function->version != prepared.version || prepared.function->address)
+		return false;
+	install_code(prepared);
+	return true;
+}
+
+CompiledExpression compile_expression(ExprTree& expr, std::map<std::string, double>& vars,
+                                      std::map<std::string, Function*>& funs, ArrayResults& results,
+                                      std::size_t line)
+{
+	auto name = expression_name(line);
+	auto& ctx = jit_context();
+	auto module = std::make_unique<llvm::Module>("CalcMain", ctx);
+	auto module_ref = module.get();
+	auto calc_type = llvm::FunctionType::get(llvm::Type::getDoubleTy(ctx), {}, false);
+	auto calc_main = llvm::Function::Create(calc_type, llvm::Function::ExternalLinkage, name, module_ref);
+
+	llvm::IRBuilder<> builder{ctx};
+	auto block = llvm::BasicBlock::Create(ctx, "entry", calc_main);
+	builder.SetInsertPoint(block);
+	if (expr.is_array())
+	{
+		codegen_array(expr, *module_ref, builder, results);
+		builder.CreateRet(llvm::ConstantFP::getNaN(llvm::Type::getDoubleTy(ctx)));
+	}
+	else
+		builder.CreateRet(expr.codegen(*module_ref, builder));
+
+	llvm::verifyFunction(*calc_main);
+
+	auto engine = create_engine(std::move(module));
+	link_symbols(*module_ref, *engine, vars, funs);
+	auto sections_before = thread_section_bytes;
+	engine->finalizeObject();
+
+	auto entry = reinterpret_cast<double(*)()>(engine->getFunctionAddress(name));
+	return {std::move(engine), entry, thread_section_bytes - sections_before, ++use_clock};
+}
+
+void link_symbols(llvm::Module& module, llvm::ExecutionEngine& engine, std::map<std::string, double>& vars,
+                  std::map<std::string, Function*>& funs)
+{
+	map_symbols(module, engine, find_symbols(module, vars, funs));
+}
+
+Symbols find_symbols(llvm::Module& module, std::map<std::string, double>& vars, std::map<std::string, Function*>& funs)
+{
+	Symbols symbols{std::begin(runtime_functions), std::end(runtime_functions)};
+	for (auto it = module.global_begin() ; it != module.global_end() ; ++it)
+	{
+		auto var_it = vars.find(it->getName().str());
+		assert(var_it != std::end(vars));
+		symbols[var_it->first] = &var_it->second;
+	}
+	for (auto& elem : module)
+	{
+		auto name = elem.getName();
+		if (!elem.isDeclaration() || !name.startswith(compiled_prefix))
+			continue;
+		auto fun_it = funs.find(name.substr(sizeof(compiled_prefix) - 1).str());
+		assert(fun_it != std::end(funs) && fun_it->second->type == FunctionType::userdef);
+		auto fn = fun_it->second;
+		if (!fn->address)
+			compile_function(fun_it->first, *fn, vars, funs);
+		fn->last_use = ++use_clock;
+		symbols[name.str()] = reinterpret_cast<void*>(fn->address);
+	}
+	return symbols;
+}
+
+// Building the engine may remove unused declarations, and add the declarations of the runtime
+// functions called by the builtins it links.
+void map_symbols(llvm::Module& module, llvm::ExecutionEngine& engine, Symbols const& symbols)
+{
+	for (auto it = module.global_begin() ; it != module.global_end() ; ++it)
+		engine.addGlobalMapping(&*it, symbols.at(it->getName().str()));
+	for (auto& elem : module)
+	{
+		auto symbol_it = symbols.find(elem.getName().str());
+		if (elem.isDeclaration() && symbol_it != std::end(symbols))
+			engine.addGlobalMapping(&elem, symbol_it->second);
+	}
+}
+
+void discard_code(Function& fn)
+{
+	fn.engine.reset();
+	fn.address = 0;
+	fn.version = ++versions;
+}
+
+void invalidate_dependents(std::string const& name, DependencyGraph const& graph,
+                           std::map<std::string, Function*>& funs)
+{
+	for (auto& elem : graph.dependents(name))
+	{
+		auto fun_it = funs.find(elem);
+		if (fun_it == std::end(funs) || fun_it->second->type != FunctionType::userdef)
+			continue;
+		discard_code(*fun_it->second);
+	}
+}
+
+std::string library_code_name(std::size_t index)
+{
+	return library_code_prefix + std::to_string(index);
+}
+
+void check_replaceable(std::string const& name, DependencyGraph const& graph,
+                       std::map<std::string, Function*> const& funs)
+{
+	auto used = [&funs](std::string const& elem)
+	{
+		if (elem.front() == library_code_prefix)
+			return true;
+		auto fun_it = funs.find(elem);
+		return fun_it != std::end(funs) && fun_it->second->type == FunctionType::userdef && fun_it->second->pinned;
+	};
+	auto dependents = graph.dependents(name);
+	if (used(name) || std::any_of(std::begin(dependents), std::end(dependents), used))
+		throw InvalidInput{"Cannot redefine or delete " + name + " : the code compiled for the library uses it"};
+}
+
+bool assigns_variables(ExprTree& expr, std::set<std::string> const& deps, std::map<std::string, Function*> const& funs,
+                       DependencyGraph const& graph)
+{
+	auto assigns = expr.has_assignments();
+	std::set<std::string> visited;
+	std::vector<std::string> to_visit{std::begin(deps), std::end(deps)};
+	while (!assigns && !to_visit.empty())
+	{
+		auto cur = std::move(to_visit.back());
+		to_visit.pop_back();
+		auto fun_it = funs.find(cur);
+		if (fun_it == std::end(funs) || fun_it->second->type != FunctionType::userdef ||
+		    !visited.insert(cur).second)
+			continue;
+		assigns = fun_it->second->body->has_assignments();
+		auto& callees = graph.dependencies(cur);
+		to_visit.insert(std::end(to_visit), std::begin(callees), std::end(callees));
+	}
+	return assigns;
+}
+
+std::set<std::string> assigned_variables(ExprTree& expr, std::set<std::string> const& deps,
+                                         std::map<std::string, Function*> const& funs, DependencyGraph const& graph)
+{
+	std::set<std::string> res;
+	expr.add_assigned_variables(res);
+	std::set<std::string> visited;
+	std::vector<std::string> to_visit{std::begin(deps), std::end(deps)};
+	while (!to_visit.empty())
+	{
+		auto cur = std::move(to_visit.back());
+		to_visit.pop_back();
+		auto fun_it = funs.find(cur);
+		if (fun_it == std::end(funs) || fun_it->second->type != FunctionType::userdef ||
+		    !visited.insert(cur).second)
+			continue;
+		fun_it->second->body->add_assigned_variables(res);
+		auto& callees = graph.dependencies(cur);
+		to_visit.insert(std::end(to_visit), std::begin(callees), std::end(callees));
+	}
+	return res;
+}
+
+void invalidate_functions(std::map<std::string, Function*>& funs)
+{
+	for (auto& elem : funs)
+	{
+		if (elem.second->type == FunctionType::userdef && elem.second->pinned)
+			throw InvalidInput{"Cannot recompile " + elem.first + " : the code compiled for the library calls it"};
+	}
+	for (auto& elem : funs)
+	{
+		if (elem.second->type != FunctionType::userdef)
+			continue;
+		discard_code(*elem.second);
+	}
+}
+
+void mark_used(Function& fn)
+{
+	fn.last_use = ++use_clock;
+}
+
+void mark_used(CompiledExpression& expr)
+{
+	expr.last_use = ++use_clock;
+}
+
+std::uint64_t use_time()
+{
+	return use_clock;
+}
+
+void evict_functions(std::map<std::string, Function*>& funs, DependencyGraph const& graph, ExpressionCache& cache,
+                     std::uint64_t used_since)
+{
+	while (limit != 0 && code_bytes + data_bytes > limit)
+	{
+		// The engine of an expression is destroyed once the sessions running it are done.
+		auto cached = std::end(cache);
+		for (auto it = std::begin(cache) ; it != std::end(cache) ; ++it)
+		{
+			if (it->second->last_use <= used_since &&
+			    (cached == std::end(cache) || it->second->last_use < cached->second->last_use))
+				cached = it;
+		}
+		// Compiled code refers to the address of the functions it calls, so the callers are evicted too.
+		// The callers of pinned functions cannot be.
+		auto victim = std::end(funs);
+		for (auto it = std::begin(funs) ; it != std::end(funs) ; ++it)
+		{
+			auto fn = it->second;
+			if (fn->type != FunctionType::userdef || !fn->address || fn->pinned || fn->last_use > used_since)
+				continue;
+			if (victim != std::end(funs) && victim->second->last_use <= fn->last_use)
+				continue;
+			auto dependents = graph.dependents(it->first);
+			auto pinned = std::any_of(std::begin(dependents), std::end(dependents), [&funs](std::string const& name)
+			{
+				auto fun_it = funs.find(name);
+				return fun_it != std::end(funs) && fun_it->second->pinned;
+			});
+			if (!pinned)
+				victim = it;
+		}
+		if (cached != std::end(cache) &&
+		    (victim == std::end(funs) || cached->second->last_use < victim->second->last_use))
+		{
+			cache.erase(cached);
+			++evictions;
+			continue;
+		}
+		if (victim == std::end(funs))
+			return;
+		invalidate_dependents(victim->first, graph, funs);
+		discard_code(*victim->second);
+		++evictions;
+	}
+}
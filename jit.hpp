@@ -0,0 +1,201 @@
+// Copyright 2015 Benoît Vey
+
+#ifndef CALC_JIT_HPP_
+#define CALC_JIT_HPP_
+
+#include <cstddef>
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <set>
+#include <string>
+
+namespace llvm
+{
+	class ExecutionEngine;
+	class Function;
+	class GlobalVariable;
+	class LLVMContext;
+	class Module;
+	class TargetMachine;
+}
+
+class DependencyGraph;
+class ExprTree;
+struct Array;
+struct Function;
+
+struct CompiledExpression
+{
+	std::unique_ptr<llvm::ExecutionEngine> engine;
+	double (*entry)();
+	std::size_t code_size;
+	std::uint64_t last_use;
+};
+
+// Expressions without side effects nor user definitions only depend on their text and the numeric,
+// algebra and profiling modes, so their compiled code can be shared between sessions. The sessions
+// running an expression own it too, so that other sessions can evict it in the meantime.
+using ExpressionCache = std::map<std::string, std::shared_ptr<CompiledExpression>>;
+
+// Memory used by all the live engines. The IR of a module is kept by its engine once compiled.
+struct JitMemory
+{
+	std::size_t engines;
+	std::size_t ir_instructions;
+	std::size_t code_bytes;
+	std::size_t data_bytes;
+	std::size_t evictions;
+};
+
+JitMemory jit_memory();
+
+// Once the code and data of the engines go over the limit, the least recently used user functions
+// and cached expressions are evicted and compiled again on their next use. 0 means no limit.
+std::size_t code_limit();
+void set_code_limit(std::size_t);
+
+// LLVM objects live in the global context, so compilation is serialized. Compiled code can run
+// without holding the lock.
+std::mutex& jit_mutex();
+
+// Releases the JIT lock held by the current thread while it runs compiled code, and takes it back
+// when destroyed, so that long computations do not stop other sessions from compiling. The
+// environment of the session cannot change meanwhile, since a session is used by one thread at a
+// time.
+class JitUnlock
+{
+	public:
+	JitUnlock();
+
+	JitUnlock(JitUnlock const&) = delete;
+	JitUnlock& operator=(JitUnlock const&) = delete;
+
+	JitUnlock(JitUnlock&&) = delete;
+	JitUnlock& operator=(JitUnlock&&) = delete;
+
+	~JitUnlock();
+};
+
+// Context in which the current thread creates LLVM objects. It is the global context, unless the
+// thread was given a context of its own to compile in parallel with other threads. Functions compiled
+// in such a context keep it alive. nullptr restores the global context.
+llvm::LLVMContext& jit_context();
+void set_jit_context(std::shared_ptr<llvm::LLVMContext>);
+
+// Prepares LLVM for the host. Must be called once before compiling anything. Throws InvalidInput if
+// the builtins bitcode embedded in the library cannot be read.
+void initialize_jit();
+
+// Tells profilers and debuggers about the code of the engines created afterwards. perf_map writes
+// /tmp/perf-<pid>.map for perf, and gdb registers the objects with the GDB JIT interface. Must be
+// called before compiling anything.
+enum class JitListener
+{
+	perf_map,
+	gdb
+};
+
+void enable_listener(JitListener);
+
+// Name of the compiled code of an input line, cmain_<line>, or cmain if the line is 0.
+std::string expression_name(std::size_t line);
+
+std::string compiled_name(std::string const&);
+
+llvm::GlobalVariable* declare_variable(llvm::Module&, std::string const&);
+
+// Links the builtins called by the module from the bitcode embedded in the library, and inlines them.
+void link_builtins(llvm::Module&);
+
+// Runs the O2 pipeline with the vectorizers, tuned for the target.
+void optimize(llvm::Module&, llvm::TargetMachine&);
+
+// Optimized engines always run the O2 pipeline and inline the builtins, and generate code at the
+// highest level.
+std::unique_ptr<llvm::ExecutionEngine> create_engine(std::unique_ptr<llvm::Module>, bool optimized = false);
+
+// Generates the compiled function in the module. The parameter values of the function are bound to
+// its arguments.
+llvm::Function* define_function(llvm::Module&, std::string const&, Function&);
+
+void compile_function(std::string const&, Function&, std::map<std::string, double>&,
+                      std::map<std::string, Function*>&);
+
+// Addresses of the variables and functions used by compiled code, by name.
+using Symbols = std::map<std::string, void*>;
+
+// A user function compiled in steps, so that its machine code can be generated without holding the
+// JIT lock. The other steps need the lock.
+struct PreparedFunction
+{
+	std::string name;
+	Function* function;
+	std::uint64_t version;
+	std::unique_ptr<llvm::Module> module;
+	Symbols symbols;
+	std::unique_ptr<llvm::ExecutionEngine> engine;
+	std::uint64_t address;
+	std::size_t code_size;
+};
+
+// Generates the IR of the function and finds its symbols, compiling the functions it calls if needed.
+PreparedFunction prepare_function(std::string const&, Function&, std::map<std::string, double>&,
+                                  std::map<std::string, Function*>&);
+
+// Generates the machine code. Only uses the context of the module.
+void build_function(PreparedFunction&, bool optimized);
+
+// Gives the code to the function, unless the function was redefined or its code discarded since it
+// was prepared. Returns false if the code is dropped.
+bool install_function(PreparedFunction&, std::map<std::string, Function*> const&);
+
+// Array expressions store their elements in the unnamed result and return NaN. The code is named
+// after the line of input, if any.
+CompiledExpression compile_expression(ExprTree&, std::map<std::string, double>&, std::map<std::string, Function*>&,
+                                      std::map<std::string, Array>&, std::size_t line = 0);
+
+void link_symbols(llvm::Module&, llvm::ExecutionEngine&, std::map<std::string, double>&,
+                  std::map<std::string, Function*>&);
+
+Symbols find_symbols(llvm::Module&, std::map<std::string, double>&, std::map<std::string, Function*>&);
+void map_symbols(llvm::Module&, llvm::ExecutionEngine&, Symbols const&);
+
+// Drops the compiled code of a user function. Code prepared for it before is not installed anymore.
+void discard_code(Function&);
+
+void invalidate_dependents(std::string const&, DependencyGraph const&, std::map<std::string, Function*>&);
+
+// The dependencies of the code given to the user of the library are in the graph under these names,
+// which are not identifiers.
+std::string library_code_name(std::size_t index);
+
+// Throws InvalidInput if the code given to the user of the library uses the identifier, directly or
+// through the functions it calls, since it cannot be redefined or deleted anymore.
+void check_replaceable(std::string const&, DependencyGraph const&, std::map<std::string, Function*> const&);
+
+// Whether the expression, or the user functions it calls directly or not, assign variables.
+bool assigns_variables(ExprTree&, std::set<std::string> const& deps, std::map<std::string, Function*> const&,
+                       DependencyGraph const&);
+
+// Variables assigned by the expression, or by the user functions it calls directly or not.
+std::set<std::string> assigned_variables(ExprTree&, std::set<std::string> const& deps,
+                                         std::map<std::string, Function*> const&, DependencyGraph const&);
+
+// Throws InvalidInput without discarding anything if a function is pinned.
+void invalidate_functions(std::map<std::string, Function*>&);
+
+// Makes the code the most recently used one, which is evicted last.
+void mark_used(Function&);
+void mark_used(CompiledExpression&);
+// Value of the use clock, which the next uses go past.
+std::uint64_t use_time();
+
+// Evicts the user functions of a session and the cached expressions, least recently used first, until
+// the code of the whole program is under the limit. The code used since the given use time is kept,
+// since the session would compile it again at once. The code of other sessions is evicted by them.
+void evict_functions(std::map<std::string, Function*>&, DependencyGraph const&, ExpressionCache&,
+                     std::uint64_t used_since);
+
+#endif // Header guard
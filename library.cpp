@@ -0,0 +1,357 @@
+// Copyright 2015 Benoît Vey
+
+#include "library.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <fstream>
+#include <iterator>
+#include <set>
+#include <sstream>
+#include <thread>
+#include <vector>
+
+#include <llvm/IR/LLVMContext.h>
+
+#include "Lexer.hpp"
+#include "Parser.hpp"
+#include "arrays.hpp"
+#include "command_handler.hpp"
+#include "dependency_graph.hpp"
+#include "jit.hpp"
+#include "profile.hpp"
+#include "syntax_tree.hpp"
+#include "utility.hpp"
+
+namespace
+{
+
+struct Definition
+{
+	std::string location;
+	std::string name;
+	Lexer lex;
+	std::unique_ptr<Function> function;
+	std::set<std::string> deps;
+	std::vector<Diagnostic> diagnostics;
+};
+
+std::size_t worker_count(std::size_t tasks)
+{
+	return std::min<std::size_t>(std::max(std::thread::hardware_concurrency(), 1u), tasks);
+}
+
+// The calling thread is one of the workers.
+template <typename Work>
+void run_workers(std::size_t count, Work const& work)
+{
+	std::vector<std::thread> workers;
+	for (std::size_t i{1} ; i < count ; ++i)
+		workers.emplace_back(work);
+	work();
+	for (auto& elem : workers)
+		elem.join();
+}
+
+// Empty lines and lines starting with # are skipped. The other lines must be !def commands, whose
+// bodies are left in their lexer. The invalid lines are added to the errors.
+std::vector<Definition> read_definitions(std::vector<std::string> const& paths, std::vector<std::string>& errors)
+{
+	std::vector<Definition> defs;
+	std::set<std::string> names;
+	for (auto& path : paths)
+	{
+		std::ifstream file{path};
+		if (!file)
+			throw InvalidInput{"Cannot open " + path};
+		std::string line;
+		for (std::size_t number{1} ; std::getline(file, line) ; ++number)
+		{
+			auto first = line.find_first_not_of(" \t\r");
+			if (first == std::string::npos || line[first] == '#')
+				continue;
+			Definition def{path + ':' + std::to_string(number), {}, Lexer{}, nullptr, {}, {}};
+			def.lex.newline(std::move(line));
+			try
+			{
+				if (def.lex.peek() != '!')
+					throw InvalidInput{"Expected !def"};
+				auto command = parse_command(def.lex);
+				if (command.type != CommandType::def)
+					throw InvalidInput{"Expected !def"};
+				def.name = command.args[0];
+				command.args.erase(std::begin(command.args));
+				def.function.reset(new Function{nullptr, std::move(command.args), {},
+				                                llvm::Intrinsic::not_intrinsic, FunctionType::userdef});
+			}
+			catch (InvalidInput const& ex)
+			{
+				errors.emplace_back(def.location + ':' + std::to_string(def.lex.column()) + " : " + ex.what());
+				continue;
+			}
+			if (!names.insert(def.name).second)
+			{
+				errors.emplace_back(def.location + " : Multiple definitions of " + def.name);
+				continue;
+			}
+			defs.emplace_back(std::move(def));
+		}
+	}
+	return defs;
+}
+
+// The functions of the libraries are in the environment while their bodies are parsed, so that they
+// can call each other in any order. Parsing only reads the environment.
+void parse_definitions(std::vector<Definition>& defs, std::map<std::string, double>& var_env,
+                       std::map<std::string, Function*>& fun_env, std::map<std::string, Array>& arr_env,
+                       DependencyGraph& graph, Parser& par)
+{
+	std::atomic<std::size_t> next{0};
+	std::vector<std::ostringstream> messages(defs.size());
+	run_workers(worker_count(defs.size()), [&]
+	{
+		auto& previous_output = output();
+		Parser worker{var_env, fun_env, arr_env, graph};
+		worker.copy_operators(par);
+		for (auto i = next++ ; i < defs.size() ; i = next++)
+		{
+			auto& def = defs[i];
+			set_output(messages[i]);
+			def.function->body = worker.check_function_body(def.lex, def.name, *def.function, def.deps,
+			                                                def.diagnostics);
+		}
+		set_output(previous_output);
+	});
+	for (auto& elem : messages)
+		output() << elem.str();
+}
+
+// The libraries replace the functions of the environment of the same name, so calls between them
+// can form cycles with the functions of the environment.
+void check_recursion(std::vector<Definition> const& defs, DependencyGraph const& graph)
+{
+	std::map<std::string, std::set<std::string> const*> loaded;
+	for (auto& def : defs)
+		loaded[def.name] = &def.deps;
+	auto reaches = [&](std::string const& from, std::string const& to)
+	{
+		std::set<std::string> visited;
+		std::vector<std::string const*> to_visit{&from};
+		while (!to_visit.empty())
+		{
+			auto cur = to_visit.back();
+			to_visit.pop_back();
+			if (*cur == to)
+				return true;
+			if (!visited.insert(*cur).second)
+				continue;
+			auto loaded_it = loaded.find(*cur);
+			auto& deps = loaded_it != std::end(loaded) ? *loaded_it->second : graph.dependencies(*cur);
+			for (auto& elem : deps)
+				to_visit.emplace_back(&elem);
+		}
+		return false;
+	};
+	for (auto& def : defs)
+	{
+		for (auto& elem : def.deps)
+		{
+			if (reaches(elem, def.name))
+				throw InvalidInput{def.location + " : Recursive function calls are not allowed : " + elem +
+				                   " calls " + def.name};
+		}
+	}
+}
+
+// A function is compiled now if compiling it cannot change the environment, and if the functions it
+// calls are already compiled or compiled at an earlier level. The functions of a level do not call
+// each other. The functions of the environment called by the libraries are compiled too.
+std::vector<std::vector<std::string>> compile_levels(std::vector<std::string> const& names,
+                                                     std::map<std::string, double> const& var_env,
+                                                     std::map<std::string, Function*> const& fun_env,
+                                                     std::map<std::string, Array> const& arr_env,
+                                                     DependencyGraph const& graph)
+{
+	auto uncompiled = [&fun_env](std::string const& name)
+	{
+		auto fun_it = fun_env.find(name);
+		return fun_it != std::end(fun_env) && fun_it->second->type == FunctionType::userdef &&
+		       !fun_it->second->address;
+	};
+
+	// Postorder, so that callees come before their callers.
+	std::vector<std::string> order;
+	std::set<std::string> visited;
+	std::vector<std::pair<std::string const*, bool>> to_visit;
+	for (auto it = names.rbegin() ; it != names.rend() ; ++it)
+		to_visit.emplace_back(&*it, false);
+	while (!to_visit.empty())
+	{
+		auto cur = to_visit.back();
+		to_visit.pop_back();
+		if (cur.second)
+		{
+			order.emplace_back(*cur.first);
+			continue;
+		}
+		if (!visited.insert(*cur.first).second)
+			continue;
+		to_visit.emplace_back(cur.first, true);
+		for (auto& elem : graph.dependencies(*cur.first))
+		{
+			if (uncompiled(elem) && visited.find(elem) == std::end(visited))
+				to_visit.emplace_back(&elem, false);
+		}
+	}
+
+	std::map<std::string, std::size_t> levels;
+	std::vector<std::vector<std::string>> res;
+	for (auto& name : order)
+	{
+		if (fun_env.at(name)->body->has_assignments())
+			continue;
+		std::size_t level{0};
+		auto compilable = true;
+		for (auto& elem : graph.dependencies(name))
+		{
+			if (var_env.find(elem) != std::end(var_env) || arr_env.find(elem) != std::end(arr_env))
+				continue;
+			if (fun_env.find(elem) == std::end(fun_env))
+			{
+				compilable = false;
+				break;
+			}
+			if (!uncompiled(elem))
+				continue;
+			auto level_it = levels.find(elem);
+			if (level_it == std::end(levels))
+			{
+				compilable = false;
+				break;
+			}
+			level = std::max(level, level_it->second + 1);
+		}
+		if (!compilable)
+			continue;
+		levels[name] = level;
+		if (res.size() <= level)
+			res.resize(level + 1);
+		res[level].emplace_back(name);
+	}
+	return res;
+}
+
+// Returns the number of functions compiled. The functions which cannot be compiled, and their callers,
+// are compiled on first use, where their errors are reported.
+std::size_t compile_libraries(std::vector<std::string> const& names, std::map<std::string, double>& var_env,
+                              std::map<std::string, Function*>& fun_env,
+                              std::map<std::string, Array>& arr_env, DependencyGraph& graph)
+{
+	auto mode = numeric_mode();
+	auto algebra = algebra_mode();
+	auto profile = profile_mode();
+	std::size_t compiled{0};
+	for (auto& level : compile_levels(names, var_env, fun_env, arr_env, graph))
+	{
+		std::atomic<std::size_t> next{0};
+		std::atomic<std::size_t> level_compiled{0};
+		std::vector<std::ostringstream> messages(level.size());
+		run_workers(worker_count(level.size()), [&]
+		{
+			auto& previous_output = output();
+			set_numeric_mode(mode);
+			set_algebra_mode(algebra);
+			set_profile_mode(profile);
+			set_jit_context(std::make_shared<llvm::LLVMContext>());
+			for (auto i = next++ ; i < level.size() ; i = next++)
+			{
+				auto fn = fun_env.at(level[i]);
+				auto& deps = graph.dependencies(level[i]);
+				auto is_compiled = [&fun_env](std::string const& dep)
+				{
+					auto fun_it = fun_env.find(dep);
+					return fun_it == std::end(fun_env) || fun_it->second->type != FunctionType::userdef ||
+					       fun_it->second->address;
+				};
+				if (!std::all_of(std::begin(deps), std::end(deps), is_compiled))
+					continue;
+				set_output(messages[i]);
+				try
+				{
+					compile_function(level[i], *fn, var_env, fun_env);
+					++level_compiled;
+				}
+				catch (InvalidInput const&)
+				{}
+			}
+			set_jit_context(nullptr);
+			set_output(previous_output);
+		});
+		compiled += level_compiled;
+		for (auto& elem : messages)
+			output() << elem.str();
+		// The workers mark the callees used in any order. They are marked again in the order of the level,
+		// so that the functions evicted first do not depend on the scheduling.
+		for (auto& name : level)
+		{
+			for (auto& elem : graph.dependencies(name))
+			{
+				auto fun_it = fun_env.find(elem);
+				if (fun_it != std::end(fun_env) && fun_it->second->type == FunctionType::userdef &&
+				    fun_it->second->address)
+					mark_used(*fun_it->second);
+			}
+		}
+	}
+	return compiled;
+}
+
+} // namespace
+
+std::vector<std::string> load_libraries(std::vector<std::string> const& paths,
+                                        std::map<std::string, double>& var_env,
+                                        std::map<std::string, Function*>& fun_env,
+                                        std::map<std::string, Array>& arr_env, DependencyGraph& graph,
+                                        std::map<Function*, std::unique_ptr<Function>>& functions,
+                                        Parser& par)
+{
+	std::vector<std::string> errors;
+	auto defs = read_definitions(paths, errors);
+
+	auto previous_funs = fun_env;
+	for (auto& def : defs)
+		fun_env[def.name] = def.function.get();
+	parse_definitions(defs, var_env, fun_env, arr_env, graph, par);
+	fun_env = std::move(previous_funs);
+	// All the errors of the files are reported at once.
+	for (auto& def : defs)
+	{
+		for (auto& elem : def.diagnostics)
+			errors.emplace_back(def.location + ':' + std::to_string(elem.column) + " : " + elem.message);
+	}
+	if (!errors.empty())
+	{
+		std::string message{errors.front()};
+		for (auto it = std::next(std::begin(errors)) ; it != std::end(errors) ; ++it)
+			message += '\n' + *it;
+		throw InvalidInput{message};
+	}
+	check_recursion(defs, graph);
+	for (auto& def : defs)
+	{
+		if (is_reserved_name(def.name))
+			throw InvalidInput{def.location + " : " + def.name + " is a reserved name"};
+		check_replaceable(def.name, graph, fun_env);
+	}
+
+	std::vector<std::string> names;
+	for (auto& def : defs)
+	{
+		names.emplace_back(def.name);
+		add_definition(def.name, std::move(def.function), std::move(def.deps), var_env, fun_env, arr_env,
+		               graph, functions);
+	}
+	auto compiled = compile_libraries(names, var_env, fun_env, arr_env, graph);
+	output() << "Loaded " << names.size() << " functions, " << compiled << " compiled\n";
+	return names;
+}
@@ -0,0 +1,25 @@
+// Copyright 2015 Benoît Vey
+
+#ifndef CALC_LIBRARY_HPP_
+#define CALC_LIBRARY_HPP_
+
+#include <map>
+#include <memory>
+#include <string>
+#include <vector>
+
+class DependencyGraph;
+class Parser;
+struct Array;
+struct Function;
+
+// Loads files of !def lines. The bodies are parsed on all processors and the definitions are added to
+// the environment in the order of the files. The functions are then compiled in parallel, each worker
+// in its own LLVM context, callees before their callers. Nothing is added if a definition is invalid,
+// and the errors of all the definitions are reported. Returns the names of the functions.
+std::vector<std::string> load_libraries(std::vector<std::string> const& paths, std::map<std::string, double>&,
+                                        std::map<std::string, Function*>&, std::map<std::string, Array>&,
+                                        DependencyGraph&, std::map<Function*, std::unique_ptr<Function>>&,
+                                        Parser&);
+
+#endif // Header guard
@@ -0,0 +1,202 @@
+// Copyright 2015 Benoît Vey
+
+// Load generator for the calc server. Each client opens a connection, sends the setup lines, then
+// sends the expression repeatedly and measures the time until the end of each response.
+
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+using namespace std::string_literals;
+
+namespace
+{
+
+using clock = std::chrono::steady_clock;
+
+struct Options
+{
+	std::string path;
+	std::size_t clients;
+	std::size_t requests;
+	std::vector<std::string> setup;
+	std::string expression;
+};
+
+struct ClientResult
+{
+	std::vector<double> latencies;
+	std::size_t errors;
+	bool failed;
+};
+
+class Client
+{
+	public:
+	Client() : fd_{-1}
+	{}
+
+	Client(Client const&) = delete;
+	Client& operator=(Client const&) = delete;
+
+	~Client()
+	{
+		if (fd_ >= 0)
+			close(fd_);
+	}
+
+	bool connect(std::string const& path)
+	{
+		sockaddr_un address{};
+		address.sun_family = AF_UNIX;
+		if (path.size() >= sizeof(address.sun_path))
+			return false;
+		std::strcpy(address.sun_path, path.c_str());
+		fd_ = socket(AF_UNIX, SOCK_STREAM, 0);
+		return fd_ >= 0 && ::connect(fd_, reinterpret_cast<sockaddr*>(&address), sizeof(address)) == 0;
+	}
+
+	// Returns false if the connection failed. Otherwise, error tells whether the server reported
+	// invalid input.
+	bool request(std::string const& line, bool& error)
+	{
+		auto data = line + '\n';
+		std::size_t sent{0};
+		while (sent != data.size())
+		{
+			auto res = send(fd_, data.data() + sent, data.size() - sent, MSG_NOSIGNAL);
+			if (res <= 0)
+				return false;
+			sent += static_cast<std::size_t>(res);
+		}
+		error = false;
+		while (true)
+		{
+			auto end = buffer_.find('\n');
+			if (end == std::string::npos)
+			{
+				char chunk[4096];
+				auto res = read(fd_, chunk, sizeof(chunk));
+				if (res <= 0)
+					return false;
+				buffer_.append(chunk, static_cast<std::size_t>(res));
+				continue;
+			}
+			auto response_line = buffer_.substr(0, end);
+			buffer_.erase(0, end + 1);
+			if (response_line == ".")
+				return true;
+			if (response_line.find("Invalid") == 0)
+				error = true;
+		}
+	}
+
+	private:
+	int fd_;
+	std::string buffer_;
+};
+
+void run_client(Options const& options, ClientResult& result)
+{
+	result.errors = 0;
+	result.failed = true;
+	Client client;
+	if (!client.connect(options.path))
+		return;
+	bool error;
+	for (auto& elem : options.setup)
+	{
+		if (!client.request(elem, error))
+			return;
+	}
+	result.latencies.reserve(options.requests);
+	for (std::size_t i{0} ; i != options.requests ; ++i)
+	{
+		auto start = clock::now();
+		if (!client.request(options.expression, error))
+			return;
+		result.latencies.emplace_back(std::chrono::duration<double, std::milli>{clock::now() - start}.count());
+		if (error)
+			++result.errors;
+	}
+	result.failed = false;
+}
+
+double percentile(std::vector<double> const& sorted, double p)
+{
+	auto index = static_cast<std::size_t>(p * static_cast<double>(sorted.size() - 1) + 0.5);
+	return sorted[index];
+}
+
+int usage()
+{
+	std::cerr << "Usage : calc-loadgen socket_path [--clients count] [--requests count] [--setup line]... "
+	             "[expression]\n";
+	return EXIT_FAILURE;
+}
+
+} // namespace
+
+int main(int argc, char** argv)
+{
+	if (argc < 2)
+		return usage();
+	Options options{argv[1], 8, 1000, {}, "1 + 2 * 3"};
+	for (int i{2} ; i < argc ; ++i)
+	{
+		if (argv[i] == "--clients"s && i + 1 < argc)
+			options.clients = std::strtoul(argv[++i], nullptr, 10);
+		else if (argv[i] == "--requests"s && i + 1 < argc)
+			options.requests = std::strtoul(argv[++i], nullptr, 10);
+		else if (argv[i] == "--setup"s && i + 1 < argc)
+			options.setup.emplace_back(argv[++i]);
+		else if (i == argc - 1)
+			options.expression = argv[i];
+		else
+			return usage();
+	}
+	if (options.clients == 0 || options.requests == 0)
+		return usage();
+
+	std::vector<ClientResult> results{options.clients};
+	std::vector<std::thread> clients;
+	auto start = clock::now();
+	for (std::size_t i{0} ; i != options.clients ; ++i)
+		clients.emplace_back(run_client, std::cref(options), std::ref(results[i]));
+	for (auto& elem : clients)
+		elem.join();
+	auto elapsed = std::chrono::duration<double>{clock::now() - start}.count();
+
+	std::vector<double> latencies;
+	std::size_t errors{0};
+	std::size_t failures{0};
+	for (auto& elem : results)
+	{
+		latencies.insert(std::end(latencies), std::begin(elem.latencies), std::end(elem.latencies));
+		errors += elem.errors;
+		if (elem.failed)
+			++failures;
+	}
+	if (latencies.empty())
+	{
+		std::cerr << "No request succeeded\n";
+		return EXIT_FAILURE;
+	}
+	std::sort(std::begin(latencies), std::end(latencies));
+
+	std::cout << "Requests : " << latencies.size() << " (" << options.clients << " clients, "
+	          << failures << " failed connections, " << errors << " invalid inputs)\n";
+	std::cout << "Throughput : " << static_cast<double>(latencies.size()) / elapsed << " requests/s\n";
+	std::cout << "Latency (ms) : p50 " << percentile(latencies, 0.5) << ", p90 " << percentile(latencies, 0.9)
+	          << ", p99 " << percentile(latencies, 0.99) << ", max " << latencies.back() << '\n';
+	return failures == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,340 @@
+// Copyright 2015 Benoît Vey
+
+#include "output.hpp"
+
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <ostream>
+#include <vector>
+
+namespace
+{
+
+// Printed by %g for numbers whose exponent is at least the precision.
+int const max_shortest_exponent{17};
+int const min_fixed_exponent{-5};
+// 17 digits tell all the doubles apart.
+int const max_round_trip_digits{17};
+
+thread_local NumberFormat format{NumberStyle::precision, 6};
+
+std::size_t write_integer(std::uint64_t value, char* out)
+{
+	char digits[20];
+	std::size_t count{0};
+	do
+	{
+		digits[count++] = static_cast<char>('0' + value % 10);
+		value /= 10;
+	} while (value);
+	for (std::size_t i{0} ; i != count ; ++i)
+		out[i] = digits[count - 1 - i];
+	return count;
+}
+
+// Integers which print with all their digits, which are most of the results, do not need printf.
+bool is_small_integer(double value, double limit)
+{
+	return std::fabs(value) < limit && std::trunc(value) == value;
+}
+
+std::size_t format_small_integer(double value, char* out)
+{
+	std::size_t length{0};
+	if (std::signbit(value))
+		out[length++] = '-';
+	return length + write_integer(static_cast<std::uint64_t>(std::fabs(value)), out + length);
+}
+
+// Shortest digits with Schubfach (R. Giulietti, "The Schubfach way to render doubles"): the value
+// is scaled by a power of 10 with one 128-bit product, which is enough to find the shortest decimal
+// reading back to it, the closest one if there are several.
+using uint128 = unsigned __int128;
+
+int const min_binary_exponent{-1074};
+int const min_decimal_exponent{-324};
+int const max_decimal_exponent{292};
+std::uint64_t const min_significand{std::uint64_t{1} << 52};
+std::uint64_t const mask_63{(std::uint64_t{1} << 63) - 1};
+
+int floor_log10_pow2(int e)
+{
+	return static_cast<int>((e * 661971961083LL) >> 41);
+}
+
+int floor_log10_three_quarters_pow2(int e)
+{
+	return static_cast<int>((e * 661971961083LL - 274743187321LL) >> 41);
+}
+
+int floor_log2_pow10(int e)
+{
+	return static_cast<int>((e * 913124641741LL) >> 38);
+}
+
+// For each k, 10^-k = b * 2^r with 2^125 <= b < 2^126, and g = floor(b) + 1, split in its high and
+// low 63 bits. Computed once with big integers.
+struct Powers
+{
+	std::array<std::uint64_t, max_decimal_exponent - min_decimal_exponent + 1> high;
+	std::array<std::uint64_t, max_decimal_exponent - min_decimal_exponent + 1> low;
+};
+
+// Little endian 32-bit limbs.
+using BigInteger = std::vector<std::uint32_t>;
+
+void multiply(BigInteger& value, std::uint32_t factor)
+{
+	std::uint64_t carry{0};
+	for (auto& elem : value)
+	{
+		carry += std::uint64_t{elem} * factor;
+		elem = static_cast<std::uint32_t>(carry);
+		carry >>= 32;
+	}
+	if (carry)
+		value.push_back(static_cast<std::uint32_t>(carry));
+}
+
+void divide(BigInteger& value, std::uint32_t divisor)
+{
+	std::uint64_t remainder{0};
+	for (auto it = value.rbegin() ; it != value.rend() ; ++it)
+	{
+		remainder = (remainder << 32) | *it;
+		*it = static_cast<std::uint32_t>(remainder / divisor);
+		remainder %= divisor;
+	}
+	while (!value.empty() && value.back() == 0)
+		value.pop_back();
+}
+
+// floor(value * 2^-shift), or value * 2^-shift when shift is negative, which must have at most 128 bits.
+uint128 shifted(BigInteger const& value, int shift)
+{
+	uint128 res{0};
+	auto first = std::max(shift, 0);
+	for (auto bit = static_cast<int>(value.size()) * 32 - 1 ; bit >= first ; --bit)
+		res = (res << 1) | ((value[static_cast<std::size_t>(bit) / 32] >> (bit % 32)) & 1);
+	return shift < 0 ? res << -shift : res;
+}
+
+Powers compute_powers()
+{
+	Powers powers;
+	for (auto k = min_decimal_exponent ; k <= max_decimal_exponent ; ++k)
+	{
+		auto r = floor_log2_pow10(-k) - 125;
+		BigInteger value{1};
+		uint128 b;
+		if (k <= 0)
+		{
+			for (auto i = 0 ; i != -k ; ++i)
+				multiply(value, 10);
+			b = shifted(value, r);
+		}
+		else
+		{
+			value.assign(static_cast<std::size_t>(-r) / 32 + 1, 0);
+			value.back() = std::uint32_t{1} << (-r % 32);
+			for (auto i = 0 ; i != k ; ++i)
+				divide(value, 10);
+			b = shifted(value, 0);
+		}
+		auto g = b + 1;
+		auto index = static_cast<std::size_t>(k - min_decimal_exponent);
+		powers.high[index] = static_cast<std::uint64_t>(g >> 63);
+		powers.low[index] = static_cast<std::uint64_t>(g) & mask_63;
+	}
+	return powers;
+}
+
+Powers const& powers()
+{
+	static Powers const res = compute_powers();
+	return res;
+}
+
+// floor(g * cp * 2^-127), with its lowest bit set if the result is not exact.
+std::uint64_t round_to_odd(std::uint64_t g1, std::uint64_t g0, std::uint64_t cp)
+{
+	auto x = uint128{g0} * cp;
+	auto y = uint128{g1} * cp;
+	auto z = (static_cast<std::uint64_t>(y) >> 1) + static_cast<std::uint64_t>(x >> 64);
+	auto vbp = static_cast<std::uint64_t>(y >> 64) + (z >> 63);
+	return vbp | (((z & mask_63) + mask_63) >> 63);
+}
+
+// The value is c * 2^q, and the result is digits * 10^exponent.
+std::uint64_t to_decimal(int q, std::uint64_t c, int dk, int& exponent)
+{
+	auto out = c & 1;
+	auto cb = c << 2;
+	auto cbr = cb + 2;
+	std::uint64_t cbl;
+	int k;
+	// The interval is narrower below powers of 2.
+	if (c != min_significand || q == min_binary_exponent)
+	{
+		cbl = cb - 2;
+		k = floor_log10_pow2(q);
+	}
+	else
+	{
+		cbl = cb - 1;
+		k = floor_log10_three_quarters_pow2(q);
+	}
+	auto h = q + floor_log2_pow10(-k) + 2;
+	auto index = static_cast<std::size_t>(k - min_decimal_exponent);
+	auto g1 = powers().high[index];
+	auto g0 = powers().low[index];
+	auto vb = round_to_odd(g1, g0, cb << h);
+	auto vbl = round_to_odd(g1, g0, cbl << h);
+	auto vbr = round_to_odd(g1, g0, cbr << h);
+
+	auto s = vb >> 2;
+	if (s >= 100)
+	{
+		auto sp10 = s / 10 * 10;
+		auto tp10 = sp10 + 10;
+		auto upin = vbl + out <= sp10 << 2;
+		auto wpin = (tp10 << 2) + out <= vbr;
+		if (upin != wpin)
+		{
+			exponent = k;
+			return upin ? sp10 : tp10;
+		}
+	}
+	auto t = s + 1;
+	auto uin = vbl + out <= s << 2;
+	auto win = (t << 2) + out <= vbr;
+	exponent = k + dk;
+	if (uin != win)
+		return uin ? s : t;
+	auto cmp = static_cast<std::int64_t>(vb - ((s + t) << 1));
+	return cmp < 0 || (cmp == 0 && (s & 1) == 0) ? s : t;
+}
+
+// Writes the significant digits without trailing zeros, and returns their count. The value is
+// 0.digits * 10^(exponent + 1).
+std::size_t shortest_digits(double value, char* digits, int& exponent)
+{
+	std::uint64_t bits;
+	std::memcpy(&bits, &value, sizeof(bits));
+	auto fraction = bits & (min_significand - 1);
+	auto biased = static_cast<int>((bits >> 52) & 0x7FF);
+	std::uint64_t decimal;
+	// The two smallest subnormal numbers are too small for the algorithm.
+	if (biased == 0 && fraction < 3)
+	{
+		decimal = fraction == 1 ? 5 : 1;
+		exponent = fraction == 1 ? -324 : -323;
+	}
+	else if (biased == 0)
+		decimal = to_decimal(min_binary_exponent, fraction, 0, exponent);
+	else
+	{
+		auto q = biased - 1075;
+		auto c = min_significand | fraction;
+		// Integers are exact.
+		if (q < 0 && q > -53 && ((c >> -q) << -q) == c)
+		{
+			decimal = c >> -q;
+			exponent = 0;
+		}
+		else
+			decimal = to_decimal(q, c, 0, exponent);
+	}
+	while (decimal % 10 == 0)
+	{
+		decimal /= 10;
+		++exponent;
+	}
+	auto count = write_integer(decimal, digits);
+	exponent += static_cast<int>(count) - 1;
+	return count;
+}
+
+std::size_t format_shortest(double value, char* out)
+{
+	if (!std::isfinite(value) || value == 0.0)
+		return static_cast<std::size_t>(std::snprintf(out, max_number_chars, "%g", value));
+	char digits[max_round_trip_digits + 1];
+	int exponent;
+	auto count = shortest_digits(value, digits, exponent);
+
+	std::size_t length{0};
+	if (value < 0.0)
+		out[length++] = '-';
+	if (exponent < min_fixed_exponent || exponent >= max_shortest_exponent)
+	{
+		out[length++] = digits[0];
+		if (count > 1)
+		{
+			out[length++] = '.';
+			std::memcpy(out + length, digits + 1, count - 1);
+			length += count - 1;
+		}
+		return length + static_cast<std::size_t>(std::snprintf(out + length, max_number_chars - length, "e%+03d",
+		                                                       exponent));
+	}
+	if (exponent < 0)
+	{
+		out[length++] = '0';
+		out[length++] = '.';
+		for (auto i = exponent + 1 ; i != 0 ; ++i)
+			out[length++] = '0';
+		std::memcpy(out + length, digits, count);
+		return length + count;
+	}
+	auto integer_digits = static_cast<std::size_t>(exponent) + 1;
+	for (std::size_t i{0} ; i != integer_digits ; ++i)
+		out[length++] = i < count ? digits[i] : '0';
+	if (count > integer_digits)
+	{
+		out[length++] = '.';
+		std::memcpy(out + length, digits + integer_digits, count - integer_digits);
+		length += count - integer_digits;
+	}
+	return length;
+}
+
+} // namespace
+
+NumberFormat number_format()
+{
+	return format;
+}
+
+void set_number_format(NumberFormat new_format)
+{
+	format = new_format;
+}
+
+std::size_t format_number(double value, char* out)
+{
+	if (format.style != NumberStyle::precision)
+	{
+		if (is_small_integer(value, 1e15))
+			return format_small_integer(value, out);
+		return format_shortest(value, out);
+	}
+	if (format.precision <= max_round_trip_digits && is_small_integer(value, std::pow(10.0, format.precision)))
+		return format_small_integer(value, out);
+	return static_cast<std::size_t>(std::snprintf(out, max_number_chars, "%.*g", format.precision, value));
+}
+
+void write_number(std::ostream& os, double value)
+{
+	char buffer[max_number_chars];
+	os.write(buffer, static_cast<std::streamsize>(format_number(value, buffer)));
+}
+
+void write_binary(std::ostream& os, double const* values, std::size_t count)
+{
+	os.write(reinterpret_cast<char const*>(values), static_cast<std::streamsize>(count * sizeof(double)));
+}
@@ -0,0 +1,41 @@
+// Copyright 2015 Benoît Vey
+
+#ifndef CALC_OUTPUT_HPP_
+#define CALC_OUTPUT_HPP_
+
+#include <cstddef>
+#include <iosfwd>
+
+enum class NumberStyle
+{
+	precision,
+	shortest,
+	binary
+};
+
+// Results are printed with the given number of significant digits, like printf's %g, or with the
+// fewest digits which read back to the same number. Binary results are written as native doubles,
+// without separators, and the other numbers are printed as in shortest.
+struct NumberFormat
+{
+	NumberStyle style;
+	int precision;
+};
+
+// Format of the session running on the current thread.
+NumberFormat number_format();
+void set_number_format(NumberFormat);
+
+// Long enough for any double in any format.
+std::size_t const max_number_chars{32};
+
+// Returns the number of characters written.
+std::size_t format_number(double, char*);
+
+// Writes the characters in one call, without going through the locale of the stream.
+void write_number(std::ostream&, double);
+
+// Writes the bytes of the values.
+void write_binary(std::ostream&, double const*, std::size_t);
+
+#endif // Header guard
@@ -0,0 +1,88 @@
+// Copyright 2015 Benoît Vey
+
+// Parser throughput benchmark. Each case builds an expression of the given shape, then parses it
+// repeatedly and reports the input bytes and terms parsed per second.
+
+#include <chrono>
+#include <cstdlib>
+#include <iostream>
+#include <map>
+#include <string>
+#include <vector>
+
+#include "../Lexer.hpp"
+#include "../Parser.hpp"
+#include "../arrays.hpp"
+#include "../command_handler.hpp"
+#include "../dependency_graph.hpp"
+#include "../syntax_tree.hpp"
+
+namespace
+{
+
+using clock = std::chrono::steady_clock;
+
+struct Case
+{
+	char const* name;
+	std::string expression;
+	std::size_t terms;
+};
+
+std::size_t const terms{20000};
+
+std::string repeat(std::string const& text, std::size_t count, std::string const& separator)
+{
+	std::string res;
+	for (std::size_t i{0} ; i < count ; ++i)
+	{
+		if (i)
+			res += separator;
+		res += text;
+	}
+	return res;
+}
+
+std::vector<Case> make_cases()
+{
+	std::vector<Case> cases;
+	cases.push_back({"flat sum", repeat("x", terms, " + "), terms});
+	cases.push_back({"mixed", repeat("x * 2.5 - y / 3", terms / 4, " + "), terms});
+	cases.push_back({"nested parens", std::string(terms, '(') + "x" + std::string(terms, ')'), terms});
+	cases.push_back({"calls", repeat("min(x, y)", terms / 2, " + "), terms});
+	cases.push_back({"power chain", repeat("x", terms, " ^ "), terms});
+	return cases;
+}
+
+} // namespace
+
+int main(int argc, char** argv)
+{
+	auto seconds = argc > 1 ? std::atof(argv[1]) : 1.0;
+
+	std::map<std::string, double> vars{{"x", 1.5}, {"y", 2.5}};
+	std::map<std::string, Function*> funs;
+	std::map<std::string, Array> arrays;
+	DependencyGraph graph;
+	execute_import({"min"}, vars, funs, arrays, graph);
+	Parser par{vars, funs, arrays, graph};
+	Lexer lex;
+
+	for (auto& elem : make_cases())
+	{
+		std::size_t runs{0};
+		auto start = clock::now();
+		std::chrono::duration<double> elapsed{0};
+		while (elapsed.count() < seconds)
+		{
+			lex.newline(std::string{elem.expression});
+			par.parse(lex);
+			++runs;
+			elapsed = clock::now() - start;
+		}
+		auto bytes = static_cast<double>(elem.expression.size()) * runs;
+		auto parsed_terms = static_cast<double>(elem.terms) * runs;
+		std::cout << elem.name << " : " << bytes / elapsed.count() / 1e6 << " MB/s, "
+		          << parsed_terms / elapsed.count() / 1e6 << " Mterms/s\n";
+	}
+}
@@ -0,0 +1,179 @@
+// Copyright 2015 Benoît Vey
+
+#include "profile.hpp"
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <map>
+#include <mutex>
+#include <set>
+
+#include <llvm/IR/Intrinsics.h>
+
+namespace
+{
+
+// Functions named after the first ones are not counted.
+std::size_t const max_profiled{1024};
+
+thread_local ProfileMode mode{ProfileMode::off};
+
+struct Counter
+{
+	std::atomic<std::uint64_t> calls;
+	std::atomic<std::uint64_t> cycles;
+};
+
+using Counters = std::array<Counter, max_profiled>;
+
+struct Totals
+{
+	std::array<std::uint64_t, max_profiled> calls;
+	std::array<std::uint64_t, max_profiled> cycles;
+};
+
+struct ThreadCounters;
+
+// Guards the names and the set of counters, not the counts.
+std::mutex registry_mutex;
+std::map<std::string, std::uint32_t> ids;
+std::vector<std::string> names;
+std::set<ThreadCounters*> threads;
+// Counts of the threads which exited, and counts at the last reset.
+Totals retired{};
+Totals baseline{};
+
+// Only the owning thread writes its counters, so increments are plain loads and stores. Other threads
+// read them while reporting.
+struct ThreadCounters
+{
+	ThreadCounters()
+		: counters{}
+	{
+		std::lock_guard<std::mutex> lock{registry_mutex};
+		threads.insert(this);
+	}
+
+	~ThreadCounters()
+	{
+		std::lock_guard<std::mutex> lock{registry_mutex};
+		for (std::size_t i{0} ; i < max_profiled ; ++i)
+		{
+			retired.calls[i] += counters[i].calls.load(std::memory_order_relaxed);
+			retired.cycles[i] += counters[i].cycles.load(std::memory_order_relaxed);
+		}
+		threads.erase(this);
+	}
+
+	Counters counters;
+};
+
+// Must be called with the registry lock held.
+Totals sum_counters()
+{
+	auto res = retired;
+	for (auto elem : threads)
+	{
+		for (std::size_t i{0} ; i < max_profiled ; ++i)
+		{
+			res.calls[i] += elem->counters[i].calls.load(std::memory_order_relaxed);
+			res.cycles[i] += elem->counters[i].cycles.load(std::memory_order_relaxed);
+		}
+	}
+	return res;
+}
+
+// Returns max_profiled once there are too many functions.
+std::uint32_t profile_id(std::string const& name)
+{
+	std::lock_guard<std::mutex> lock{registry_mutex};
+	auto id_it = ids.find(name);
+	if (id_it != std::end(ids))
+		return id_it->second;
+	if (names.size() == max_profiled)
+		return max_profiled;
+	names.emplace_back(name);
+	return ids[name] = static_cast<std::uint32_t>(names.size() - 1);
+}
+
+} // namespace
+
+ProfileMode profile_mode()
+{
+	return mode;
+}
+
+void set_profile_mode(ProfileMode new_mode)
+{
+	mode = new_mode;
+}
+
+llvm::Value* codegen_profile_begin(llvm::Module& main, llvm::IRBuilder<>& builder)
+{
+	if (mode == ProfileMode::off)
+		return nullptr;
+	if (mode == ProfileMode::calls)
+		return builder.getInt64(0);
+	auto counter = llvm::Intrinsic::getDeclaration(&main, llvm::Intrinsic::readcyclecounter);
+	return builder.CreateCall(counter, {}, "begin");
+}
+
+void codegen_profile_end(llvm::Module& main, llvm::IRBuilder<>& builder, std::string const& name,
+                         llvm::Value* begin)
+{
+	if (!begin)
+		return;
+	auto id = profile_id(name);
+	if (id == max_profiled)
+		return;
+	auto cycles = begin;
+	if (mode == ProfileMode::cycles)
+	{
+		auto counter = llvm::Intrinsic::getDeclaration(&main, llvm::Intrinsic::readcyclecounter);
+		cycles = builder.CreateSub(builder.CreateCall(counter, {}, "end"), begin, "cycles");
+	}
+	auto fn = main.getFunction("calcrt_profile");
+	if (!fn)
+	{
+		auto fn_type = llvm::FunctionType::get(builder.getVoidTy(), {builder.getInt32Ty(), builder.getInt64Ty()},
+		                                       false);
+		fn = llvm::Function::Create(fn_type, llvm::Function::ExternalLinkage, "calcrt_profile", &main);
+	}
+	builder.CreateCall(fn, {builder.getInt32(id), cycles});
+}
+
+std::vector<ProfileEntry> profile_report()
+{
+	std::vector<ProfileEntry> res;
+	{
+		std::lock_guard<std::mutex> lock{registry_mutex};
+		auto totals = sum_counters();
+		for (std::size_t i{0} ; i < names.size() ; ++i)
+		{
+			auto calls = totals.calls[i] - baseline.calls[i];
+			if (calls)
+				res.push_back(ProfileEntry{names[i], calls, totals.cycles[i] - baseline.cycles[i]});
+		}
+	}
+	std::sort(std::begin(res), std::end(res), [](ProfileEntry const& lhs, ProfileEntry const& rhs)
+	{
+		return lhs.cycles != rhs.cycles ? lhs.cycles > rhs.cycles : lhs.calls > rhs.calls;
+	});
+	return res;
+}
+
+// The counters of other threads cannot be written, so the counts are taken from the current ones.
+void reset_profile()
+{
+	std::lock_guard<std::mutex> lock{registry_mutex};
+	baseline = sum_counters();
+}
+
+extern "C" void calcrt_profile(std::uint32_t id, std::uint64_t cycles)
+{
+	thread_local ThreadCounters thread_counters;
+	auto& counter = thread_counters.counters[id];
+	counter.calls.store(counter.calls.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+	counter.cycles.store(counter.cycles.load(std::memory_order_relaxed) + cycles, std::memory_order_relaxed);
+}
@@ -0,0 +1,44 @@
+// Copyright 2015 Benoît Vey
+
+#ifndef CALC_PROFILE_HPP_
+#define CALC_PROFILE_HPP_
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include <llvm/IR/IRBuilder.h>
+#include <llvm/IR/Module.h>
+
+enum class ProfileMode
+{
+	off,
+	calls,
+	cycles
+};
+
+// Mode of the code generated by the current thread. Code generated with profiling counts the calls
+// to user functions, builtins and intrinsics, and the cycles spent in them in cycles mode.
+ProfileMode profile_mode();
+void set_profile_mode(ProfileMode);
+
+// Returns the start of the call to profile, or nullptr when not profiling.
+llvm::Value* codegen_profile_begin(llvm::Module&, llvm::IRBuilder<>&);
+// Counts the call to the named function once it returns.
+void codegen_profile_end(llvm::Module&, llvm::IRBuilder<>&, std::string const&, llvm::Value* begin);
+
+struct ProfileEntry
+{
+	std::string name;
+	std::uint64_t calls;
+	std::uint64_t cycles;
+};
+
+// Counters of all the threads since the last reset, the most expensive functions first.
+std::vector<ProfileEntry> profile_report();
+void reset_profile();
+
+// Called by the profiled code. Each thread counts in its own counters, without locking.
+extern "C" void calcrt_profile(std::uint32_t, std::uint64_t);
+
+#endif // Header guard
@@ -0,0 +1,239 @@
+// Copyright 2015 Benoît Vey
+
+#include "random.hpp"
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <cmath>
+#include <limits>
+#include <random>
+#include <thread>
+#include <vector>
+
+#include <llvm/IR/Verifier.h>
+#include <llvm/ExecutionEngine/ExecutionEngine.h>
+#include <llvm/ExecutionEngine/MCJIT.h>
+
+#include "arrays.hpp"
+#include "jit.hpp"
+#include "syntax_tree.hpp"
+#include "utility.hpp"
+#include "watchdog.hpp"
+
+namespace
+{
+
+char const sampler_name[] = "calcmc";
+
+// Streams of the call sites of samplers, after the streams of the threads.
+std::uint64_t const sample_streams{std::uint64_t{1} << 63};
+
+// The samples are drawn in blocks, which the threads share, and the watchdog is polled between them.
+std::uint64_t const block_samples{1 << 16};
+
+std::atomic<std::uint64_t> seed{(std::uint64_t{std::random_device{}()} << 32) | std::random_device{}()};
+std::atomic<std::uint64_t> next_stream{0};
+// Incremented with the seed, so that threads know they must start a new stream.
+std::atomic<std::uint64_t> generation{0};
+
+struct ThreadStream
+{
+	std::uint64_t generation;
+	std::uint64_t stream;
+	std::uint64_t counter;
+};
+
+thread_local ThreadStream thread_stream{std::numeric_limits<std::uint64_t>::max(), 0, 0};
+
+thread_local SampleStream* current_stream{nullptr};
+
+} // namespace
+
+std::uint64_t random_seed()
+{
+	return seed;
+}
+
+void set_random_seed(std::uint64_t new_seed)
+{
+	seed = new_seed;
+	next_stream = 0;
+	++generation;
+}
+
+SampleStream::SampleStream(llvm::Value* index)
+	: previous_{current_stream}, index_{index}, sites_{0}
+{
+	current_stream = this;
+}
+
+SampleStream::~SampleStream()
+{
+	current_stream = previous_;
+}
+
+SampleStream* SampleStream::current()
+{
+	return current_stream;
+}
+
+llvm::Value* SampleStream::draw(llvm::Module& module, llvm::IRBuilder<>& builder, llvm::Value* min,
+                                llvm::Value* max)
+{
+	auto& ctx = jit_context();
+	auto double_type = llvm::Type::getDoubleTy(ctx);
+	auto int64_type = llvm::Type::getInt64Ty(ctx);
+	auto fn = module.getFunction("calcfn_sample");
+	if (!fn)
+	{
+		std::vector<llvm::Type*> args_type{double_type, double_type, int64_type, int64_type, int64_type};
+		auto fn_type = llvm::FunctionType::get(double_type, args_type, false);
+		fn = llvm::Function::Create(fn_type, llvm::Function::ExternalLinkage, "calcfn_sample", &module);
+	}
+	return builder.CreateCall(fn, {convert_number(builder, min, double_type),
+	                               convert_number(builder, max, double_type), builder.getInt64(seed),
+	                               builder.getInt64(sample_streams + sites_++), index_}, "rand");
+}
+
+CompiledSampler compile_sampler(ExprTree& expr, std::map<std::string, double>& vars,
+                                std::map<std::string, Function*>& funs)
+{
+	if (expr.is_array())
+		throw InvalidInput{"Monte Carlo expression must return a number"};
+	auto& ctx = jit_context();
+	auto module = std::make_unique<llvm::Module>("CalcSampler", ctx);
+	auto module_ref = module.get();
+	auto double_type = llvm::Type::getDoubleTy(ctx);
+	auto int64_type = llvm::Type::getInt64Ty(ctx);
+	std::vector<llvm::Type*> args_type{int64_type, int64_type, double_type, double_type->getPointerTo()};
+	auto kernel_type = llvm::FunctionType::get(llvm::Type::getVoidTy(ctx), args_type, false);
+	auto kernel = llvm::Function::Create(kernel_type, llvm::Function::ExternalLinkage, sampler_name,
+	                                     module_ref);
+	auto arg_it = kernel->arg_begin();
+	auto first = &*arg_it++;
+	auto count = &*arg_it++;
+	auto shift = &*arg_it++;
+	auto sums = &*arg_it;
+	first->setName("first");
+	count->setName("count");
+	shift->setName("shift");
+	sums->setName("sums");
+
+	llvm::IRBuilder<> builder{ctx};
+	auto entry = llvm::BasicBlock::Create(ctx, "entry", kernel);
+	auto body = llvm::BasicBlock::Create(ctx, "sample", kernel);
+	auto exit = llvm::BasicBlock::Create(ctx, "exit", kernel);
+	builder.SetInsertPoint(entry);
+	auto index = builder.CreateAlloca(int64_type, nullptr, "index");
+	auto sum = builder.CreateAlloca(double_type, nullptr, "sum");
+	auto squares = builder.CreateAlloca(double_type, nullptr, "squares");
+	builder.CreateStore(first, index);
+	builder.CreateStore(llvm::ConstantFP::get(double_type, 0.0), sum);
+	builder.CreateStore(llvm::ConstantFP::get(double_type, 0.0), squares);
+	auto end = builder.CreateAdd(first, count, "end");
+	builder.CreateCondBr(builder.CreateICmpULT(first, end), body, exit);
+
+	// The order of the sums is left to the optimizer so that the loop can be vectorized.
+	builder.SetInsertPoint(body);
+	auto i = builder.CreateLoad(index, "i");
+	llvm::Value* value;
+	{
+		SampleStream stream{i};
+		value = convert_number(builder, expr.codegen(*module_ref, builder), double_type);
+	}
+	llvm::FastMathFlags fast_math;
+	fast_math.setUnsafeAlgebra();
+	auto deviation = builder.CreateFSub(value, shift, "deviation");
+	auto square = builder.CreateFMul(deviation, deviation, "square");
+	auto new_sum = builder.CreateFAdd(builder.CreateLoad(sum), deviation, "sum");
+	auto new_squares = builder.CreateFAdd(builder.CreateLoad(squares), square, "squares");
+	for (auto elem : {deviation, square, new_sum, new_squares})
+		llvm::cast<llvm::Instruction>(elem)->setFastMathFlags(fast_math);
+	builder.CreateStore(new_sum, sum);
+	builder.CreateStore(new_squares, squares);
+	auto next = builder.CreateAdd(i, builder.getInt64(1), "next");
+	builder.CreateStore(next, index);
+	builder.CreateCondBr(builder.CreateICmpULT(next, end), body, exit);
+
+	builder.SetInsertPoint(exit);
+	builder.CreateStore(builder.CreateLoad(sum), sums);
+	builder.CreateStore(builder.CreateLoad(squares), builder.CreateConstGEP1_64(sums, 1));
+	builder.CreateRetVoid();
+
+	llvm::verifyFunction(*kernel);
+
+	auto engine = create_engine(std::move(module), true);
+	link_symbols(*module_ref, *engine, vars, funs);
+	engine->finalizeObject();
+
+	auto address = reinterpret_cast<SampleKernel>(engine->getFunctionAddress(sampler_name));
+	return {std::move(engine), address};
+}
+
+SampleEstimate run_sampler(SampleKernel kernel, std::uint64_t samples, std::size_t threads)
+{
+	// The values are summed as deviations from the first sample, so that the squares do not cancel out
+	// when the mean is large compared with the spread.
+	std::array<double, 2> first_sums;
+	kernel(0, 1, 0.0, first_sums.data());
+	auto shift = first_sums[0];
+
+	// The blocks do not depend on the number of threads, and are merged in order, so the estimate
+	// does not either.
+	auto blocks = (samples + block_samples - 1) / block_samples;
+	auto chunks = std::max<std::uint64_t>(std::min<std::uint64_t>(threads, blocks), 1);
+	auto chunk_blocks = (blocks + chunks - 1) / chunks;
+	std::vector<std::array<double, 2>> sums(blocks);
+	auto watchdog = current_watchdog();
+	std::atomic<bool> mismatch{false};
+	auto run_chunk = [&](std::uint64_t first_block)
+	{
+		set_current_watchdog(watchdog);
+		auto last_block = std::min(first_block + chunk_blocks, blocks);
+		for (auto block = first_block ; block < last_block && !calcrt_poll() ; ++block)
+		{
+			auto first = block * block_samples;
+			kernel(first, std::min(block_samples, samples - first), shift, sums[block].data());
+		}
+		if (take_length_mismatch())
+			mismatch = true;
+	};
+
+	std::vector<std::thread> workers;
+	for (auto first_block = chunk_blocks ; first_block < blocks ; first_block += chunk_blocks)
+		workers.emplace_back(run_chunk, first_block);
+	run_chunk(0);
+	for (auto& elem : workers)
+		elem.join();
+	if (mismatch)
+		calcrt_array_mismatch();
+
+	// Pairwise update of the mean and of the sum of the squared deviations from the mean, by Chan et al.
+	double count{0.0};
+	double mean{0.0};
+	double deviations{0.0};
+	for (std::uint64_t i{0} ; i < blocks ; ++i)
+	{
+		double block_count = std::min(block_samples, samples - i * block_samples);
+		auto block_mean = sums[i][0] / block_count;
+		auto block_deviations = std::max(sums[i][1] - sums[i][0] * block_mean, 0.0);
+		auto delta = block_mean - mean;
+		auto total = count + block_count;
+		mean += delta * block_count / total;
+		deviations += block_deviations + delta * delta * count * block_count / total;
+		count = total;
+	}
+	auto variance = samples > 1 ? deviations / (samples - 1) : 0.0;
+	return {shift + mean, std::sqrt(variance / samples)};
+}
+
+extern "C" double calcfn_rand(double min, double max)
+{
+	if (max < min)
+		return std::numeric_limits<double>::quiet_NaN();
+	auto current = generation.load();
+	if (thread_stream.generation != current)
+		thread_stream = ThreadStream{current, next_stream++, 0};
+	return min + (max - min) * calcfn_uniform(seed, thread_stream.stream, thread_stream.counter++);
+}
@@ -0,0 +1,83 @@
+// Copyright 2015 Benoît Vey
+
+#ifndef CALC_RANDOM_HPP_
+#define CALC_RANDOM_HPP_
+
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <string>
+
+#include <llvm/IR/IRBuilder.h>
+#include <llvm/IR/Module.h>
+
+namespace llvm
+{
+	class ExecutionEngine;
+}
+
+class ExprTree;
+struct Function;
+
+// Seed of rand for the whole program, random at startup. Setting it restarts every thread from the
+// beginning of a new stream, so the numbers drawn by a thread after setting it are reproducible.
+std::uint64_t random_seed();
+void set_random_seed(std::uint64_t);
+
+// While a Monte Carlo sampler is generated, the calls to rand of its expression draw the numbers of
+// the current sample instead of the numbers of the thread, so that the samples can be drawn in any
+// order, on any thread and in vectorized loops with the same results. The calls to rand in arrays
+// and in user functions cannot, and are rejected.
+class SampleStream
+{
+	public:
+	explicit SampleStream(llvm::Value* index);
+
+	SampleStream(SampleStream const&) = delete;
+	SampleStream& operator=(SampleStream const&) = delete;
+
+	SampleStream(SampleStream&&) = delete;
+	SampleStream& operator=(SampleStream&&) = delete;
+
+	~SampleStream();
+
+	static SampleStream* current();
+
+	// Each call site draws from a stream of its own.
+	llvm::Value* draw(llvm::Module&, llvm::IRBuilder<>&, llvm::Value* min, llvm::Value* max);
+
+	private:
+	SampleStream* previous_;
+	llvm::Value* index_;
+	std::uint64_t sites_;
+};
+
+// Evaluates the expression for the samples [first, first + count), and stores the sum of the values
+// minus the shift in sums[0] and the sum of their squares in sums[1].
+using SampleKernel = void (*)(std::uint64_t first, std::uint64_t count, double shift, double* sums);
+
+struct CompiledSampler
+{
+	std::unique_ptr<llvm::ExecutionEngine> engine;
+	SampleKernel entry;
+};
+
+CompiledSampler compile_sampler(ExprTree&, std::map<std::string, double>&, std::map<std::string, Function*>&);
+
+struct SampleEstimate
+{
+	double mean;
+	double error;
+};
+
+// Splits the samples in contiguous ranges drawn on up to the given number of threads, which stop
+// early once the watchdog of the calling thread is interrupted. Array length mismatches of the threads
+// are reported by the next check_array_lengths of the calling thread. The error is the standard error
+// of the mean. The estimate does not depend on the number of threads.
+SampleEstimate run_sampler(SampleKernel, std::uint64_t samples, std::size_t threads);
+
+// Defined in builtins.c.
+extern "C" double calcfn_uniform(std::uint64_t, std::uint64_t, std::uint64_t);
+extern "C" double calcfn_sample(double, double, std::uint64_t, std::uint64_t, std::uint64_t);
+
+#endif // Header guard
@@ -0,0 +1,296 @@
+// Copyright 2015 Benoît Vey
+
+#include "server.hpp"
+
+#include <cerrno>
+#include <condition_variable>
+#include <csignal>
+#include <cstdlib>
+#include <cstring>
+#include <deque>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <sstream>
+#include <thread>
+#include <vector>
+
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include "session.hpp"
+
+namespace
+{
+
+std::size_t const max_line_length{1 << 20};
+std::size_t const read_size{4096};
+
+int signal_fd{-1};
+
+void handle_signal(int)
+{
+	char byte{0};
+	auto res = write(signal_fd, &byte, 1);
+	static_cast<void>(res);
+}
+
+bool send_all(int fd, std::string const& data)
+{
+	std::size_t sent{0};
+	while (sent != data.size())
+	{
+		auto res = send(fd, data.data() + sent, data.size() - sent, MSG_NOSIGNAL);
+		if (res < 0 && errno == EINTR)
+			continue;
+		if (res <= 0)
+			return false;
+		sent += static_cast<std::size_t>(res);
+	}
+	return true;
+}
+
+bool send_response(int fd, std::string const& output)
+{
+	std::string response;
+	std::istringstream lines{output};
+	std::string line;
+	while (std::getline(lines, line))
+	{
+		if (!line.empty() && line[0] == '.')
+			response += '.';
+		response += line;
+		response += '\n';
+	}
+	response += ".\n";
+	return send_all(fd, response);
+}
+
+int socket_error(char const* what, int fd = -1)
+{
+	std::cerr << "Server error : " << what << " : " << std::strerror(errno) << '\n';
+	if (fd >= 0)
+		close(fd);
+	return EXIT_FAILURE;
+}
+
+struct Connection
+{
+	Connection(int socket, ExpressionCache& cache) : fd{socket}, session{cache}, busy{false}, closed{false}
+	{}
+
+	~Connection()
+	{
+		close(fd);
+	}
+
+	int fd;
+	Session session;
+	std::string input;
+	bool busy;
+	bool closed;
+};
+
+// The main thread polls the idle connections. Once a connection has received complete lines, it is
+// marked busy and handed to a worker, which executes the lines and hands the connection back.
+class Server
+{
+	public:
+	Server(int listener, int wake_read, std::size_t threads, ExpressionCache& cache)
+		: listener_{listener}, wake_read_{wake_read}, cache_{cache}, stopping_{false}
+	{
+		for (std::size_t i{0} ; i != threads ; ++i)
+			workers_.emplace_back([this]{work_();});
+	}
+
+	Server(Server const&) = delete;
+	Server& operator=(Server const&) = delete;
+
+	~Server()
+	{
+		{
+			std::lock_guard<std::mutex> lock{mutex_};
+			stopping_ = true;
+		}
+		ready_cv_.notify_all();
+		for (auto& elem : workers_)
+			elem.join();
+	}
+
+	bool run()
+	{
+		std::vector<pollfd> fds;
+		std::vector<Connection*> polled;
+		while (true)
+		{
+			fds.assign({{listener_, POLLIN, 0}, {wake_read_, POLLIN, 0}});
+			polled.clear();
+			{
+				std::lock_guard<std::mutex> lock{mutex_};
+				for (auto it = std::begin(connections_) ; it != std::end(connections_) ;)
+				{
+					if ((*it)->busy)
+						++it;
+					else if ((*it)->closed)
+						it = connections_.erase(it);
+					else
+					{
+						fds.push_back({(*it)->fd, POLLIN, 0});
+						polled.emplace_back(it->get());
+						++it;
+					}
+				}
+			}
+			if (poll(fds.data(), fds.size(), -1) < 0)
+			{
+				if (errno == EINTR)
+					continue;
+				socket_error("poll");
+				return false;
+			}
+			if (fds[1].revents & POLLIN)
+			{
+				char byte;
+				if (read(wake_read_, &byte, 1) == 1 && byte == 0)
+					return true;
+			}
+			if (fds[0].revents & POLLIN)
+				accept_();
+			for (std::size_t i{0} ; i != polled.size() ; ++i)
+			{
+				if (fds[i + 2].revents)
+					receive_(*polled[i]);
+			}
+		}
+	}
+
+	private:
+	void accept_()
+	{
+		auto fd = accept(listener_, nullptr, nullptr);
+		if (fd < 0)
+			return;
+		std::lock_guard<std::mutex> lock{mutex_};
+		connections_.emplace_back(std::make_unique<Connection>(fd, cache_));
+	}
+
+	void receive_(Connection& conn)
+	{
+		char buffer[read_size];
+		auto res = read(conn.fd, buffer, sizeof(buffer));
+		if (res < 0 && errno == EINTR)
+			return;
+		if (res <= 0 || conn.input.size() > max_line_length)
+		{
+			conn.closed = true;
+			return;
+		}
+		conn.input.append(buffer, static_cast<std::size_t>(res));
+		if (conn.input.find('\n') == std::string::npos)
+			return;
+		{
+			std::lock_guard<std::mutex> lock{mutex_};
+			conn.busy = true;
+			ready_.push_back(&conn);
+		}
+		ready_cv_.notify_one();
+	}
+
+	void work_()
+	{
+		while (true)
+		{
+			Connection* conn;
+			{
+				std::unique_lock<std::mutex> lock{mutex_};
+				ready_cv_.wait(lock, [this]{return stopping_ || !ready_.empty();});
+				if (ready_.empty())
+					return;
+				conn = ready_.front();
+				ready_.pop_front();
+			}
+			serve_(*conn);
+		}
+	}
+
+	void serve_(Connection& conn)
+	{
+		auto pos = conn.input.find('\n');
+		while (pos != std::string::npos)
+		{
+			auto line = conn.input.substr(0, pos);
+			conn.input.erase(0, pos + 1);
+			if (!line.empty() && line.back() == '\r')
+				line.pop_back();
+			std::ostringstream output;
+			auto keep_going = conn.session.execute(std::move(line), output);
+			if (!send_response(conn.fd, output.str()) || !keep_going)
+			{
+				conn.closed = true;
+				break;
+			}
+			pos = conn.input.find('\n');
+		}
+		{
+			std::lock_guard<std::mutex> lock{mutex_};
+			conn.busy = false;
+		}
+		char byte{1};
+		auto res = write(signal_fd, &byte, 1);
+		static_cast<void>(res);
+	}
+
+	int listener_;
+	int wake_read_;
+	ExpressionCache& cache_;
+	std::vector<std::unique_ptr<Connection>> connections_;
+	std::deque<Connection*> ready_;
+	std::mutex mutex_;
+	std::condition_variable ready_cv_;
+	bool stopping_;
+	std::vector<std::thread> workers_;
+};
+
+} // namespace
+
+int run_server(std::string const& path, std::size_t threads, ExpressionCache& cache)
+{
+	sockaddr_un address{};
+	address.sun_family = AF_UNIX;
+	if (path.size() >= sizeof(address.sun_path))
+	{
+		std::cerr << "Server error : socket path is too long\n";
+		return EXIT_FAILURE;
+	}
+	std::strcpy(address.sun_path, path.c_str());
+
+	auto listener = socket(AF_UNIX, SOCK_STREAM, 0);
+	if (listener < 0)
+		return socket_error("socket");
+	unlink(path.c_str());
+	if (bind(listener, reinterpret_cast<sockaddr*>(&address), sizeof(address)) < 0)
+		return socket_error("bind", listener);
+	if (listen(listener, SOMAXCONN) < 0)
+		return socket_error("listen", listener);
+
+	int wake[2];
+	if (pipe(wake) < 0)
+		return socket_error("pipe", listener);
+	signal_fd = wake[1];
+	std::signal(SIGINT, handle_signal);
+	std::signal(SIGTERM, handle_signal);
+
+	std::cout << "Listening on " << path << " with " << threads << " threads\n";
+	bool clean_exit;
+	{
+		Server server{listener, wake[0], threads, cache};
+		clean_exit = server.run();
+	}
+	close(listener);
+	close(wake[0]);
+	close(wake[1]);
+	unlink(path.c_str());
+	return clean_exit ? EXIT_SUCCESS : EXIT_FAILURE;
+}
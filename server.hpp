@@ -0,0 +1,17 @@
+// Copyright 2015 Benoît Vey
+
+#ifndef CALC_SERVER_HPP_
+#define CALC_SERVER_HPP_
+
+#include <cstddef>
+#include <string>
+
+#include "jit.hpp"
+
+// Serves clients on a Unix domain socket until interrupted. Each connection has its own session.
+// Clients send lines of input, and the server answers each line with the output of the session
+// followed by a line containing a single dot. Output lines starting with a dot get an extra dot.
+// Returns the exit status of the program.
+int run_server(std::string const&, std::size_t, ExpressionCache&);
+
+#endif // Header guard
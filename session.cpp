@@ -0,0 +1,441 @@
+// Copyright 2015 Benoît Vey
+
+#include "session.hpp"
+
+#include <cctype>
+#include <iostream>
+#include <set>
+
+#include "command_handler.hpp"
+#include "csv.hpp"
+#include "utility.hpp"
+
+namespace
+{
+
+std::size_t const max_cached_expressions{4096};
+
+// Expressions reading or writing the environment depend on the session they are compiled for.
+bool is_cacheable(ExprTree& expr, std::set<std::string> const& deps,
+                  std::map<std::string, Function*> const& funs)
+{
+	if (expr.is_array())
+		return false;
+	return std::all_of(std::begin(deps), std::end(deps), [&funs](std::string const& dep)
+	{
+		auto fun_it = funs.find(dep);
+		return fun_it != std::end(funs) && fun_it->second->type != FunctionType::userdef;
+	});
+}
+
+std::string cache_key(std::string const& line)
+{
+	return std::to_string(static_cast<int>(numeric_mode())) + ':' + std::to_string(static_cast<int>(algebra_mode())) +
+	       ':' + std::to_string(static_cast<int>(profile_mode())) + ':' + line;
+}
+
+bool is_identifier(std::string const& name)
+{
+	return !name.empty() && std::isalpha(name[0]) && std::all_of(std::begin(name), std::end(name), [](char c)
+	{
+		return std::isalnum(c);
+	});
+}
+
+void check_parameters(std::vector<std::string> const& params)
+{
+	for (auto it = std::begin(params) ; it != std::end(params) ; ++it)
+	{
+		if (!is_identifier(*it))
+			throw InvalidInput{"Invalid parameter name : " + *it};
+		if (std::find(std::begin(params), it, *it) != it)
+			throw InvalidInput{"Multiple parameters named " + *it};
+	}
+}
+
+// The code given to the user of the library calls these functions by address, so they cannot be
+// evicted anymore.
+void pin_functions(std::set<std::string> const& names, std::map<std::string, Function*>& funs)
+{
+	for (auto& elem : names)
+	{
+		auto fun_it = funs.find(elem);
+		if (fun_it != std::end(funs) && fun_it->second->type == FunctionType::userdef)
+			fun_it->second->pinned = true;
+	}
+}
+
+// The variables created by the line are removed, and the others get back their values.
+void restore_variables(std::map<std::string, double> const& saved, std::map<std::string, double>& vars,
+                       std::map<std::string, Function*>& funs, DependencyGraph const& graph)
+{
+	for (auto it = std::begin(vars) ; it != std::end(vars) ;)
+	{
+		auto saved_it = saved.find(it->first);
+		if (saved_it != std::end(saved))
+		{
+			it->second = saved_it->second;
+			++it;
+			continue;
+		}
+		auto name = it->first;
+		it = vars.erase(it);
+		invalidate_dependents(name, graph, funs);
+	}
+}
+
+ExpressionCache& default_cache()
+{
+	static ExpressionCache cache;
+	return cache;
+}
+
+} // namespace
+
+Session::Session() : Session{default_cache()}
+{}
+
+Session::Session(ExpressionCache& cache)
+	: background_{variables_, functions_, dependencies_},
+	  cells_{variables_, functions_, arrays_, dependencies_}, lex_{},
+	  par_{variables_, functions_, arrays_, dependencies_}, mode_{NumericMode::float64},
+	  algebra_{AlgebraMode::exact}, profile_{ProfileMode::off}, format_{NumberStyle::precision, 6},
+	  time_limit_{default_time_limit()}, timings_{}, line_{0}, cache_{cache}
+{}
+
+Session::~Session()
+{
+	background_.stop();
+	std::lock_guard<std::mutex> lock{jit_mutex()};
+	formulas_.clear();
+	definitions_.clear();
+}
+
+bool Session::execute(std::string line, std::ostream& os)
+{
+	std::lock_guard<std::mutex> lock{jit_mutex()};
+	auto used_since = use_time();
+	++line_;
+	auto& previous_output = output();
+	set_output(os);
+	// The jobs usually end after the line defining their function.
+	for (auto& elem : background_.take_errors())
+		os << "Background compilation failed : " << elem << '\n';
+	set_numeric_mode(mode_);
+	set_algebra_mode(algebra_);
+	set_profile_mode(profile_);
+	set_number_format(format_);
+	set_time_limit(time_limit_);
+	using clock = std::chrono::steady_clock;
+	auto keep_going = true;
+	auto start = clock::now();
+	timings_ = LineTimings{};
+	// The code run by the thread outside of the session does not make the line fail.
+	take_length_mismatch();
+	watchdog_.start();
+	try
+	{
+		keep_going = execute_(std::move(line));
+	}
+	catch (InvalidInput const& ex)
+	{
+		os << "Invalid input : " << ex.what() << '\n';
+	}
+	watchdog_.stop();
+	evict_functions(functions_, dependencies_, cache_, used_since);
+	timings_.total = clock::now() - start;
+	mode_ = numeric_mode();
+	algebra_ = algebra_mode();
+	profile_ = profile_mode();
+	format_ = number_format();
+	time_limit_ = time_limit();
+	set_output(previous_output);
+	return keep_going;
+}
+
+LineTimings const& Session::timings() const
+{
+	return timings_;
+}
+
+void Session::cancel()
+{
+	watchdog_.cancel();
+}
+
+std::uint64_t Session::compile_(std::string body, std::vector<std::string> params)
+{
+	std::lock_guard<std::mutex> lock{jit_mutex()};
+	auto used_since = use_time();
+	set_numeric_mode(mode_);
+	set_algebra_mode(algebra_);
+	set_profile_mode(profile_);
+	check_parameters(params);
+	std::unique_ptr<Function> formula{new Function{nullptr, std::move(params), {},
+	                                  llvm::Intrinsic::not_intrinsic, FunctionType::userdef}};
+	std::set<std::string> deps;
+	lex_.newline(std::move(body));
+	formula->body = par_.parse_function_body(lex_, "", *formula, deps);
+	if (formula->body->is_array())
+		throw InvalidInput{"Formula must return a number"};
+	compile_function("formula" + std::to_string(formulas_.size()), *formula, variables_, functions_);
+	pin_functions(deps, functions_);
+	dependencies_.set_dependencies(library_code_name(formulas_.size()), std::move(deps));
+	evict_functions(functions_, dependencies_, cache_, used_since);
+	formulas_.emplace_back(std::move(formula));
+	return formulas_.back()->address;
+}
+
+ColumnKernel Session::compile_columns_(std::string body, std::vector<std::string> columns)
+{
+	std::lock_guard<std::mutex> lock{jit_mutex()};
+	auto used_since = use_time();
+	set_numeric_mode(mode_);
+	set_algebra_mode(algebra_);
+	set_profile_mode(profile_);
+	check_parameters(columns);
+	std::unique_ptr<Function> formula{new Function{nullptr, std::move(columns), {},
+	                                  llvm::Intrinsic::not_intrinsic, FunctionType::columnar}};
+	std::set<std::string> deps;
+	lex_.newline(std::move(body));
+	formula->body = par_.parse_function_body(lex_, "", *formula, deps);
+	::compile_columns("formula" + std::to_string(formulas_.size()), *formula, variables_, functions_);
+	pin_functions(deps, functions_);
+	dependencies_.set_dependencies(library_code_name(formulas_.size()), std::move(deps));
+	evict_functions(functions_, dependencies_, cache_, used_since);
+	formulas_.emplace_back(std::move(formula));
+	return reinterpret_cast<ColumnKernel>(formulas_.back()->address);
+}
+
+std::uint64_t Session::define_(std::string const& name, std::string body, std::vector<std::string> params)
+{
+	std::lock_guard<std::mutex> lock{jit_mutex()};
+	auto used_since = use_time();
+	set_numeric_mode(mode_);
+	set_algebra_mode(algebra_);
+	set_profile_mode(profile_);
+	if (!is_identifier(name))
+		throw InvalidInput{"Invalid function name"};
+	check_parameters(params);
+	params.emplace(std::begin(params), name);
+	lex_.newline(std::move(body));
+	execute_def(params, variables_, functions_, arrays_, dependencies_, definitions_, par_, lex_);
+	cells_.touch(name);
+	cells_.update();
+	auto fn = functions_[name];
+	if (!fn->address)
+		compile_function(name, *fn, variables_, functions_);
+	fn->pinned = true;
+	evict_functions(functions_, dependencies_, cache_, used_since);
+	return fn->address;
+}
+
+std::uint64_t Session::apply(std::string const& path, std::string formula, std::ostream& os)
+{
+	std::lock_guard<std::mutex> lock{jit_mutex()};
+	auto used_since = use_time();
+	set_numeric_mode(mode_);
+	set_algebra_mode(algebra_);
+	set_profile_mode(profile_);
+	set_number_format(format_);
+	set_time_limit(time_limit_);
+	take_length_mismatch();
+	watchdog_.start();
+	std::uint64_t rows;
+	try
+	{
+		rows = apply_csv(path, std::move(formula), variables_, functions_, dependencies_, par_, os);
+	}
+	catch (InvalidInput const&)
+	{
+		watchdog_.stop();
+		throw;
+	}
+	watchdog_.stop();
+	evict_functions(functions_, dependencies_, cache_, used_since);
+	return rows;
+}
+
+bool Session::execute_(std::string line)
+{
+	auto key = cache_key(line);
+	lex_.newline(std::move(line));
+	try
+	{
+		if (lex_.peek() == '!' || lex_.peek() == Token::eof)
+			return execute_command_();
+	}
+	catch (InvalidInput const& ex)
+	{
+		output() << "Invalid command : " << ex.what() << '\n';
+		return true;
+	}
+	using clock = std::chrono::steady_clock;
+	std::set<std::string> deps;
+	auto start = clock::now();
+	auto ast = par_.parse_formula(lex_, deps);
+	timings_.parse = clock::now() - start;
+	// Restored if the line is interrupted or computes arrays of different lengths.
+	std::map<std::string, double> saved_variables;
+	auto assigned = assigned_variables(*ast, deps, functions_, dependencies_);
+	if (!assigned.empty())
+		saved_variables = variables_;
+
+	start = clock::now();
+	ArrayResults array_results;
+	// Kept alive while it runs, even if another session evicts it from the cache.
+	std::shared_ptr<CompiledExpression> compiled;
+	auto cacheable = is_cacheable(*ast, deps, functions_);
+	if (cacheable)
+	{
+		auto cached_it = cache_.find(key);
+		if (cached_it != std::end(cache_))
+		{
+			compiled = cached_it->second;
+			mark_used(*compiled);
+		}
+	}
+	if (!compiled)
+	{
+		auto compiled_line = compile_expression(*ast, variables_, functions_, array_results, line_);
+		compiled = std::make_shared<CompiledExpression>(std::move(compiled_line));
+		if (cacheable && cache_.size() < max_cached_expressions)
+			cache_.emplace(key, compiled);
+	}
+	auto entry = compiled->entry;
+	timings_.compile = clock::now() - start;
+
+	double res;
+	{
+		JitUnlock unlock;
+		start = clock::now();
+		res = entry();
+		timings_.run = clock::now() - start;
+	}
+	try
+	{
+		check_array_lengths();
+		check_watchdog();
+	}
+	catch (InvalidInput const&)
+	{
+		if (!assigned.empty())
+			restore_variables(saved_variables, variables_, functions_, dependencies_);
+		throw;
+	}
+	if (number_format().style == NumberStyle::binary)
+	{
+		if (ast->is_array())
+			write_array(output(), array_results[""]);
+		else
+			write_binary(output(), &res, 1);
+	}
+	else
+	{
+		if (ast->is_array())
+			print_array(output(), array_results[""]);
+		else
+			write_number(output(), res);
+		output() << '\n';
+	}
+
+	for (auto& elem : assigned)
+		cells_.touch(elem);
+	for (auto& elem : commit_arrays(array_results, arrays_, variables_, functions_, dependencies_))
+		cells_.touch(elem);
+	cells_.update();
+	return true;
+}
+
+bool Session::execute_command_()
+{
+	auto c = parse_command(lex_);
+	switch (c.type)
+	{
+		case CommandType::help:
+			execute_help(c.args.empty() ? nullptr : &c.args[0]);
+			break;
+		case CommandType::quit:
+			return false;
+		case CommandType::env:
+			execute_env(c.args, variables_, functions_, arrays_, cells_);
+			break;
+		case CommandType::import:
+			execute_import(c.args, variables_, functions_, arrays_, dependencies_);
+			for (auto& elem : c.args)
+				cells_.touch(elem);
+			break;
+		case CommandType::del:
+			execute_del(c.args, variables_, functions_, arrays_, dependencies_);
+			for (auto& elem : c.args)
+				cells_.touch(elem);
+			break;
+		case CommandType::def:
+		{
+			auto name = c.args[0];
+			execute_def(c.args, variables_, functions_, arrays_, dependencies_, definitions_, par_, lex_);
+			cells_.touch(name);
+			background_.submit(name);
+			break;
+		}
+		case CommandType::background:
+			execute_background(c.args, background_);
+			break;
+		case CommandType::profile:
+			execute_profile(c.args, functions_);
+			break;
+		case CommandType::format:
+			execute_format(c.args);
+			break;
+		case CommandType::seed:
+			execute_seed(c.args);
+			break;
+		case CommandType::timeout:
+			execute_timeout(c.args);
+			break;
+		case CommandType::montecarlo:
+			execute_montecarlo(variables_, functions_, dependencies_, par_, lex_);
+			break;
+		case CommandType::check:
+			execute_check(c.args, variables_, functions_, arrays_, par_);
+			break;
+		case CommandType::apply:
+			execute_apply(variables_, functions_, dependencies_, par_, lex_);
+			break;
+		case CommandType::load:
+		{
+			auto loaded = execute_load(c.args, variables_, functions_, arrays_, dependencies_, definitions_, par_);
+			for (auto& elem : loaded)
+				cells_.touch(elem);
+			break;
+		}
+		case CommandType::cell:
+			execute_cell(c.args, cells_, par_, lex_);
+			break;
+		case CommandType::mode:
+			execute_mode(c.args, functions_);
+			break;
+		case CommandType::algebra:
+			execute_algebra(c.args, functions_);
+			break;
+		case CommandType::bench:
+			for (auto& elem : execute_bench(variables_, functions_, dependencies_, par_, lex_))
+				cells_.touch(elem);
+			break;
+		case CommandType::map:
+			for (auto& elem : execute_map(c.args, variables_, functions_, arrays_, dependencies_, par_, lex_))
+				cells_.touch(elem);
+			break;
+		case CommandType::export_:
+			execute_export(c.args, variables_, functions_);
+			break;
+		case CommandType::mem:
+			execute_mem(c.args, variables_, functions_, arrays_);
+			break;
+		case CommandType::op:
+			execute_op(c.args, par_);
+			break;
+	}
+	cells_.update();
+	return true;
+}
@@ -0,0 +1,129 @@
+// Copyright 2015 Benoît Vey
+
+#ifndef CALC_SESSION_HPP_
+#define CALC_SESSION_HPP_
+
+#include <chrono>
+#include <cstdint>
+#include <iosfwd>
+#include <map>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "Lexer.hpp"
+#include "Parser.hpp"
+#include "arrays.hpp"
+#include "background.hpp"
+#include "cells.hpp"
+#include "columns.hpp"
+#include "dependency_graph.hpp"
+#include "jit.hpp"
+#include "output.hpp"
+#include "profile.hpp"
+#include "syntax_tree.hpp"
+#include "watchdog.hpp"
+
+// Time spent by the last line executed, in each phase. Commands are only timed as a whole.
+struct LineTimings
+{
+	std::chrono::nanoseconds parse;
+	std::chrono::nanoseconds compile;
+	std::chrono::nanoseconds run;
+	std::chrono::nanoseconds total;
+};
+
+// Environment of a user of the calculator. Sessions are isolated from each other and can be used
+// from different threads, but a given session must only be used by one thread at a time.
+// This is the interface of libllcalc. Call initialize_jit once before creating sessions.
+class Session
+{
+	public:
+	template <typename>
+	using Parameter = double;
+
+	Session();
+	Session(ExpressionCache&);
+
+	Session(Session const&) = delete;
+	Session& operator=(Session const&) = delete;
+
+	Session(Session&&) = delete;
+	Session& operator=(Session&&) = delete;
+
+	~Session();
+
+	// Executes a line of input and writes the results and messages to the stream. Returns false
+	// once the line asks to quit.
+	bool execute(std::string, std::ostream&);
+
+	// Timings of the last call to execute.
+	LineTimings const& timings() const;
+
+	// Interrupts the line being executed, or the file being applied, from any thread or from a signal
+	// handler. The line fails without changing the variables.
+	void cancel();
+
+	// Compiles a formula of the given parameters, for example compile("x * y + z", "x", "y", "z"),
+	// and returns the native function. Functions compiled by the session can be called from any
+	// thread. They stay valid until the session is destroyed. The identifiers used by the formula
+	// cannot be redefined or deleted, and the numeric, algebra and profiling modes cannot change
+	// while it calls user functions. Throws InvalidInput on errors.
+	template <typename... Names>
+	double (*compile(std::string body, Names const&... params))(Parameter<Names>...)
+	{
+		auto address = compile_(std::move(body), {params...});
+		return reinterpret_cast<double(*)(Parameter<Names>...)>(address);
+	}
+
+	// Compiles a formula evaluated on each row of the given columns, for example
+	// compile_columns("x * y + z", "x", "y"), where z is a variable of the session. Run the kernel
+	// with apply_columns. Kernels follow the same rules as the functions returned by compile.
+	template <typename... Names>
+	ColumnKernel compile_columns(std::string body, Names const&... columns)
+	{
+		return compile_columns_(std::move(body), {columns...});
+	}
+
+	// Same as !def name(params...) = body, and returns the native function.
+	template <typename... Names>
+	double (*define(std::string const& name, std::string body, Names const&... params))(Parameter<Names>...)
+	{
+		auto address = define_(name, std::move(body), {params...});
+		return reinterpret_cast<double(*)(Parameter<Names>...)>(address);
+	}
+
+	// Same as !apply path formula, with the results written to the stream. Returns the number of
+	// rows. Throws InvalidInput on errors.
+	std::uint64_t apply(std::string const& path, std::string formula, std::ostream&);
+
+	private:
+	std::uint64_t compile_(std::string, std::vector<std::string>);
+	ColumnKernel compile_columns_(std::string, std::vector<std::string>);
+	std::uint64_t define_(std::string const&, std::string, std::vector<std::string>);
+	bool execute_(std::string);
+	bool execute_command_();
+
+	std::map<std::string, double> variables_;
+	std::map<std::string, Function*> functions_;
+	std::map<std::string, Array> arrays_;
+	std::map<Function*, std::unique_ptr<Function>> definitions_;
+	std::vector<std::unique_ptr<Function>> formulas_;
+	DependencyGraph dependencies_;
+	BackgroundCompiler background_;
+	Cells cells_;
+	Lexer lex_;
+	Parser par_;
+	NumericMode mode_;
+	AlgebraMode algebra_;
+	ProfileMode profile_;
+	NumberFormat format_;
+	std::chrono::milliseconds time_limit_;
+	Watchdog watchdog_;
+	LineTimings timings_;
+	// Number of the line being executed, which names its compiled code.
+	std::size_t line_;
+	ExpressionCache& cache_;
+};
+
+#endif // Header guard
@@ -0,0 +1,142 @@
+// Copyright 2015 Benoît Vey
+
+// Stress test for very deep expressions. Each shape is parsed, printed, compiled to IR and destroyed
+// at growing sizes, and compiled to native code and run up to a smaller size. The time per node of
+// each step should stay about the same as the size grows.
+
+#include <chrono>
+#include <cmath>
+#include <cstdlib>
+#include <functional>
+#include <iostream>
+#include <map>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "../Lexer.hpp"
+#include "../Parser.hpp"
+#include "../arrays.hpp"
+#include "../command_handler.hpp"
+#include "../dependency_graph.hpp"
+#include "../jit.hpp"
+#include "../syntax_tree.hpp"
+
+namespace
+{
+
+using clock = std::chrono::steady_clock;
+
+struct Shape
+{
+	char const* name;
+	std::function<std::string(std::size_t)> expression;
+	std::function<double(std::size_t)> value;
+};
+
+std::string repeat(std::string const& text, std::size_t count)
+{
+	std::string res;
+	res.reserve(text.size() * count);
+	for (std::size_t i{0} ; i != count ; ++i)
+		res += text;
+	return res;
+}
+
+// x is 1 in every expression.
+std::vector<Shape> make_shapes()
+{
+	return
+	{
+		{"left sum", [](std::size_t n) { return "x" + repeat(" + x", n - 1); },
+		 [](std::size_t n) { return static_cast<double>(n); }},
+		{"right differences", [](std::size_t n) { return repeat("(x - ", n - 1) + "x" + repeat(")", n - 1); },
+		 [](std::size_t n) { return n % 2 == 0 ? 0.0 : 1.0; }},
+		{"power chain", [](std::size_t n) { return "x" + repeat(" ^ x", n - 1); },
+		 [](std::size_t) { return 1.0; }},
+		{"negations", [](std::size_t n) { return repeat("-", n - 1) + "x"; },
+		 [](std::size_t n) { return n % 2 == 0 ? -1.0 : 1.0; }},
+		{"nested calls", [](std::size_t n) { return repeat("abs(", n - 1) + "x" + repeat(")", n - 1); },
+		 [](std::size_t) { return 1.0; }}
+	};
+}
+
+double nanoseconds_per_node(clock::time_point start, std::size_t nodes)
+{
+	return std::chrono::duration<double, std::nano>{clock::now() - start}.count() / static_cast<double>(nodes);
+}
+
+} // namespace
+
+int main(int argc, char** argv)
+{
+	std::size_t max_size = argc > 1 ? std::strtoull(argv[1], nullptr, 10) : 10000000;
+	std::size_t max_jit_size = argc > 2 ? std::strtoull(argv[2], nullptr, 10) : 100000;
+
+	initialize_jit();
+	std::map<std::string, double> vars{{"x", 1.0}};
+	std::map<std::string, Function*> funs;
+	std::map<std::string, Array> arrays;
+	DependencyGraph graph;
+	execute_import({"abs"}, vars, funs, arrays, graph);
+	Parser par{vars, funs, arrays, graph};
+	Lexer lex;
+	auto& ctx = jit_context();
+	auto failed = false;
+
+	std::cout << "ns per node : parse, print, analyze, IR, destroy, native\n";
+	for (auto& shape : make_shapes())
+	{
+		for (std::size_t size{1000} ; size <= max_size ; size *= 10)
+		{
+			std::cout << shape.name << ' ' << size << " :";
+			lex.newline(shape.expression(size));
+
+			auto start = clock::now();
+			auto ast = par.parse(lex);
+			auto nodes = tree_memory().nodes;
+			std::cout << ' ' << nanoseconds_per_node(start, nodes);
+
+			start = clock::now();
+			std::ostringstream printed;
+			ast->print(printed);
+			std::cout << ' ' << nanoseconds_per_node(start, nodes);
+
+			start = clock::now();
+			ast->is_array();
+			std::cout << ' ' << nanoseconds_per_node(start, nodes);
+
+			start = clock::now();
+			{
+				llvm::Module module{"CalcStress", ctx};
+				auto fn_type = llvm::FunctionType::get(llvm::Type::getDoubleTy(ctx), {}, false);
+				auto fn = llvm::Function::Create(fn_type, llvm::Function::ExternalLinkage, "stress", &module);
+				llvm::IRBuilder<> builder{ctx};
+				builder.SetInsertPoint(llvm::BasicBlock::Create(ctx, "entry", fn));
+				builder.CreateRet(ast->codegen(module, builder));
+			}
+			std::cout << ' ' << nanoseconds_per_node(start, nodes);
+
+			std::unique_ptr<CompiledExpression> compiled;
+			if (size <= max_jit_size)
+			{
+				ArrayResults results;
+				start = clock::now();
+				compiled = std::make_unique<CompiledExpression>(compile_expression(*ast, vars, funs, results));
+			}
+			auto native_time = compiled ? nanoseconds_per_node(start, nodes) : NAN;
+
+			start = clock::now();
+			ast.reset();
+			std::cout << ' ' << nanoseconds_per_node(start, nodes) << ' ' << native_time;
+
+			if (compiled && compiled->entry() != shape.value(size))
+			{
+				std::cout << " wrong result " << compiled->entry();
+				failed = true;
+			}
+			std::cout << std::endl;
+		}
+	}
+	return failed ? EXIT_FAILURE : EXIT_SUCCESS;
+}
@@ -2,212 +2,1942 @@
 
 #include "syntax_tree.hpp"
 
+#include <algorithm>
+#include <atomic>
+#include <cmath>
 #include <iostream>
 
+#include "Lexer.hpp"
 #include "Parser.hpp"
+#include "arrays.hpp"
+#include "dependency_graph.hpp"
+#include "jit.hpp"
+#include "profile.hpp"
+#include "random.hpp"
+#include "watchdog.hpp"
 
 using namespace std::string_literals;
 
-llvm::Value* NumberTree::codegen(llvm::Module&, llvm::IRBuilder<>&)
+namespace
 {
-	return llvm::ConstantFP::get(llvm::getGlobalContext(), llvm::APFloat(number_));
+
+thread_local NumericMode mode{NumericMode::float64};
+thread_local AlgebraMode algebra{AlgebraMode::exact};
+
+// Flag set by the integer operations overflowing in the integer subtree being generated, and whether
+// the subtrees which overflowed are being generated again with reals.
+thread_local llvm::Value* overflow_flag{nullptr};
+thread_local bool real_arithmetic{false};
+
+std::atomic<std::size_t> tree_nodes{0};
+std::atomic<std::size_t> tree_bytes{0};
+
+double const max_exact_integer{9007199254740992.0};
+
+// The instruction scheduler of the backend takes a time quadratic in the length of basic blocks, so
+// long expressions are split in blocks of bounded length.
+std::size_t const max_block_nodes{1024};
+
+// Each multiplication of a chain rounds, so longer chains are less precise than pow.
+double const max_power_exponent{32.0};
+int const max_polynomial_degree{32};
+
+PolynomialShape const not_polynomial{nullptr, nullptr, -1, false};
+
+// Both branches of conditions are computed when they are at most this long.
+std::size_t const max_speculated_nodes{16};
+
+llvm::Function* declare_function(llvm::Module& main, std::string const& name, std::size_t args_count)
+{
+	auto fn = main.getFunction(name);
+	if (!fn)
+	{
+		std::vector<llvm::Type*> args_type{args_count, llvm::Type::getDoubleTy(jit_context())};
+		auto fn_type = llvm::FunctionType::get(llvm::Type::getDoubleTy(jit_context()),
+		                                       args_type, false);
+		fn = llvm::Function::Create(fn_type, llvm::Function::ExternalLinkage, name, &main);
+	}
+	return fn;
+}
+
+ArrayLoop& array_loop(std::string const& what)
+{
+	auto loop = ArrayLoop::current();
+	if (!loop)
+		throw InvalidInput{what + " used in a scalar context"};
+	return *loop;
+}
+
+// Type of the numbers computed at the current insertion point.
+llvm::Type* real_type()
+{
+	auto loop = ArrayLoop::current();
+	if (loop && loop->in_body())
+		return loop->element_type();
+	return llvm::Type::getDoubleTy(jit_context());
+}
+
+// Builtins and user functions always work on doubles.
+llvm::Value* call_double(llvm::IRBuilder<>& builder, llvm::Function* fn, std::vector<llvm::Value*> args,
+                         std::string const& name)
+{
+	for (auto& elem : args)
+		elem = convert_number(builder, elem, llvm::Type::getDoubleTy(jit_context()));
+	return convert_number(builder, builder.CreateCall(fn, args, name), real_type());
+}
+
+void split_block(llvm::IRBuilder<>& builder)
+{
+	auto block = builder.GetInsertBlock();
+	auto next = llvm::BasicBlock::Create(jit_context(), "cont", block->getParent());
+	builder.CreateBr(next);
+	builder.SetInsertPoint(next);
+}
+
+bool is_literal(ExprTree const& expr, double& value)
+{
+	if (expr.type != TreeType::number)
+		return false;
+	value = static_cast<NumberTree const&>(expr).number();
+	return true;
+}
+
+// Exponentiation by squaring.
+llvm::Value* codegen_multiplications(llvm::IRBuilder<>& builder, llvm::Value* base, unsigned exponent)
+{
+	assert(exponent != 0);
+	llvm::Value* res{nullptr};
+	for ( ; exponent != 0 ; exponent >>= 1)
+	{
+		if (exponent & 1)
+			res = res ? builder.CreateFMul(res, base, "pow") : base;
+		if (exponent > 1)
+			base = builder.CreateFMul(base, base, "sqr");
+	}
+	return res;
+}
+
+// Same as pow(x, 0.5), which is +0 for -0 and +inf for -inf.
+llvm::Value* codegen_sqrt(llvm::Module& main, llvm::IRBuilder<>& builder, llvm::Value* x)
+{
+	std::vector<llvm::Type*> args_type{x->getType()};
+	auto sqrt_fn = llvm::Intrinsic::getDeclaration(&main, llvm::Intrinsic::sqrt, args_type);
+	auto fabs_fn = llvm::Intrinsic::getDeclaration(&main, llvm::Intrinsic::fabs, args_type);
+	auto root = builder.CreateCall(fabs_fn, {builder.CreateCall(sqrt_fn, {x}, "sqrt")}, "abs");
+	auto minus_infinity = builder.CreateFCmpOEQ(x, llvm::ConstantFP::getInfinity(x->getType(), true));
+	return builder.CreateSelect(minus_infinity, llvm::ConstantFP::getInfinity(x->getType()), root, "sqrt");
+}
+
+// Horner form. The variable is raised to the gaps between the terms of sparse polynomials.
+llvm::Value* codegen_polynomial(llvm::IRBuilder<>& builder, std::vector<double> const& coefficients, llvm::Value* x)
+{
+	auto type = x->getType();
+	auto degree = static_cast<int>(coefficients.size()) - 1;
+	while (degree > 0 && coefficients[degree] == 0.0)
+		--degree;
+	if (degree <= 0)
+		return llvm::ConstantFP::get(type, degree < 0 ? 0.0 : coefficients[0]);
+	std::map<int, llvm::Value*> powers;
+	auto power = [&](int exponent)
+	{
+		auto& value = powers[exponent];
+		if (!value)
+			value = codegen_multiplications(builder, x, static_cast<unsigned>(exponent));
+		return value;
+	};
+	llvm::Value* res{nullptr};
+	auto previous = degree;
+	for (auto i = degree - 1 ; i >= 0 ; --i)
+	{
+		if (coefficients[i] == 0.0 && i != 0)
+			continue;
+		if (res || coefficients[degree] != 1.0)
+		{
+			auto lead = res ? res : llvm::ConstantFP::get(type, coefficients[degree]);
+			res = builder.CreateFMul(lead, power(previous - i), "horner");
+		}
+		else
+			res = power(previous - i);
+		if (coefficients[i] != 0.0)
+			res = builder.CreateFAdd(res, llvm::ConstantFP::get(type, coefficients[i]), "horner");
+		previous = i;
+	}
+	return res;
+}
+
+std::vector<double> add_polynomials(std::vector<double> lhs, std::vector<double> const& rhs, double sign)
+{
+	lhs.resize(std::max(lhs.size(), rhs.size()), 0.0);
+	for (std::size_t i{0} ; i != rhs.size() ; ++i)
+		lhs[i] += sign * rhs[i];
+	return lhs;
+}
+
+std::vector<double> multiply_polynomials(std::vector<double> const& lhs, std::vector<double> const& rhs)
+{
+	std::vector<double> res(lhs.size() + rhs.size() - 1, 0.0);
+	for (std::size_t i{0} ; i != lhs.size() ; ++i)
+	{
+		for (std::size_t j{0} ; j != rhs.size() ; ++j)
+			res[i + j] += lhs[i] * rhs[j];
+	}
+	return res;
+}
+
+// Multiplying by the inverse of a power of two rounds like dividing by it.
+bool has_exact_inverse(double value)
+{
+	int exponent;
+	return std::fabs(std::frexp(value, &exponent)) == 0.5 && std::isnormal(1.0 / value);
+}
+
+// Numbers other than 0 are true, including nan.
+llvm::Value* codegen_truth(llvm::IRBuilder<>& builder, llvm::Value* value)
+{
+	if (value->getType()->isIntegerTy())
+		return builder.CreateICmpNE(value, llvm::ConstantInt::get(value->getType(), 0), "true");
+	return builder.CreateFCmpUNE(value, llvm::ConstantFP::get(value->getType(), 0.0), "true");
+}
+
+// Comparisons are 1 or 0. Comparisons with nan are 0, except !=.
+llvm::Value* codegen_comparison(llvm::IRBuilder<>& builder, char op, llvm::Value* lhs, llvm::Value* rhs)
+{
+	auto integer = lhs->getType()->isIntegerTy();
+	llvm::CmpInst::Predicate predicate;
+	switch (op)
+	{
+		case '<':
+			predicate = integer ? llvm::CmpInst::ICMP_SLT : llvm::CmpInst::FCMP_OLT;
+			break;
+		case '>':
+			predicate = integer ? llvm::CmpInst::ICMP_SGT : llvm::CmpInst::FCMP_OGT;
+			break;
+		case Token::less_equal:
+			predicate = integer ? llvm::CmpInst::ICMP_SLE : llvm::CmpInst::FCMP_OLE;
+			break;
+		case Token::greater_equal:
+			predicate = integer ? llvm::CmpInst::ICMP_SGE : llvm::CmpInst::FCMP_OGE;
+			break;
+		case Token::equal:
+			predicate = integer ? llvm::CmpInst::ICMP_EQ : llvm::CmpInst::FCMP_OEQ;
+			break;
+		default:
+			assert(op == Token::not_equal);
+			predicate = integer ? llvm::CmpInst::ICMP_NE : llvm::CmpInst::FCMP_UNE;
+			break;
+	}
+	if (integer)
+		return builder.CreateZExt(builder.CreateICmp(predicate, lhs, rhs), lhs->getType(), "cmp");
+	return builder.CreateUIToFP(builder.CreateFCmp(predicate, lhs, rhs), lhs->getType(), "cmp");
+}
+
+bool is_comparison(char op)
+{
+	return is_in(op, {'<', '>', char(Token::less_equal), char(Token::greater_equal), char(Token::equal),
+	                  char(Token::not_equal)});
+}
+
+// The test is generated at the start of each iteration, and the body when the test is true. Both are
+// given the number of the iteration. The loop stops with a nan value once the watchdog is interrupted,
+// and exhausts it after too many iterations so that the run fails.
+template <typename Test, typename Body>
+llvm::Value* codegen_loop(llvm::Module& main, llvm::IRBuilder<>& builder, Test const& test, Body const& body)
+{
+	auto& ctx = jit_context();
+	auto fn = builder.GetInsertBlock()->getParent();
+	auto type = real_type();
+	auto count_type = llvm::Type::getInt64Ty(ctx);
+	auto preheader = builder.GetInsertBlock();
+	auto header = llvm::BasicBlock::Create(ctx, "loop", fn);
+	auto check = llvm::BasicBlock::Create(ctx, "loop.check", fn);
+	auto poll = llvm::BasicBlock::Create(ctx, "loop.poll", fn);
+	auto body_block = llvm::BasicBlock::Create(ctx, "loop.body", fn);
+	auto limited = llvm::BasicBlock::Create(ctx, "loop.limit", fn);
+	auto polling = llvm::BasicBlock::Create(ctx, "loop.polling", fn);
+	auto exhausted = llvm::BasicBlock::Create(ctx, "loop.exhausted", fn);
+	auto exit = llvm::BasicBlock::Create(ctx, "loop.end", fn);
+
+	builder.CreateBr(header);
+	builder.SetInsertPoint(header);
+	auto count = builder.CreatePHI(count_type, 2, "n");
+	auto value = builder.CreatePHI(type, 2, "value");
+	count->addIncoming(llvm::ConstantInt::get(count_type, 0), preheader);
+	value->addIncoming(llvm::ConstantFP::get(type, 0.0), preheader);
+	auto condition = test(count);
+	auto tested = builder.GetInsertBlock();
+	builder.CreateCondBr(condition, check, exit);
+
+	builder.SetInsertPoint(check);
+	// The limit is a multiple of the polling interval, so it is only checked along with the watchdog.
+	auto polled = builder.CreateICmpEQ(builder.CreateAnd(count, poll_iterations - 1), builder.getInt64(0));
+	builder.CreateCondBr(polled, poll, body_block);
+	builder.SetInsertPoint(poll);
+	auto limit = builder.CreateICmpEQ(count, llvm::ConstantInt::get(count_type, max_loop_iterations));
+	builder.CreateCondBr(limit, limited, polling);
+	builder.SetInsertPoint(limited);
+	codegen_loop_limit(main, builder);
+	builder.CreateBr(exhausted);
+	builder.SetInsertPoint(polling);
+	builder.CreateCondBr(codegen_poll(main, builder), exhausted, body_block);
+
+	builder.SetInsertPoint(body_block);
+	auto body_value = body(count);
+	auto latch = builder.GetInsertBlock();
+	count->addIncoming(builder.CreateNUWAdd(count, llvm::ConstantInt::get(count_type, 1), "n.next"), latch);
+	value->addIncoming(body_value, latch);
+	builder.CreateBr(header);
+
+	builder.SetInsertPoint(exhausted);
+	builder.CreateBr(exit);
+
+	builder.SetInsertPoint(exit);
+	auto res = builder.CreatePHI(type, 2, "loop");
+	res->addIncoming(value, tested);
+	res->addIncoming(llvm::ConstantFP::getNaN(type), exhausted);
+	return res;
+}
+
+int power_of_two(ExprTree const& expr)
+{
+	double value;
+	if (!is_literal(expr, value) || value < 1.0 || value >= max_exact_integer)
+		return -1;
+	auto exponent = std::ilogb(value);
+	return std::ldexp(1.0, exponent) == value ? exponent : -1;
+}
+
+llvm::Value* start_overflow_check(llvm::IRBuilder<>& builder)
+{
+	auto& entry = builder.GetInsertBlock()->getParent()->getEntryBlock();
+	llvm::IRBuilder<> entry_builder{&entry, entry.begin()};
+	auto flag = entry_builder.CreateAlloca(builder.getInt1Ty(), nullptr, "overflow");
+	builder.CreateStore(builder.getFalse(), flag);
+	return flag;
+}
+
+void note_overflow(llvm::IRBuilder<>& builder, llvm::Value* overflow)
+{
+	if (!overflow_flag || !overflow)
+		return;
+	builder.CreateStore(builder.CreateOr(builder.CreateLoad(overflow_flag), overflow), overflow_flag);
+}
+
+// Intrinsic is one of the signed arithmetic with overflow intrinsics.
+llvm::Value* checked_arithmetic(llvm::Module& main, llvm::IRBuilder<>& builder, llvm::Intrinsic::ID intrinsic,
+                                llvm::Value* lhs, llvm::Value* rhs, char const* name)
+{
+	auto fn = llvm::Intrinsic::getDeclaration(&main, intrinsic, {lhs->getType()});
+	auto res = builder.CreateCall(fn, {lhs, rhs});
+	note_overflow(builder, builder.CreateExtractValue(res, 1));
+	return builder.CreateExtractValue(res, 0, name);
+}
+
+} // namespace
+
+NumericMode numeric_mode()
+{
+	return mode;
+}
+
+void set_numeric_mode(NumericMode new_mode)
+{
+	mode = new_mode;
+}
+
+AlgebraMode algebra_mode()
+{
+	return algebra;
+}
+
+void set_algebra_mode(AlgebraMode new_mode)
+{
+	algebra = new_mode;
+}
+
+TreeMemory tree_memory()
+{
+	return {tree_nodes, tree_bytes};
+}
+
+void* ExprTree::operator new(std::size_t size)
+{
+	auto node = ::operator new(size);
+	++tree_nodes;
+	tree_bytes += size;
+	return node;
+}
+
+void ExprTree::operator delete(void* node, std::size_t size)
+{
+	--tree_nodes;
+	tree_bytes -= size;
+	::operator delete(node);
+}
+
+llvm::Value* ExprTree::codegen(llvm::Module& main, llvm::IRBuilder<>& builder)
+{
+	analyze_();
+	return generate_(main, builder, false);
+}
+
+llvm::Value* ExprTree::codegen_integer(llvm::Module& main, llvm::IRBuilder<>& builder)
+{
+	analyze_();
+	assert(is_integer_(*this));
+	return generate_(main, builder, true);
+}
+
+CheckedValue ExprTree::codegen_checked(llvm::Module& main, llvm::IRBuilder<>& builder)
+{
+	analyze_();
+	assert(is_integer_(*this));
+	auto outer_overflow = overflow_flag;
+	overflow_flag = start_overflow_check(builder);
+	llvm::Value* value;
+	try
+	{
+		value = generate_(main, builder, true);
+	}
+	catch (...)
+	{
+		overflow_flag = outer_overflow;
+		throw;
+	}
+	return check_overflow_(main, builder, value, outer_overflow);
+}
+
+void ExprTree::print(std::ostream& os)
+{
+	// Each node prints its parts between its children.
+	std::vector<std::pair<ExprTree*, std::size_t>> stack{{this, 0}};
+	while (!stack.empty())
+	{
+		auto node = stack.back().first;
+		auto part = stack.back().second++;
+		node->print_(os, part);
+		auto child = node->child_(part);
+		if (child)
+			stack.emplace_back(child->get(), 0);
+		else
+			stack.pop_back();
+	}
+}
+
+bool ExprTree::is_array()
+{
+	analyze_();
+	return array_;
+}
+
+bool ExprTree::has_assignments()
+{
+	std::vector<ExprTree*> stack{this};
+	while (!stack.empty())
+	{
+		auto node = stack.back();
+		stack.pop_back();
+		if (node->type == TreeType::assignment || node->type == TreeType::for_loop)
+			return true;
+		for (std::size_t i{0} ; auto child = node->child_(i) ; ++i)
+			stack.emplace_back(child->get());
+	}
+	return false;
+}
+
+void ExprTree::add_assigned_variables(std::set<std::string>& names)
+{
+	std::vector<ExprTree*> stack{this};
+	while (!stack.empty())
+	{
+		auto node = stack.back();
+		stack.pop_back();
+		if (auto name = node->assigned_variable_())
+			names.insert(*name);
+		for (std::size_t i{0} ; auto child = node->child_(i) ; ++i)
+			stack.emplace_back(child->get());
+	}
+}
+
+void ExprTree::prepare_array(ArrayLoop&, llvm::Module&, llvm::IRBuilder<>&)
+{
+	assert(!"Scalar expressions are hoisted out of array loops");
+}
+
+void ExprTree::destroy_children_()
+{
+	std::vector<ExprNode> pending;
+	auto detach = [&pending](ExprTree& node)
+	{
+		for (std::size_t i{0} ; auto child = node.child_(i) ; ++i)
+			pending.emplace_back(std::move(*child));
+	};
+	detach(*this);
+	while (!pending.empty())
+	{
+		// The node is destroyed once its children are detached.
+		auto node = std::move(pending.back());
+		pending.pop_back();
+		detach(*node);
+	}
+}
+
+bool ExprTree::is_array_(ExprTree const& expr)
+{
+	return expr.array_;
+}
+
+NumericType ExprTree::numeric_type_of_(ExprTree const& expr)
+{
+	return expr.numeric_type_;
+}
+
+bool ExprTree::is_integer_(ExprTree const& expr)
+{
+	return mode == NumericMode::int64 && !real_arithmetic && expr.numeric_type_ == NumericType::integer;
+}
+
+// The properties depend on the environment, so they are computed again before each use of the tree.
+void ExprTree::analyze_()
+{
+	std::vector<std::pair<ExprTree*, std::size_t>> stack{{this, 0}};
+	while (!stack.empty())
+	{
+		auto node = stack.back().first;
+		auto child = node->child_(stack.back().second++);
+		if (child)
+		{
+			stack.emplace_back(child->get(), 0);
+			continue;
+		}
+		node->array_ = node->node_is_array_();
+		node->numeric_type_ = node->node_numeric_type_();
+		node->analyze_shape_();
+		stack.pop_back();
+	}
+}
+
+llvm::Value* ExprTree::generate_(llvm::Module& main, llvm::IRBuilder<>& builder, bool integer)
+{
+	struct Pending
+	{
+		ExprTree* node;
+		bool integer;
+		bool convert;
+		std::size_t next_operand;
+		std::size_t operands;
+		llvm::Value* outer_overflow;
+	};
+
+	auto loop = ArrayLoop::current();
+	std::vector<Pending> stack;
+	std::vector<llvm::Value*> values;
+	std::size_t generated{0};
+	auto push = [&](ExprTree* node, bool as_integer)
+	{
+		auto hoisted = loop ? loop->hoisted(*node) : nullptr;
+		if (hoisted)
+		{
+			if (!stack.empty())
+				stack.back().node->operand_generated_(stack.back().next_operand - 1, *hoisted);
+			if (as_integer)
+				note_overflow(builder, hoisted->overflow);
+			values.emplace_back(as_integer ? hoisted->value
+			                               : convert_number(builder, real_value(*hoisted), real_type()));
+			return;
+		}
+		// Integer subexpressions of real expressions are converted once computed, or computed again
+		// with reals if they overflow.
+		auto convert = !as_integer && is_integer_(*node);
+		stack.push_back(Pending{node, as_integer || convert, convert, 0, values.size(), overflow_flag});
+		if (convert)
+			overflow_flag = start_overflow_check(builder);
+	};
+
+	auto outer_overflow = overflow_flag;
+	try
+	{
+		push(this, integer);
+		while (!stack.empty())
+		{
+			auto& top = stack.back();
+			auto operand = top.node->operand_(top.next_operand, top.integer);
+			if (operand)
+			{
+				++top.next_operand;
+				push(operand, top.integer);
+				continue;
+			}
+			auto operands = values.data() + top.operands;
+			auto generated_value = top.integer ? top.node->codegen_integer_(main, builder, operands)
+			                                   : top.node->codegen_(main, builder, operands);
+			CheckedValue checked{generated_value, nullptr, nullptr};
+			if (top.convert)
+				checked = top.node->check_overflow_(main, builder, generated_value, top.outer_overflow);
+			if (++generated % max_block_nodes == 0)
+				split_block(builder);
+			values.resize(top.operands);
+			values.emplace_back(top.convert ? checked.real : generated_value);
+			stack.pop_back();
+			if (!stack.empty())
+				stack.back().node->operand_generated_(stack.back().next_operand - 1, checked);
+		}
+	}
+	catch (...)
+	{
+		overflow_flag = outer_overflow;
+		throw;
+	}
+	assert(values.size() == 1);
+	return values.back();
+}
+
+// The real code is generated in its own block, so it only slows down the computations which overflow.
+CheckedValue ExprTree::check_overflow_(llvm::Module& main, llvm::IRBuilder<>& builder, llvm::Value* value,
+                                       llvm::Value* outer_overflow)
+{
+	auto& ctx = jit_context();
+	auto overflow = builder.CreateLoad(overflow_flag, "overflow");
+	overflow_flag = outer_overflow;
+	auto exact = convert_number(builder, value, real_type());
+	auto exact_block = builder.GetInsertBlock();
+	auto fn = exact_block->getParent();
+	auto overflowed = llvm::BasicBlock::Create(ctx, "overflow", fn);
+	auto checked = llvm::BasicBlock::Create(ctx, "checked", fn);
+	builder.CreateCondBr(overflow, overflowed, checked);
+
+	builder.SetInsertPoint(overflowed);
+	auto outer_real = real_arithmetic;
+	real_arithmetic = true;
+	llvm::Value* real;
+	try
+	{
+		real = generate_(main, builder, false);
+	}
+	catch (...)
+	{
+		real_arithmetic = outer_real;
+		throw;
+	}
+	real_arithmetic = outer_real;
+	auto real_block = builder.GetInsertBlock();
+	builder.CreateBr(checked);
+
+	builder.SetInsertPoint(checked);
+	auto res = builder.CreatePHI(exact->getType(), 2, "checked");
+	res->addIncoming(exact, exact_block);
+	res->addIncoming(real, real_block);
+	return {value, overflow, res};
+}
+
+PolynomialShape ExprTree::shape_of_(ExprTree const& expr)
+{
+	return expr.shape_();
+}
+
+std::vector<double> ExprTree::coefficients_of_(ExprTree& expr)
+{
+	assert(shape_of_(expr).degree >= 0);
+	std::vector<std::vector<double>> values;
+	std::vector<std::pair<ExprTree*, std::size_t>> stack{{&expr, 0}};
+	while (!stack.empty())
+	{
+		auto node = stack.back().first;
+		auto child = node->child_(stack.back().second++);
+		if (child)
+		{
+			stack.emplace_back(child->get(), 0);
+			continue;
+		}
+		node->push_coefficients_(values);
+		stack.pop_back();
+	}
+	assert(values.size() == 1);
+	return std::move(values.back());
+}
+
+bool ExprTree::literal_of_(ExprTree& expr, double& value)
+{
+	// Unary minus is the only unary operator with a shape.
+	auto negated = expr.type == TreeType::unary_op && shape_of_(expr).degree == 0;
+	auto& operand = negated ? *expr.child_(0)->get() : expr;
+	if (!is_literal(operand, value))
+		return false;
+	if (negated)
+		value = -value;
+	return true;
+}
+
+bool ExprTree::is_speculatable_(ExprTree& expr)
+{
+	std::vector<ExprTree*> stack{&expr};
+	std::size_t nodes{0};
+	while (!stack.empty())
+	{
+		auto node = stack.back();
+		stack.pop_back();
+		if (++nodes > max_speculated_nodes ||
+		    !is_in(node->type, {TreeType::number, TreeType::identifier, TreeType::function_param, TreeType::local,
+		                        TreeType::unary_op, TreeType::binary_op, TreeType::condition}))
+			return false;
+		for (std::size_t i{0} ; auto child = node->child_(i) ; ++i)
+			stack.emplace_back(child->get());
+	}
+	return true;
+}
+
+llvm::Value* ExprTree::generate_of_(ExprTree& expr, llvm::Module& main, llvm::IRBuilder<>& builder, bool integer)
+{
+	return expr.generate_(main, builder, integer);
+}
+
+ExprNode* ExprTree::child_(std::size_t)
+{
+	return nullptr;
+}
+
+std::string const* ExprTree::assigned_variable_() const
+{
+	return nullptr;
+}
+
+void ExprTree::analyze_shape_()
+{}
+
+PolynomialShape ExprTree::shape_() const
+{
+	return not_polynomial;
+}
+
+void ExprTree::push_coefficients_(std::vector<std::vector<double>>&) const
+{
+	assert(!"Not a polynomial");
+}
+
+bool ExprTree::node_is_array_() const
+{
+	return false;
+}
+
+NumericType ExprTree::node_numeric_type_() const
+{
+	return NumericType::real;
+}
+
+ExprTree* ExprTree::operand_(std::size_t, bool)
+{
+	return nullptr;
+}
+
+void ExprTree::operand_generated_(std::size_t, CheckedValue const&)
+{}
+
+llvm::Value* ExprTree::codegen_integer_(llvm::Module&, llvm::IRBuilder<>&, llvm::Value* const*)
+{
+	assert(!"Only integer expressions have an integer codegen");
+	return nullptr;
+}
+
+double NumberTree::number() const
+{
+	return number_;
+}
+
+void NumberTree::print_(std::ostream& os, std::size_t)
+{
+	os << number_;
+}
+
+NumericType NumberTree::node_numeric_type_() const
+{
+	if (std::trunc(number_) == number_ && std::abs(number_) <= max_exact_integer)
+		return NumericType::integer;
+	return NumericType::real;
+}
+
+PolynomialShape NumberTree::shape_() const
+{
+	return PolynomialShape{nullptr, nullptr, 0, true};
+}
+
+void NumberTree::push_coefficients_(std::vector<std::vector<double>>& values) const
+{
+	values.push_back({number_});
+}
+
+llvm::Value* NumberTree::codegen_(llvm::Module&, llvm::IRBuilder<>&, llvm::Value* const*)
+{
+	return llvm::ConstantFP::get(real_type(), number_);
+}
+
+llvm::Value* NumberTree::codegen_integer_(llvm::Module&, llvm::IRBuilder<>&, llvm::Value* const*)
+{
+	return llvm::ConstantInt::get(llvm::Type::getInt64Ty(jit_context()),
+	                              static_cast<std::int64_t>(number_), true);
+}
+
+void IdentifierTree::prepare_array(ArrayLoop& loop, llvm::Module&, llvm::IRBuilder<>& builder)
+{
+	auto& array = arrays_[label_];
+	auto data_ptr = host_address(builder, &array.data, array_element_type(array)->getPointerTo()->getPointerTo());
+	auto size_ptr = host_address(builder, &array.size, llvm::Type::getInt64PtrTy(jit_context()));
+	loop.add_leaf(*this, builder.CreateLoad(data_ptr, label_ + ".data"));
+	loop.add_length(builder.CreateLoad(size_ptr, label_ + ".size"));
+}
+
+void IdentifierTree::print_(std::ostream& os, std::size_t)
+{
+	os << label_;
+}
+
+bool IdentifierTree::node_is_array_() const
+{
+	return arrays_.find(label_) != std::end(arrays_);
+}
+
+PolynomialShape IdentifierTree::shape_() const
+{
+	return PolynomialShape{const_cast<IdentifierTree*>(this), &label_, 1, true};
+}
+
+void IdentifierTree::push_coefficients_(std::vector<std::vector<double>>& values) const
+{
+	values.push_back({0.0, 1.0});
+}
+
+llvm::Value* IdentifierTree::codegen_(llvm::Module& main, llvm::IRBuilder<>& builder, llvm::Value* const*)
+{
+	if (is_array_(*this))
+	{
+		auto& loop = array_loop("Array " + label_);
+		auto element = builder.CreateLoad(builder.CreateGEP(loop.leaf(*this), loop.index()), label_);
+		return convert_number(builder, element, real_type());
+	}
+	if (vars_.find(label_) == std::end(vars_))
+	{
+		auto err = ""s;
+		if (funs_.find(label_) != std::end(funs_))
+			err = ". Maybe you meant to use the function?";
+		throw InvalidInput{"Undeclared identifier : " + label_ + err};
+	}
+	auto var = declare_variable(main, label_);
+	return builder.CreateLoad(var);
+}
+
+void IdentifierTree::store_(llvm::Module& main, llvm::IRBuilder<>& builder, llvm::Value* value)
+{
+	if (is_array_(*this))
+		throw InvalidInput{"Cannot assign a number to array " + label_ + ". Use !del first"};
+	if (vars_.find(label_) == std::end(vars_))
+	{
+		auto fn_it = funs_.find(label_);
+		if (fn_it != std::end(funs_))
+		{
+			check_replaceable(label_, deps_, funs_);
+			output() << "Warning : overriding function " << label_ << '\n';
+			funs_.erase(fn_it);
+			deps_.remove(label_);
+			invalidate_dependents(label_, deps_, funs_);
+		}
+		vars_[label_] = 0.0f;
+	}
+	builder.CreateStore(value, declare_variable(main, label_));
+}
+
+UnaryExprTree::~UnaryExprTree()
+{
+	destroy_children_();
+}
+
+void UnaryExprTree::prepare_array(ArrayLoop& loop, llvm::Module&, llvm::IRBuilder<>&)
+{
+	loop.prepare(*st_);
+}
+
+ExprNode* UnaryExprTree::child_(std::size_t index)
+{
+	return index == 0 && st_ ? &st_ : nullptr;
+}
+
+void UnaryExprTree::print_(std::ostream& os, std::size_t part)
+{
+	if (part == 0)
+	{
+		os << op_;
+		if (parenthesized_())
+			os << '(';
+	}
+	else if (parenthesized_())
+		os << ')';
+}
+
+bool UnaryExprTree::parenthesized_() const
+{
+	return st_->type != TreeType::number && st_->type != TreeType::identifier;
+}
+
+bool UnaryExprTree::node_is_array_() const
+{
+	return is_array_(*st_);
+}
+
+NumericType UnaryExprTree::node_numeric_type_() const
+{
+	return numeric_type_of_(*st_);
+}
+
+void UnaryExprTree::analyze_shape_()
+{
+	polynomial_ = op_ == '-' ? shape_of_(*st_) : not_polynomial;
+}
+
+PolynomialShape UnaryExprTree::shape_() const
+{
+	return polynomial_;
+}
+
+void UnaryExprTree::push_coefficients_(std::vector<std::vector<double>>& values) const
+{
+	for (auto& elem : values.back())
+		elem = -elem;
+}
+
+ExprTree* UnaryExprTree::operand_(std::size_t index, bool)
+{
+	return index == 0 ? st_.get() : nullptr;
+}
+
+llvm::Value* UnaryExprTree::codegen_(llvm::Module&, llvm::IRBuilder<>& builder, llvm::Value* const* operands)
+{
+	switch (op_)
+	{
+		case '-':
+			return builder.CreateFNeg(operands[0], "neg");
+		default:
+			throw InvalidInput{"Invalid unary operator : "s + op_};
+	}
+}
+
+llvm::Value* UnaryExprTree::codegen_integer_(llvm::Module& main, llvm::IRBuilder<>& builder,
+                                             llvm::Value* const* operands)
+{
+	assert(op_ == '-');
+	return checked_arithmetic(main, builder, llvm::Intrinsic::ssub_with_overflow, builder.getInt64(0), operands[0],
+	                          "neg");
+}
+
+BinaryExprTree::~BinaryExprTree()
+{
+	destroy_children_();
+}
+
+void BinaryExprTree::prepare_array(ArrayLoop& loop, llvm::Module&, llvm::IRBuilder<>&)
+{
+	loop.prepare(*lhs_);
+	loop.prepare(*rhs_);
+}
+
+ExprNode* BinaryExprTree::child_(std::size_t index)
+{
+	auto child = index == 0 ? &lhs_ : index == 1 ? &rhs_ : nullptr;
+	return child && *child ? child : nullptr;
+}
+
+void BinaryExprTree::print_(std::ostream& os, std::size_t part)
+{
+	if (part == 0)
+	{
+		if (parenthesized_(0))
+			os << '(';
+		return;
+	}
+	if (part == 1)
+	{
+		if (parenthesized_(0))
+			os << ')';
+		if (op_ == '^')
+			os << '^';
+		else
+			os << ' ' << operator_symbol(op_) << ' ';
+	}
+	if (parenthesized_(1))
+		os << (part == 1 ? '(' : ')');
+}
+
+bool BinaryExprTree::parenthesized_(std::size_t index) const
+{
+	auto& operand = index == 0 ? *lhs_ : *rhs_;
+	// The body of a let extends as far as possible.
+	if (operand.type == TreeType::let)
+		return true;
+	if (operand.type != TreeType::binary_op)
+		return false;
+	auto precedence = operator_precedence(static_cast<BinaryExprTree const&>(operand).op_);
+	return index == 0 ? precedence < operator_precedence(op_) : precedence <= operator_precedence(op_);
+}
+
+bool BinaryExprTree::node_is_array_() const
+{
+	return is_array_(*lhs_) || is_array_(*rhs_);
+}
+
+NumericType BinaryExprTree::node_numeric_type_() const
+{
+	if (numeric_type_of_(*lhs_) != NumericType::integer || numeric_type_of_(*rhs_) != NumericType::integer)
+		return NumericType::real;
+	double value;
+	switch (op_)
+	{
+		case '+':
+		case '-':
+		case '*':
+			return NumericType::integer;
+		case '<':
+		case '>':
+		case Token::less_equal:
+		case Token::greater_equal:
+		case Token::equal:
+		case Token::not_equal:
+			return NumericType::integer;
+		case '%':
+			// Division by zero and overflowing division have no integer result.
+			if (is_literal(*rhs_, value) && value != 0.0 && value != -1.0)
+				return NumericType::integer;
+			return NumericType::real;
+		case '^':
+			if (is_literal(*rhs_, value) && value >= 0.0 && value < 64.0)
+				return NumericType::integer;
+			return NumericType::real;
+		default:
+			return NumericType::real;
+	}
+}
+
+// Sums of monomials are built in fast mode, as well as the exponentiations of monomials by small
+// integers. Polynomials of several variables are not recognized.
+void BinaryExprTree::analyze_shape_()
+{
+	polynomial_ = not_polynomial;
+	horner_ = false;
+	auto lhs = shape_of_(*lhs_);
+	auto rhs = shape_of_(*rhs_);
+	if (lhs.degree < 0 || rhs.degree < 0)
+		return;
+	if (lhs.variable && rhs.variable && (lhs.variable->type != rhs.variable->type || *lhs.label != *rhs.label))
+		return;
+	auto shape = lhs.variable ? lhs : rhs;
+	double value;
+	switch (op_)
+	{
+		case '+':
+		case '-':
+			shape.degree = std::max(lhs.degree, rhs.degree);
+			shape.monomial = false;
+			break;
+		case '*':
+			if (lhs.degree != 0 && rhs.degree != 0 && !(lhs.monomial && rhs.monomial))
+				return;
+			shape.degree = lhs.degree + rhs.degree;
+			shape.monomial = lhs.monomial && rhs.monomial;
+			break;
+		case '/':
+			if (rhs.degree != 0)
+				return;
+			shape.degree = lhs.degree;
+			shape.monomial = lhs.monomial;
+			break;
+		case '^':
+			if (algebra != AlgebraMode::fast || !lhs.monomial || !is_literal(*rhs_, value) || value < 0.0 ||
+			    value > max_polynomial_degree || std::floor(value) != value)
+				return;
+			shape.degree = lhs.degree * static_cast<int>(value);
+			shape.monomial = true;
+			break;
+		default:
+			return;
+	}
+	if (shape.degree > max_polynomial_degree)
+		return;
+	polynomial_ = shape;
+	horner_ = algebra == AlgebraMode::fast && (op_ == '+' || op_ == '-') && shape.degree >= 2;
+}
+
+PolynomialShape BinaryExprTree::shape_() const
+{
+	return polynomial_;
+}
+
+void BinaryExprTree::push_coefficients_(std::vector<std::vector<double>>& values) const
+{
+	auto rhs = std::move(values.back());
+	values.pop_back();
+	auto& lhs = values.back();
+	switch (op_)
+	{
+		case '+':
+			lhs = add_polynomials(std::move(lhs), rhs, 1.0);
+			break;
+		case '-':
+			lhs = add_polynomials(std::move(lhs), rhs, -1.0);
+			break;
+		case '*':
+			lhs = multiply_polynomials(lhs, rhs);
+			break;
+		case '/':
+			for (auto& elem : lhs)
+				elem /= rhs[0];
+			break;
+		case '^':
+		{
+			std::vector<double> res{1.0};
+			for (auto i = static_cast<int>(rhs[0]) ; i > 0 ; --i)
+				res = multiply_polynomials(res, lhs);
+			lhs = std::move(res);
+			break;
+		}
+		default:
+			assert(!"Not a polynomial");
+	}
+}
+
+// Multiplications by powers of two and exponentiations do not need the value of their constant
+// right operand. Polynomials in Horner form only need the value of their variable.
+ExprTree* BinaryExprTree::operand_(std::size_t index, bool integer)
+{
+	if (horner_ && !integer)
+		return index == 0 ? polynomial_.variable : nullptr;
+	if (index == 0)
+		return lhs_.get();
+	if (index > 1 || (integer && (op_ == '^' || (op_ == '*' && power_of_two(*rhs_) >= 0))))
+		return nullptr;
+	return rhs_.get();
+}
+
+llvm::Value* BinaryExprTree::codegen_(llvm::Module& main, llvm::IRBuilder<>& builder, llvm::Value* const* operands)
+{
+	if (horner_)
+		return codegen_polynomial(builder, coefficients_of_(*this), operands[0]);
+
+	auto lrep = operands[0];
+	auto rrep = operands[1];
+
+	switch (op_)
+	{
+		case '+':
+			return builder.CreateFAdd(lrep, rrep, "add");
+		case '-':
+			return builder.CreateFSub(lrep, rrep, "sub");
+		case '*':
+			return builder.CreateFMul(lrep, rrep, "mul");
+		case '/':
+		{
+			auto res = codegen_division_(builder, lrep);
+			return res ? res : builder.CreateFDiv(lrep, rrep, "div");
+		}
+		case '%':
+			return builder.CreateFRem(lrep, rrep, "mod");
+		case '^':
+		{
+			auto power = codegen_power_(main, builder, lrep);
+			if (power)
+				return power;
+			std::vector<llvm::Type*> args_type{lrep->getType()};
+			auto pow_fn = llvm::Intrinsic::getDeclaration(&main, llvm::Intrinsic::pow, args_type);
+			auto begin = codegen_profile_begin(main, builder);
+			auto res = builder.CreateCall(pow_fn, {lrep, rrep}, "pow");
+			codegen_profile_end(main, builder, "^", begin);
+			return res;
+		}
+		default:
+			if (is_comparison(op_))
+				return codegen_comparison(builder, op_, lrep, rrep);
+			throw InvalidInput{"Invalid binary operator : "s + op_};
+	}
+}
+
+llvm::Value* BinaryExprTree::codegen_power_(llvm::Module& main, llvm::IRBuilder<>& builder, llvm::Value* base)
+{
+	double exponent;
+	if (!literal_of_(*rhs_, exponent))
+		return nullptr;
+	auto fast = algebra == AlgebraMode::fast;
+	auto one = llvm::ConstantFP::get(base->getType(), 1.0);
+	if (exponent == 0.0)
+		return one;
+	if (exponent == 0.5)
+		return codegen_sqrt(main, builder, base);
+	if (exponent == -0.5 && fast)
+		return builder.CreateFDiv(one, codegen_sqrt(main, builder, base), "rsqrt");
+	// Only x * x and 1 / x round like pow.
+	auto magnitude = std::fabs(exponent);
+	if (std::floor(magnitude) != magnitude || magnitude > (fast ? max_power_exponent : 2.0) ||
+	    (exponent == -2.0 && !fast))
+		return nullptr;
+	auto res = codegen_multiplications(builder, base, static_cast<unsigned>(magnitude));
+	return exponent < 0.0 ? builder.CreateFDiv(one, res, "inv") : res;
+}
+
+llvm::Value* BinaryExprTree::codegen_division_(llvm::IRBuilder<>& builder, llvm::Value* dividend)
+{
+	double divisor;
+	if (!literal_of_(*rhs_, divisor))
+		return nullptr;
+	auto fast = algebra == AlgebraMode::fast;
+	if (!has_exact_inverse(divisor) && !(fast && std::isnormal(divisor) && std::isnormal(1.0 / divisor)))
+		return nullptr;
+	return builder.CreateFMul(dividend, llvm::ConstantFP::get(dividend->getType(), 1.0 / divisor), "div");
+}
+
+llvm::Value* BinaryExprTree::codegen_integer_(llvm::Module& main, llvm::IRBuilder<>& builder,
+                                              llvm::Value* const* operands)
+{
+	auto& ctx = jit_context();
+	auto lrep = operands[0];
+
+	switch (op_)
+	{
+		case '+':
+			return checked_arithmetic(main, builder, llvm::Intrinsic::sadd_with_overflow, lrep, operands[1], "add");
+		case '-':
+			return checked_arithmetic(main, builder, llvm::Intrinsic::ssub_with_overflow, lrep, operands[1], "sub");
+		case '*':
+		{
+			// A shift would not report the overflow, so the backend is left to lower the product by a
+			// constant.
+			auto shift = power_of_two(*rhs_);
+			auto rhs = shift >= 0 ? builder.getInt64(std::uint64_t{1} << shift) : operands[1];
+			return checked_arithmetic(main, builder, llvm::Intrinsic::smul_with_overflow, lrep, rhs, "mul");
+		}
+		case '%':
+			return builder.CreateSRem(lrep, operands[1], "mod");
+		case '^':
+		{
+			// Exponentiation by squaring, unrolled for the constant exponent.
+			double value;
+			is_literal(*rhs_, value);
+			auto exponent = static_cast<unsigned>(value);
+			llvm::Value* res = llvm::ConstantInt::get(llvm::Type::getInt64Ty(ctx), 1);
+			for (auto base = lrep ; exponent != 0 ; exponent >>= 1)
+			{
+				if (exponent & 1)
+					res = checked_arithmetic(main, builder, llvm::Intrinsic::smul_with_overflow, res, base, "pow");
+				if (exponent > 1)
+					base = checked_arithmetic(main, builder, llvm::Intrinsic::smul_with_overflow, base, base, "sqr");
+			}
+			return res;
+		}
+		default:
+			if (is_comparison(op_))
+				return codegen_comparison(builder, op_, lrep, operands[1]);
+			assert(!"Operator has no integer codegen");
+			return nullptr;
+	}
+}
+
+AssignmentTree::~AssignmentTree()
+{
+	destroy_children_();
+}
+
+void AssignmentTree::prepare_array(ArrayLoop& loop, llvm::Module&, llvm::IRBuilder<>&)
+{
+	loop.prepare(*rhs_);
+	loop.add_target(static_cast<IdentifierTree*>(lhs_.get())->label_);
+}
+
+ExprNode* AssignmentTree::child_(std::size_t index)
+{
+	auto child = index == 0 ? &lhs_ : index == 1 ? &rhs_ : nullptr;
+	return child && *child ? child : nullptr;
+}
+
+std::string const* AssignmentTree::assigned_variable_() const
+{
+	return &static_cast<IdentifierTree const&>(*lhs_).label_;
+}
+
+void AssignmentTree::print_(std::ostream& os, std::size_t part)
+{
+	if (part == 1)
+		os << " = ";
+}
+
+bool AssignmentTree::node_is_array_() const
+{
+	return is_array_(*rhs_);
+}
+
+ExprTree* AssignmentTree::operand_(std::size_t index, bool)
+{
+	return index == 0 ? rhs_.get() : nullptr;
+}
+
+llvm::Value* AssignmentTree::codegen_(llvm::Module& main, llvm::IRBuilder<>& builder, llvm::Value* const* operands)
+{
+	auto id = static_cast<IdentifierTree*>(lhs_.get());
+	auto rrep = operands[0];
+	if (is_array_(*this))
+	{
+		auto& loop = array_loop("Array assignment");
+		builder.CreateStore(rrep, builder.CreateGEP(loop.target(id->label_), loop.index()));
+		return rrep;
+	}
+	id->store_(main, builder, rrep);
+	return lhs_->codegen(main, builder);
+}
+
+void FunctionParamTree::prepare_array(ArrayLoop& loop, llvm::Module&, llvm::IRBuilder<>&)
+{
+	// Columns are processed in independent chunks.
+	if (loop.nested())
+		throw InvalidInput{"Column " + label_ + " cannot be reduced"};
+	loop.add_leaf(*this, function_->param_values[index_()]);
+}
+
+void FunctionParamTree::print_(std::ostream& os, std::size_t)
+{
+	os << label_;
+}
+
+bool FunctionParamTree::node_is_array_() const
+{
+	return function_->type == FunctionType::columnar;
+}
+
+PolynomialShape FunctionParamTree::shape_() const
+{
+	return PolynomialShape{const_cast<FunctionParamTree*>(this), &label_, 1, true};
+}
+
+void FunctionParamTree::push_coefficients_(std::vector<std::vector<double>>& values) const
+{
+	values.push_back({0.0, 1.0});
 }
 
-llvm::Value* IdentifierTree::codegen(llvm::Module& main, llvm::IRBuilder<>& builder)
+llvm::Value* FunctionParamTree::codegen_(llvm::Module&, llvm::IRBuilder<>& builder, llvm::Value* const*)
 {
-	llvm::GlobalVariable* var{nullptr};
-	if (vars_.find(label_) == std::end(vars_))
+	if (is_array_(*this))
 	{
-		auto err = ""s;
-		if (funs_.find(label_) != std::end(funs_))
-			err = ". Maybe you meant to use the function?";
-		throw InvalidInput{"Undeclared identifier : " + label_ + err};
+		auto& loop = array_loop("Column " + label_);
+		auto element = builder.CreateLoad(builder.CreateGEP(loop.leaf(*this), loop.index()), label_);
+		return convert_number(builder, element, real_type());
 	}
-	if (!(var = main.getGlobalVariable(label_)))
-		var = new llvm::GlobalVariable{main, llvm::Type::getDoubleTy(llvm::getGlobalContext()), false,
-		                               llvm::GlobalVariable::ExternalLinkage,
-		                               llvm::ConstantFP::get(llvm::getGlobalContext(),
-		                               						 llvm::APFloat{vars_[label_]}),
-		                               label_};
-	return builder.CreateLoad(var);
+	return function_->param_values[index_()];
 }
 
-llvm::Value* UnaryExprTree::codegen(llvm::Module& main, llvm::IRBuilder<>& builder)
+std::size_t FunctionParamTree::index_() const
 {
-	auto strep = st_->codegen(main, builder);
+	auto par_idx = static_cast<std::size_t>(std::find(std::begin(function_->param_names),
+	                                       std::end(function_->param_names),
+	                                       label_)
+	                                       - std::begin(function_->param_names));
+	assert(par_idx < function_->param_values.size());
+	return par_idx;
+}
 
-	switch (op_)
-	{
-		case '-':
-			return builder.CreateFNeg(strep, "neg");
-		default:
-			throw InvalidInput{"Invalid unary operator : "s + op_};
-	}
+FunctionCallTree::~FunctionCallTree()
+{
+	destroy_children_();
+}
+
+void FunctionCallTree::prepare_array(ArrayLoop& loop, llvm::Module&, llvm::IRBuilder<>&)
+{
+	for (auto& elem : params_)
+		loop.prepare(*elem);
 }
 
-llvm::Value* BinaryExprTree::codegen(llvm::Module& main, llvm::IRBuilder<>& builder)
+ExprNode* FunctionCallTree::child_(std::size_t index)
 {
-	auto lrep = lhs_->codegen(main, builder);
-	auto rrep = rhs_->codegen(main, builder);
+	return index < params_.size() && params_[index] ? &params_[index] : nullptr;
+}
 
-	std::vector<llvm::Type*> args_type{llvm::Type::getDoubleTy(llvm::getGlobalContext()),
-		llvm::Type::getDoubleTy(llvm::getGlobalContext())};
-	auto pow_fn = llvm::Intrinsic::getDeclaration(&main, llvm::Intrinsic::pow, args_type);
+void FunctionCallTree::print_(std::ostream& os, std::size_t part)
+{
+	if (part == 0)
+		os << label_ << '(';
+	else if (part != params_.size())
+		os << ", ";
+	if (part == params_.size())
+		os << ')';
+}
 
-	switch (op_)
+bool FunctionCallTree::node_is_array_() const
+{
+	if (is_reduction_())
+		return false;
+	return std::any_of(std::begin(params_), std::end(params_), [](ExprNode const& param)
 	{
-		case '+':
-			return builder.CreateFAdd(lrep, rrep, "add");
-		case '-':
-			return builder.CreateFSub(lrep, rrep, "sub");
-		case '*':
-			return builder.CreateFMul(lrep, rrep, "mul");
-		case '/':
-			return builder.CreateFDiv(lrep, rrep, "div");
-		case '%':
-			return builder.CreateFRem(lrep, rrep, "mod");
-		case '^':
-			return builder.CreateCall(pow_fn, {lrep, rrep}, "pow");
-		default:
-			throw InvalidInput{"Invalid binary operator : "s + op_};
-	}
+		return is_array_(*param);
+	});
 }
 
-llvm::Value* AssignmentTree::codegen(llvm::Module& main, llvm::IRBuilder<>& builder)
+NumericType FunctionCallTree::node_numeric_type_() const
 {
-	auto id = static_cast<IdentifierTree*>(lhs_.get());
-	auto rrep = rhs_->codegen(main, builder);
-	llvm::GlobalVariable* var{nullptr};
-	if (!(var = main.getGlobalVariable(id->label_)))
+	if (!is_reduction_() || label_ == "mean")
+		return NumericType::real;
+	if (label_ == "len")
+		return NumericType::integer;
+	auto all_integers = std::all_of(std::begin(params_), std::end(params_), [](ExprNode const& param)
 	{
-		if (id->vars_.find(id->label_) == std::end(id->vars_))
-		{
-			auto fn_it = id->funs_.find(id->label_);
-			if (fn_it != std::end(id->funs_))
-			{
-				std::cout << "Warning : overriding function " << id->label_ << '\n';
-				id->funs_.erase(fn_it);
-			}
-			id->vars_[id->label_] = 0.0f;
-		}
-		var = new llvm::GlobalVariable{main, llvm::Type::getDoubleTy(llvm::getGlobalContext()), false,
-		                               llvm::GlobalVariable::ExternalLinkage,
-		                               llvm::ConstantFP::get(llvm::getGlobalContext(), llvm::APFloat{0.0}),
-		                               id->label_};
-	}
-	builder.CreateStore(rrep, var);
-	return lhs_->codegen(main, builder);
+		return numeric_type_of_(*param) == NumericType::integer;
+	});
+	return all_integers ? NumericType::integer : NumericType::real;
 }
 
-llvm::Value* FunctionParamTree::codegen(llvm::Module&, llvm::IRBuilder<>&)
+// Reductions generate their parameters in their own loop.
+ExprTree* FunctionCallTree::operand_(std::size_t index, bool)
 {
-	auto par_idx = static_cast<std::size_t>(std::find(std::begin(function_->param_names),
-	                                       std::end(function_->param_names),
-	                                       label_)
-	                                       - std::begin(function_->param_names));
-	assert(par_idx < function_->param_values.size());
-	return function_->param_values[par_idx];
+	if (index >= params_.size() || is_reduction_())
+		return nullptr;
+	return params_[index].get();
 }
 
-llvm::Value* FunctionCallTree::codegen(llvm::Module& main, llvm::IRBuilder<>& builder)
+llvm::Value* FunctionCallTree::codegen_(llvm::Module& main, llvm::IRBuilder<>& builder, llvm::Value* const* operands)
 {
-	std::vector<llvm::Value*> fn_args;
-	for (auto& elem : params_)
-		fn_args.emplace_back(elem->codegen(main, builder));
-	auto fn = funs_[label_];
+	auto fun_it = funs_.find(label_);
+	if (fun_it == std::end(funs_))
+		throw InvalidInput{"Undeclared function : " + label_};
+	auto fn = fun_it->second;
+	if (fn->param_names.size() != params_.size())
+		throw InvalidInput{"Wrong argument count in call to function " + label_};
+	if (fn->type == FunctionType::reduction)
+		return convert_number(builder, codegen_reduction_(main, builder), real_type());
+	std::vector<llvm::Value*> fn_args{operands, operands + params_.size()};
+	auto begin = codegen_profile_begin(main, builder);
+	llvm::Value* res;
 	if (fn->type == FunctionType::intrinsic)
 	{
-		std::vector<llvm::Type*> args_type{fn->param_names.size(),
-			                               llvm::Type::getDoubleTy(llvm::getGlobalContext())};
+		std::vector<llvm::Type*> args_type{real_type()};
 		auto intr = llvm::Intrinsic::getDeclaration(&main, fn->intrinsic, args_type);
 		assert(intr);
-		return builder.CreateCall(intr, fn_args, label_);
+		res = builder.CreateCall(intr, fn_args, label_);
+	}
+	else if (fn->type == FunctionType::builtin && label_ == "rand" && SampleStream::current())
+	{
+		// The elements would draw the same number.
+		if (ArrayLoop::current())
+			throw InvalidInput{"Monte Carlo expressions cannot call rand in arrays"};
+		res = SampleStream::current()->draw(main, builder, fn_args[0], fn_args[1]);
+	}
+	else if (fn->type == FunctionType::builtin)
+	{
+		auto builtin = declare_function(main, "calcfn_" + label_, fn->param_names.size());
+		res = call_double(builder, builtin, std::move(fn_args), "calcfn_" + label_);
+	}
+	else
+	{
+		auto userdef = declare_function(main, compiled_name(label_), fn->param_names.size());
+		res = call_double(builder, userdef, std::move(fn_args), label_);
+	}
+	codegen_profile_end(main, builder, label_, begin);
+	return res;
+}
+
+llvm::Value* FunctionCallTree::codegen_integer_(llvm::Module& main, llvm::IRBuilder<>& builder, llvm::Value* const*)
+{
+	return codegen_reduction_(main, builder);
+}
+
+llvm::Value* FunctionCallTree::codegen_reduction_(llvm::Module& main, llvm::IRBuilder<>& builder)
+{
+	auto& ctx = jit_context();
+	for (auto& elem : params_)
+	{
+		if (!is_array_(*elem))
+			throw InvalidInput{"Function " + label_ + " expects arrays"};
 	}
-	if (fn->type == FunctionType::builtin)
+
+	ArrayLoop loop{main, builder};
+	for (auto& elem : params_)
+		loop.prepare(*elem);
+	auto n = loop.length();
+	if (label_ == "len")
+		return n;
+
+	// Integer sums are exact, and only computed in integer subtrees, which report their overflows. The
+	// mean is real, so it adds up doubles. Otherwise, summation order is left to the optimizer so that
+	// the loop can be vectorized.
+	auto integer = is_integer_(*this);
+	auto acc_type = integer ? llvm::Type::getInt64Ty(ctx) : loop.element_type();
+	llvm::FastMathFlags fast_math;
+	fast_math.setUnsafeAlgebra();
+	auto acc = loop.entry_alloca(acc_type, 1);
+	builder.CreateStore(llvm::Constant::getNullValue(acc_type), acc);
+	loop.begin();
+	llvm::Value* sum;
+	if (integer)
 	{
-		auto builtin = main.getFunction("calcfn_" + label_);
-		if (!builtin)
+		auto value = params_[0]->codegen_integer(main, builder);
+		if (label_ == "dot")
 		{
-			std::vector<llvm::Type*> args_type{fn->param_names.size(),
-			                                   llvm::Type::getDoubleTy(llvm::getGlobalContext())};
-			auto fn_type = llvm::FunctionType::get(llvm::Type::getDoubleTy(llvm::getGlobalContext()),
-			                                       args_type, false);
-			builtin = llvm::Function::Create(fn_type, llvm::Function::ExternalLinkage,
-			                                 "calcfn_" + label_, &main);
+			value = checked_arithmetic(main, builder, llvm::Intrinsic::smul_with_overflow, value,
+			                           params_[1]->codegen_integer(main, builder), "mul");
 		}
-		return builder.CreateCall(builtin, fn_args, "calcfn_" + label_);
+		sum = checked_arithmetic(main, builder, llvm::Intrinsic::sadd_with_overflow, builder.CreateLoad(acc), value,
+		                         "sum");
+	}
+	else
+	{
+		auto value = params_[0]->codegen(main, builder);
+		if (label_ == "dot")
+			value = builder.CreateFMul(value, params_[1]->codegen(main, builder), "mul");
+		sum = builder.CreateFAdd(builder.CreateLoad(acc), value, "sum");
+		llvm::cast<llvm::Instruction>(sum)->setFastMathFlags(fast_math);
+	}
+	builder.CreateStore(sum, acc);
+	loop.end();
+
+	auto res = builder.CreateLoad(acc, label_);
+	if (label_ == "mean")
+	{
+		auto double_type = llvm::Type::getDoubleTy(ctx);
+		return builder.CreateFDiv(convert_number(builder, res, double_type), builder.CreateUIToFP(n, double_type),
+		                          "mean");
 	}
-	fn->param_values = std::move(fn_args);
-	return fn->body->codegen(main, builder);
+	return res;
 }
 
-void NumberTree::print(std::ostream& os)
+bool FunctionCallTree::is_reduction_() const
 {
-	os << number_;
+	auto fun_it = funs_.find(label_);
+	return fun_it != std::end(funs_) && fun_it->second->type == FunctionType::reduction;
 }
 
-void IdentifierTree::print(std::ostream& os)
+ArrayLiteralTree::~ArrayLiteralTree()
 {
-	os << label_;
+	destroy_children_();
 }
 
-void UnaryExprTree::print(std::ostream& os)
+void ArrayLiteralTree::prepare_array(ArrayLoop& loop, llvm::Module& main, llvm::IRBuilder<>& builder)
 {
-	os << op_;
-	if (st_->type != TreeType::number && st_->type != TreeType::identifier)
-		os << '(';
-	st_->print(os);
-	if (st_->type != TreeType::number && st_->type != TreeType::identifier)
-		os << ')';
+	auto elements = loop.entry_alloca(loop.element_type(), elements_.size());
+	for (std::size_t i{0} ; i != elements_.size() ; ++i)
+	{
+		if (is_array_(*elements_[i]))
+			throw InvalidInput{"Nested arrays are not supported"};
+		auto ptr = builder.CreateConstGEP1_64(elements, i);
+		builder.CreateStore(convert_number(builder, elements_[i]->codegen(main, builder), loop.element_type()), ptr);
+	}
+	loop.add_leaf(*this, elements);
+	loop.add_length(llvm::ConstantInt::get(llvm::Type::getInt64Ty(jit_context()), elements_.size()));
+}
+
+ExprNode* ArrayLiteralTree::child_(std::size_t index)
+{
+	return index < elements_.size() && elements_[index] ? &elements_[index] : nullptr;
+}
+
+void ArrayLiteralTree::print_(std::ostream& os, std::size_t part)
+{
+	if (part == 0)
+		os << '[';
+	else if (part != elements_.size())
+		os << ", ";
+	if (part == elements_.size())
+		os << ']';
+}
+
+bool ArrayLiteralTree::node_is_array_() const
+{
+	return true;
+}
+
+llvm::Value* ArrayLiteralTree::codegen_(llvm::Module&, llvm::IRBuilder<>& builder, llvm::Value* const*)
+{
+	auto& loop = array_loop("Array");
+	return builder.CreateLoad(builder.CreateGEP(loop.leaf(*this), loop.index()), "elem");
+}
+
+RangeTree::~RangeTree()
+{
+	destroy_children_();
 }
 
-void BinaryExprTree::print(std::ostream& os)
+void RangeTree::prepare_array(ArrayLoop& loop, llvm::Module& main, llvm::IRBuilder<>& builder)
 {
-	if (lhs_->type == TreeType::binary_op
-	    && operator_precedence(static_cast<BinaryExprTree*>(lhs_.get())->op_) < operator_precedence(op_))
+	auto& ctx = jit_context();
+	for (auto elem : {first_.get(), last_.get(), step_.get()})
 	{
-		os << '(';
-		lhs_->print(os);
-		os << ')';
+		if (elem && is_array_(*elem))
+			throw InvalidInput{"Range bounds must be numbers"};
 	}
+	auto double_type = llvm::Type::getDoubleTy(ctx);
+	auto first = convert_number(builder, real_value(loop.hoist(*first_)), double_type);
+	auto count = builder.CreateFSub(convert_number(builder, real_value(loop.hoist(*last_)), double_type), first);
+	if (step_)
+		count = builder.CreateFDiv(count, convert_number(builder, real_value(loop.hoist(*step_)), double_type));
+	auto floor = llvm::Intrinsic::getDeclaration(&main, llvm::Intrinsic::floor, {double_type});
+	count = builder.CreateCall(floor, {count});
+	count = builder.CreateFAdd(count, llvm::ConstantFP::get(ctx, llvm::APFloat{1.0}));
+	// Empty, reversed and non finite ranges have no elements.
+	auto valid = builder.CreateAnd(builder.CreateFCmpOGE(count, llvm::ConstantFP::get(ctx, llvm::APFloat{1.0})),
+	                               builder.CreateFCmpOLT(count, llvm::ConstantFP::get(ctx, llvm::APFloat{1e18})));
+	auto length = builder.CreateSelect(valid, builder.CreateFPToUI(count, llvm::Type::getInt64Ty(ctx)),
+	                                   llvm::ConstantInt::get(llvm::Type::getInt64Ty(ctx), 0), "range.len");
+	loop.add_length(length);
+}
+
+ExprNode* RangeTree::child_(std::size_t index)
+{
+	auto child = index == 0 ? &first_ : index == 1 ? &last_ : index == 2 ? &step_ : nullptr;
+	return child && *child ? child : nullptr;
+}
+
+void RangeTree::print_(std::ostream& os, std::size_t part)
+{
+	if (part == 0)
+		os << '[';
+	else if (part == 1 || (part == 2 && step_))
+		os << " : ";
+	else
+		os << ']';
+}
+
+bool RangeTree::node_is_array_() const
+{
+	return true;
+}
+
+NumericType RangeTree::node_numeric_type_() const
+{
+	if (numeric_type_of_(*first_) != NumericType::integer ||
+	    (step_ && numeric_type_of_(*step_) != NumericType::integer))
+		return NumericType::real;
+	return NumericType::integer;
+}
+
+// The step is used before the first element.
+ExprTree* RangeTree::operand_(std::size_t index, bool)
+{
+	if (step_)
+		return index == 0 ? step_.get() : index == 1 ? first_.get() : nullptr;
+	return index == 0 ? first_.get() : nullptr;
+}
+
+llvm::Value* RangeTree::codegen_(llvm::Module&, llvm::IRBuilder<>& builder, llvm::Value* const* operands)
+{
+	auto& loop = array_loop("Range");
+	auto offset = builder.CreateUIToFP(loop.index(), real_type());
+	if (step_)
+		offset = builder.CreateFMul(offset, operands[0]);
+	return builder.CreateFAdd(operands[step_ ? 1 : 0], offset, "range");
+}
+
+llvm::Value* RangeTree::codegen_integer_(llvm::Module& main, llvm::IRBuilder<>& builder,
+                                         llvm::Value* const* operands)
+{
+	auto& loop = array_loop("Range");
+	llvm::Value* offset = loop.index();
+	if (step_)
+		offset = checked_arithmetic(main, builder, llvm::Intrinsic::smul_with_overflow, offset, operands[0], "offset");
+	return checked_arithmetic(main, builder, llvm::Intrinsic::sadd_with_overflow, operands[step_ ? 1 : 0], offset,
+	                          "range");
+}
+
+LetTree::~LetTree()
+{
+	destroy_children_();
+}
+
+std::string const& LetTree::name() const
+{
+	return name_;
+}
+
+void LetTree::set_body(ExprNode body)
+{
+	assert(!body_);
+	body_ = std::move(body);
+}
+
+// Scalar values are computed before the loop, so that the scalar subtrees of the body using them can
+// be hoisted too.
+void LetTree::prepare_array(ArrayLoop& loop, llvm::Module&, llvm::IRBuilder<>&)
+{
+	loop_ = &loop;
+	if (is_array_(*value_))
+		loop.prepare(*value_);
 	else
-		lhs_->print(os);
-	if (op_ == '^')
-		os << '^';
+		code_ = loop.hoist(*value_);
+	loop.prepare(*body_);
+}
+
+ExprNode* LetTree::child_(std::size_t index)
+{
+	auto child = index == 0 ? &value_ : index == 1 ? &body_ : nullptr;
+	return child && *child ? child : nullptr;
+}
+
+void LetTree::print_(std::ostream& os, std::size_t part)
+{
+	if (part == 0)
+		os << "let " << name_ << " = ";
+	else if (part == 1)
+		os << " in ";
+}
+
+bool LetTree::node_is_array_() const
+{
+	return is_array_(*body_);
+}
+
+NumericType LetTree::node_numeric_type_() const
+{
+	if (computes_value_() && numeric_type_of_(*value_) != NumericType::integer)
+		return NumericType::real;
+	return numeric_type_of_(*body_);
+}
+
+ExprTree* LetTree::operand_(std::size_t index, bool)
+{
+	if (!computes_value_())
+		++index;
+	return index == 0 ? value_.get() : index == 1 ? body_.get() : nullptr;
+}
+
+void LetTree::operand_generated_(std::size_t index, CheckedValue const& value)
+{
+	if (index == 0 && computes_value_())
+		code_ = value;
+}
+
+llvm::Value* LetTree::codegen_(llvm::Module&, llvm::IRBuilder<>&, llvm::Value* const* operands)
+{
+	return operands[computes_value_() ? 1 : 0];
+}
+
+llvm::Value* LetTree::codegen_integer_(llvm::Module&, llvm::IRBuilder<>&, llvm::Value* const* operands)
+{
+	return operands[computes_value_() ? 1 : 0];
+}
+
+bool LetTree::computes_value_() const
+{
+	return !is_array_(*value_) || is_array_(*this);
+}
+
+void LocalTree::prepare_array(ArrayLoop& loop, llvm::Module&, llvm::IRBuilder<>&)
+{
+	if (substituted_())
+		loop.prepare(*let_->value_);
+}
+
+void LocalTree::print_(std::ostream& os, std::size_t)
+{
+	os << label_;
+}
+
+bool LocalTree::node_is_array_() const
+{
+	return is_array_(*let_->value_);
+}
+
+NumericType LocalTree::node_numeric_type_() const
+{
+	return numeric_type_of_(*let_->value_);
+}
+
+ExprTree* LocalTree::operand_(std::size_t index, bool)
+{
+	return index == 0 && substituted_() ? let_->value_.get() : nullptr;
+}
+
+llvm::Value* LocalTree::codegen_(llvm::Module&, llvm::IRBuilder<>& builder, llvm::Value* const* operands)
+{
+	if (substituted_())
+		return operands[0];
+	assert(let_->code_.value);
+	return convert_number(builder, real_value(let_->code_), real_type());
+}
+
+// The uses of an integer value which overflowed overflow too.
+llvm::Value* LocalTree::codegen_integer_(llvm::Module&, llvm::IRBuilder<>& builder, llvm::Value* const* operands)
+{
+	if (substituted_())
+		return operands[0];
+	assert(let_->code_.value && let_->code_.value->getType()->isIntegerTy());
+	note_overflow(builder, let_->code_.overflow);
+	return let_->code_.value;
+}
+
+bool LocalTree::substituted_() const
+{
+	return is_array_(*this) && (!is_array_(*let_) || ArrayLoop::current() != let_->loop_);
+}
+
+ConditionTree::~ConditionTree()
+{
+	destroy_children_();
+}
+
+void ConditionTree::prepare_array(ArrayLoop& loop, llvm::Module&, llvm::IRBuilder<>&)
+{
+	loop.prepare(*condition_);
+	loop.prepare(*then_);
+	loop.prepare(*else_);
+}
+
+ExprNode* ConditionTree::child_(std::size_t index)
+{
+	auto child = index == 0 ? &condition_ : index == 1 ? &then_ : index == 2 ? &else_ : nullptr;
+	return child && *child ? child : nullptr;
+}
+
+void ConditionTree::print_(std::ostream& os, std::size_t part)
+{
+	if (part == 0)
+		os << "if(";
+	else if (part != 3)
+		os << ", ";
 	else
-		os << ' ' << op_ << ' ';
-	if (rhs_->type == TreeType::binary_op &&
-	    operator_precedence(static_cast<BinaryExprTree*>(rhs_.get())->op_) <= operator_precedence(op_))
-	{
-		os << '(';
-		rhs_->print(os);
 		os << ')';
-	}
+}
+
+bool ConditionTree::node_is_array_() const
+{
+	return is_array_(*condition_) || is_array_(*then_) || is_array_(*else_);
+}
+
+NumericType ConditionTree::node_numeric_type_() const
+{
+	if (is_integer_(*condition_) && is_integer_(*then_) && is_integer_(*else_))
+		return NumericType::integer;
+	return NumericType::real;
+}
+
+ExprTree* ConditionTree::operand_(std::size_t index, bool)
+{
+	if (!selected_())
+		return index == 0 ? condition_.get() : nullptr;
+	return index == 0 ? condition_.get() : index == 1 ? then_.get() : index == 2 ? else_.get() : nullptr;
+}
+
+llvm::Value* ConditionTree::codegen_(llvm::Module& main, llvm::IRBuilder<>& builder, llvm::Value* const* operands)
+{
+	if (selected_())
+		return builder.CreateSelect(codegen_truth(builder, operands[0]), operands[1], operands[2], "if");
+	return codegen_branches_(main, builder, operands[0], false);
+}
+
+llvm::Value* ConditionTree::codegen_integer_(llvm::Module& main, llvm::IRBuilder<>& builder,
+                                             llvm::Value* const* operands)
+{
+	if (selected_())
+		return builder.CreateSelect(codegen_truth(builder, operands[0]), operands[1], operands[2], "if");
+	return codegen_branches_(main, builder, operands[0], true);
+}
+
+bool ConditionTree::selected_() const
+{
+	return is_array_(*this) || (is_speculatable_(*then_) && is_speculatable_(*else_));
+}
+
+llvm::Value* ConditionTree::codegen_branches_(llvm::Module& main, llvm::IRBuilder<>& builder, llvm::Value* condition,
+                                              bool integer)
+{
+	auto& ctx = jit_context();
+	auto fn = builder.GetInsertBlock()->getParent();
+	auto then_block = llvm::BasicBlock::Create(ctx, "then", fn);
+	auto else_block = llvm::BasicBlock::Create(ctx, "else", fn);
+	auto end_block = llvm::BasicBlock::Create(ctx, "if.end", fn);
+	builder.CreateCondBr(codegen_truth(builder, condition), then_block, else_block);
+
+	builder.SetInsertPoint(then_block);
+	auto then_value = generate_of_(*then_, main, builder, integer);
+	auto then_end = builder.GetInsertBlock();
+	builder.CreateBr(end_block);
+
+	builder.SetInsertPoint(else_block);
+	auto else_value = generate_of_(*else_, main, builder, integer);
+	auto else_end = builder.GetInsertBlock();
+	builder.CreateBr(end_block);
+
+	builder.SetInsertPoint(end_block);
+	auto res = builder.CreatePHI(then_value->getType(), 2, "if");
+	res->addIncoming(then_value, then_end);
+	res->addIncoming(else_value, else_end);
+	return res;
+}
+
+WhileTree::~WhileTree()
+{
+	destroy_children_();
+}
+
+ExprNode* WhileTree::child_(std::size_t index)
+{
+	auto child = index == 0 ? &condition_ : index == 1 ? &body_ : nullptr;
+	return child && *child ? child : nullptr;
+}
+
+void WhileTree::print_(std::ostream& os, std::size_t part)
+{
+	if (part == 0)
+		os << "while(";
+	else if (part == 1)
+		os << ", ";
 	else
-		rhs_->print(os);
+		os << ')';
 }
 
-void AssignmentTree::print(std::ostream& os)
+llvm::Value* WhileTree::codegen_(llvm::Module& main, llvm::IRBuilder<>& builder, llvm::Value* const*)
 {
-	lhs_->print(os);
-	os << " = ";
-	rhs_->print(os);
+	if (is_array_(*condition_) || is_array_(*body_))
+		throw InvalidInput{"Loops cannot be computed on arrays"};
+	return codegen_loop(main, builder, [&](llvm::Value*)
+	{
+		return codegen_truth(builder, generate_of_(*condition_, main, builder, false));
+	}, [&](llvm::Value*)
+	{
+		return generate_of_(*body_, main, builder, false);
+	});
 }
 
-void FunctionParamTree::print(std::ostream& os)
+ForTree::~ForTree()
 {
-	os << label_;
+	destroy_children_();
 }
 
-void FunctionCallTree::print(std::ostream& os)
+ExprNode* ForTree::child_(std::size_t index)
 {
-	os << label_;
-	os << '(';
-	for (auto it = std::begin(params_) ; it != std::end(params_) ; ++it)
+	ExprNode* children[] = {&variable_, &first_, &last_, &body_};
+	return index < 4 && *children[index] ? children[index] : nullptr;
+}
+
+std::string const* ForTree::assigned_variable_() const
+{
+	return &static_cast<IdentifierTree const&>(*variable_).label_;
+}
+
+void ForTree::print_(std::ostream& os, std::size_t part)
+{
+	if (part == 0)
+		os << "for(";
+	else if (part != 4)
+		os << ", ";
+	else
+		os << ')';
+}
+
+ExprTree* ForTree::operand_(std::size_t index, bool)
+{
+	return index == 0 ? first_.get() : index == 1 ? last_.get() : nullptr;
+}
+
+// The variable is first plus the number of the iteration, so that rounding errors do not accumulate.
+llvm::Value* ForTree::codegen_(llvm::Module& main, llvm::IRBuilder<>& builder, llvm::Value* const* operands)
+{
+	if (is_array_(*first_) || is_array_(*last_) || is_array_(*body_))
+		throw InvalidInput{"Loops cannot be computed on arrays"};
+	auto first = operands[0];
+	auto last = operands[1];
+	llvm::Value* variable{nullptr};
+	return codegen_loop(main, builder, [&](llvm::Value* count)
 	{
-		(*it)->print(os);
-		if (it != std::end(params_) - 1)
-			os << ", ";
-	}
-	os << ')';
+		variable = builder.CreateFAdd(first, builder.CreateUIToFP(count, first->getType()), "i");
+		return builder.CreateFCmpOLE(variable, last, "test");
+	}, [&](llvm::Value*)
+	{
+		static_cast<IdentifierTree&>(*variable_).store_(main, builder, variable);
+		return generate_of_(*body_, main, builder, false);
+	});
 }
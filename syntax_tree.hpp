@@ -3,25 +3,78 @@
 #ifndef CALC_SYNTAX_TREE_HPP_
 #define CALC_SYNTAX_TREE_HPP_
 
+#include <atomic>
+#include <cassert>
+#include <cstdint>
 #include <limits>
+#include <map>
+#include <memory>
+#include <set>
+#include <string>
 #include <vector>
 
 #include <llvm/IR/Module.h>
 #include <llvm/IR/IRBuilder.h>
 #include <llvm/IR/Intrinsics.h>
+#include <llvm/ExecutionEngine/ExecutionEngine.h>
 
+#include "arrays.hpp"
 #include "utility.hpp"
 
+class ArrayLoop;
+class DependencyGraph;
+struct Array;
+
 class ExprTree;
 using ExprNode = std::unique_ptr<ExprTree>;
 
+// Everything is computed in double precision by default. In int64 mode, expressions proven to hold
+// integers are computed with integer instructions. In float32 mode, array elements are stored and
+// computed in single precision, which doubles the width of vector instructions.
+enum class NumericMode
+{
+	float64,
+	int64,
+	float32
+};
+
+NumericMode numeric_mode();
+void set_numeric_mode(NumericMode);
+
+// In exact mode, expressions are only rewritten when their results do not change: x^0, x^1, x^2,
+// x^-1 and x^0.5 do not call pow, and divisions by powers of two are multiplications. In fast mode,
+// exponentiations by other small integers are multiplication chains, divisions by constants are
+// multiplications by their inverse and sums of monomials of a variable are evaluated in Horner form,
+// which can change the last digits of the results.
+enum class AlgebraMode
+{
+	exact,
+	fast
+};
+
+AlgebraMode algebra_mode();
+void set_algebra_mode(AlgebraMode);
+
+enum class NumericType
+{
+	integer,
+	real
+};
+
 enum class FunctionType
 {
 	intrinsic,
 	builtin,
-	userdef
+	reduction,
+	userdef,
+	columnar
 };
 
+// The parameters of columnar functions are columns, and param_values holds the column pointers.
+// Compiled user functions can be evicted to save memory, unless their address was given to the
+// user of the library (pinned). Functions compiled outside of the global context own their context,
+// which must outlive the engine. Callers compiled in parallel update the last use of their callees.
+// The version changes each time the code of the function is discarded.
 struct Function
 {
 	ExprNode body;
@@ -29,6 +82,13 @@ struct Function
 	std::vector<llvm::Value*> param_values;
 	llvm::Intrinsic::ID intrinsic;
 	FunctionType type;
+	std::shared_ptr<llvm::LLVMContext> context;
+	std::unique_ptr<llvm::ExecutionEngine> engine;
+	std::uint64_t address;
+	std::size_t code_size;
+	std::atomic<std::uint64_t> last_use;
+	bool pinned;
+	std::uint64_t version;
 };
 	
 enum class TreeType
@@ -39,22 +99,122 @@ enum class TreeType
 	binary_op,
 	assignment,
 	function_param,
-	function_call
+	function_call,
+	array_literal,
+	range,
+	let,
+	local,
+	condition,
+	while_loop,
+	for_loop
+};
+
+// Live syntax tree nodes of all the sessions. Only the nodes themselves are counted, not the strings
+// and vectors they own.
+struct TreeMemory
+{
+	std::size_t nodes;
+	std::size_t bytes;
 };
 
+TreeMemory tree_memory();
+
+// Sums of monomials c * x^n of a single variable x. The degree is -1 for other expressions, and the
+// variable is null for constant expressions.
+struct PolynomialShape
+{
+	ExprTree* variable;
+	std::string const* label;
+	int degree;
+	bool monomial;
+};
+
+// Trees are traversed with explicit stacks instead of recursion, so that their depth is only limited
+// by memory.
 class ExprTree
 {
+	friend class ArrayLoop;
 	public:
-	ExprTree(TreeType t) : type{t}
+	ExprTree(TreeType t) : type{t}, array_{false}, numeric_type_{NumericType::real}
 	{}
 
 	virtual ~ExprTree() = default;
 
-	virtual llvm::Value* codegen(llvm::Module&, llvm::IRBuilder<>&) = 0;
+	static void* operator new(std::size_t);
+	static void operator delete(void*, std::size_t);
+
+	llvm::Value* codegen(llvm::Module&, llvm::IRBuilder<>&);
+	llvm::Value* codegen_integer(llvm::Module&, llvm::IRBuilder<>&);
+	// Generates an integer tree, and the code computing it again with reals if it overflows.
+	CheckedValue codegen_checked(llvm::Module&, llvm::IRBuilder<>&);
+
+	void print(std::ostream&);
 
-	virtual void print(std::ostream&) = 0;
+	// Array expressions are compiled as a single loop over their elements. Before the loop,
+	// prepare_array hoists the scalar subtrees and registers the length of the array leaves.
+	bool is_array();
+	virtual void prepare_array(ArrayLoop&, llvm::Module&, llvm::IRBuilder<>&);
+
+	// Compiling an assignment may declare its variable in the environment.
+	bool has_assignments();
+	// Adds the variables assigned by the tree, and the variables of its loops, to the set.
+	void add_assigned_variables(std::set<std::string>&);
 
 	TreeType const type;
+
+	protected:
+	// Nodes with children call it in their destructor, so that the children are destroyed one after
+	// the other instead of recursively.
+	void destroy_children_();
+
+	// Properties of the nodes computed for the whole tree before code generation.
+	static bool is_array_(ExprTree const&);
+	static NumericType numeric_type_of_(ExprTree const&);
+	static bool is_integer_(ExprTree const&);
+	static PolynomialShape shape_of_(ExprTree const&);
+	// The coefficients of a polynomial, by increasing degree.
+	static std::vector<double> coefficients_of_(ExprTree&);
+	// Numbers and negated numbers.
+	static bool literal_of_(ExprTree&, double&);
+	// Small expressions without side effects, which can be computed even if their value is not used.
+	static bool is_speculatable_(ExprTree&);
+	// Generates a subtree, analyzed with the whole tree, at the current position of the builder.
+	static llvm::Value* generate_of_(ExprTree&, llvm::Module&, llvm::IRBuilder<>&, bool integer);
+
+	private:
+	void analyze_();
+	llvm::Value* generate_(llvm::Module&, llvm::IRBuilder<>&, bool);
+	// Ends the integer subtree started with the given outer overflow flag.
+	CheckedValue check_overflow_(llvm::Module&, llvm::IRBuilder<>&, llvm::Value*, llvm::Value* outer_overflow);
+
+	// Returns the children in printing order, then nullptr.
+	virtual ExprNode* child_(std::size_t);
+	// Returns the variable assigned by the node, or nullptr.
+	virtual std::string const* assigned_variable_() const;
+	// Prints the part of the node before the given child, or after the last child.
+	virtual void print_(std::ostream&, std::size_t) = 0;
+
+	// Compute the properties of the node from the properties of its children.
+	virtual bool node_is_array_() const;
+	// Integer expressions are built from integer literals and ranges with +, -, *, % by a constant
+	// and ^ by a small constant. Their values are exact as long as they fit in 64 bits.
+	virtual NumericType node_numeric_type_() const;
+	// Nodes combining polynomials store their shape, the others compute it.
+	virtual void analyze_shape_();
+	virtual PolynomialShape shape_() const;
+	// Replaces the coefficients of the operands of the node on the stack with its own.
+	virtual void push_coefficients_(std::vector<std::vector<double>>&) const;
+
+	// Returns the subtrees whose values are needed by codegen_ or codegen_integer_, in evaluation
+	// order, then nullptr. They are generated before the node and their values are given to it.
+	virtual ExprTree* operand_(std::size_t, bool integer);
+	// Receives the value of each operand once generated, before the conversion of integer values.
+	virtual void operand_generated_(std::size_t, CheckedValue const&);
+	virtual llvm::Value* codegen_(llvm::Module&, llvm::IRBuilder<>&, llvm::Value* const*) = 0;
+	virtual llvm::Value* codegen_integer_(llvm::Module&, llvm::IRBuilder<>&, llvm::Value* const*);
+
+	bool array_;
+	NumericType numeric_type_;
 };
 
 class NumberTree : public ExprTree
@@ -63,47 +223,78 @@ class NumberTree : public ExprTree
 	NumberTree(double number) : ExprTree{TreeType::number}, number_{number}
 	{}
 
-	llvm::Value* codegen(llvm::Module&, llvm::IRBuilder<>&) override;
-
-	void print(std::ostream&) override;
+	double number() const;
 
 	private:
+	void print_(std::ostream&, std::size_t) override;
+	NumericType node_numeric_type_() const override;
+	PolynomialShape shape_() const override;
+	void push_coefficients_(std::vector<std::vector<double>>&) const override;
+	llvm::Value* codegen_(llvm::Module&, llvm::IRBuilder<>&, llvm::Value* const*) override;
+	llvm::Value* codegen_integer_(llvm::Module&, llvm::IRBuilder<>&, llvm::Value* const*) override;
+
 	double number_;
 };
 
 class IdentifierTree : public ExprTree
 {
 	friend class AssignmentTree;
+	friend class ForTree;
 	public:
 	IdentifierTree(std::string label, std::map<std::string, double>& vars,
-	               std::map<std::string, Function*>& funs)
-		: ExprTree{TreeType::identifier}, label_{std::move(label)}, vars_{vars}, funs_{funs}
+	               std::map<std::string, Function*>& funs, std::map<std::string, Array>& arrays,
+	               DependencyGraph& deps)
+		: ExprTree{TreeType::identifier}, label_{std::move(label)}, vars_{vars}, funs_{funs}, arrays_{arrays},
+		  deps_{deps}
 	{}
 
-	llvm::Value* codegen(llvm::Module&, llvm::IRBuilder<>&) override;
-
-	void print(std::ostream&) override;
+	void prepare_array(ArrayLoop&, llvm::Module&, llvm::IRBuilder<>&) override;
 
 	private:
+	void print_(std::ostream&, std::size_t) override;
+	bool node_is_array_() const override;
+	PolynomialShape shape_() const override;
+	void push_coefficients_(std::vector<std::vector<double>>&) const override;
+	llvm::Value* codegen_(llvm::Module&, llvm::IRBuilder<>&, llvm::Value* const*) override;
+
+	// Declares the variable if needed.
+	void store_(llvm::Module&, llvm::IRBuilder<>&, llvm::Value*);
+
 	std::string label_;
 	std::map<std::string, double>& vars_;
 	std::map<std::string, Function*>& funs_;
+	std::map<std::string, Array>& arrays_;
+	DependencyGraph& deps_;
 };
 
 class UnaryExprTree : public ExprTree
 {
 	public:
 	UnaryExprTree(char op, ExprNode st)
-		: ExprTree{TreeType::unary_op}, op_{op}, st_{std::move(st)}
+		: ExprTree{TreeType::unary_op}, op_{op}, st_{std::move(st)}, polynomial_{nullptr, nullptr, -1, false}
 	{}
 
-	llvm::Value* codegen(llvm::Module&, llvm::IRBuilder<>&) override;
+	~UnaryExprTree() override;
 
-	void print(std::ostream&) override;
+	void prepare_array(ArrayLoop&, llvm::Module&, llvm::IRBuilder<>&) override;
 
 	private:
+	ExprNode* child_(std::size_t) override;
+	void print_(std::ostream&, std::size_t) override;
+	bool node_is_array_() const override;
+	NumericType node_numeric_type_() const override;
+	void analyze_shape_() override;
+	PolynomialShape shape_() const override;
+	void push_coefficients_(std::vector<std::vector<double>>&) const override;
+	ExprTree* operand_(std::size_t, bool) override;
+	llvm::Value* codegen_(llvm::Module&, llvm::IRBuilder<>&, llvm::Value* const*) override;
+	llvm::Value* codegen_integer_(llvm::Module&, llvm::IRBuilder<>&, llvm::Value* const*) override;
+
+	bool parenthesized_() const;
+
 	char op_;
 	ExprNode st_;
+	PolynomialShape polynomial_;
 };
 
 class BinaryExprTree : public ExprTree
@@ -111,34 +302,61 @@ class BinaryExprTree : public ExprTree
 	public:
 
 	BinaryExprTree(char op, ExprNode lhs, ExprNode rhs)
-		: ExprTree{TreeType::binary_op}, lhs_{std::move(lhs)}, rhs_{std::move(rhs)}, op_{op}
+		: ExprTree{TreeType::binary_op}, lhs_{std::move(lhs)}, rhs_{std::move(rhs)}, op_{op},
+		  polynomial_{nullptr, nullptr, -1, false}, horner_{false}
 	{}
 
-	llvm::Value* codegen(llvm::Module&, llvm::IRBuilder<>&) override;
+	~BinaryExprTree() override;
 
-	void print(std::ostream&) override;
+	void prepare_array(ArrayLoop&, llvm::Module&, llvm::IRBuilder<>&) override;
 
 	private:
+	ExprNode* child_(std::size_t) override;
+	void print_(std::ostream&, std::size_t) override;
+	bool node_is_array_() const override;
+	NumericType node_numeric_type_() const override;
+	void analyze_shape_() override;
+	PolynomialShape shape_() const override;
+	void push_coefficients_(std::vector<std::vector<double>>&) const override;
+	ExprTree* operand_(std::size_t, bool) override;
+	llvm::Value* codegen_(llvm::Module&, llvm::IRBuilder<>&, llvm::Value* const*) override;
+	llvm::Value* codegen_integer_(llvm::Module&, llvm::IRBuilder<>&, llvm::Value* const*) override;
+
+	bool parenthesized_(std::size_t) const;
+	// Returns nullptr if the right operand is not a constant that can be rewritten.
+	llvm::Value* codegen_power_(llvm::Module&, llvm::IRBuilder<>&, llvm::Value*);
+	llvm::Value* codegen_division_(llvm::IRBuilder<>&, llvm::Value*);
+
 	ExprNode lhs_;
 	ExprNode rhs_;
 	char op_;
+	PolynomialShape polynomial_;
+	// The sum is evaluated in Horner form, from the value of its variable.
+	bool horner_;
 };
 
 class AssignmentTree : public ExprTree
 {
 	public:
+	// The parser checks that the expression is assignable.
 	AssignmentTree(ExprNode lhs, ExprNode rhs)
 		: ExprTree{TreeType::assignment}, lhs_{std::move(lhs)}, rhs_{std::move(rhs)}
 	{
-		if (lhs_->type != TreeType::identifier)
-			throw InvalidInput{"Expression is not assignable"};
+		assert(lhs_->type == TreeType::identifier);
 	}
 
-	llvm::Value* codegen(llvm::Module&, llvm::IRBuilder<>&) override;
+	~AssignmentTree() override;
 
-	void print(std::ostream&) override;
+	void prepare_array(ArrayLoop&, llvm::Module&, llvm::IRBuilder<>&) override;
 
 	private:
+	ExprNode* child_(std::size_t) override;
+	std::string const* assigned_variable_() const override;
+	void print_(std::ostream&, std::size_t) override;
+	bool node_is_array_() const override;
+	ExprTree* operand_(std::size_t, bool) override;
+	llvm::Value* codegen_(llvm::Module&, llvm::IRBuilder<>&, llvm::Value* const*) override;
+
 	ExprNode lhs_;
 	ExprNode rhs_;
 };
@@ -152,11 +370,17 @@ class FunctionParamTree : public ExprTree
 		assert(function_);
 	}
 
-	llvm::Value* codegen(llvm::Module&, llvm::IRBuilder<>&) override;
-
-	void print(std::ostream&) override;
+	void prepare_array(ArrayLoop&, llvm::Module&, llvm::IRBuilder<>&) override;
 
 	private:
+	void print_(std::ostream&, std::size_t) override;
+	bool node_is_array_() const override;
+	PolynomialShape shape_() const override;
+	void push_coefficients_(std::vector<std::vector<double>>&) const override;
+	llvm::Value* codegen_(llvm::Module&, llvm::IRBuilder<>&, llvm::Value* const*) override;
+
+	std::size_t index_() const;
+
 	std::string label_;
 	Function* function_;
 };
@@ -164,39 +388,220 @@ class FunctionParamTree : public ExprTree
 class FunctionCallTree : public ExprTree
 {
 	public:
-	FunctionCallTree(std::string label, std::vector<ExprNode>&& params,
-	                 std::map<std::string, Function*>& funs, std::map<std::string, double> const& vars)
+	// The parser checks that the function exists and takes the given number of arguments.
+	FunctionCallTree(std::string label, std::vector<ExprNode>&& params, std::map<std::string, Function*>& funs)
 		: ExprTree{TreeType::function_call}, label_{label}, params_{std::move(params)}, funs_{funs}
-	{
-		using namespace std::string_literals;
-
-		auto it = funs_.find(label_);
-		if(it == std::end(funs_))
-		{
-			auto err = ""s;
-			if (vars.find(label_) != std::end(vars))
-				err = ". Maybe you meant to use the variable?";
-			throw InvalidInput{"Undeclared function : " + label_ + err};
-		}
-		if (it->second->param_names.size() != params_.size())
-		{
-			auto err = "Too "s + (it->second->param_names.size() < params_.size() ? "many" : "few") +
-			           " arguments in call to function " + label_ + ". Function takes " +
-			           std::to_string(it->second->param_names.size()) + " argument";
-			if (it->second->param_names.size() != 1)
-				err += 's';
-			throw InvalidInput{err};
-		}
-	}
+	{}
 
-	llvm::Value* codegen(llvm::Module&, llvm::IRBuilder<>&) override;
+	~FunctionCallTree() override;
 
-	void print(std::ostream&) override;
+	void prepare_array(ArrayLoop&, llvm::Module&, llvm::IRBuilder<>&) override;
 
 	private:
+	ExprNode* child_(std::size_t) override;
+	void print_(std::ostream&, std::size_t) override;
+	bool node_is_array_() const override;
+	NumericType node_numeric_type_() const override;
+	ExprTree* operand_(std::size_t, bool) override;
+	llvm::Value* codegen_(llvm::Module&, llvm::IRBuilder<>&, llvm::Value* const*) override;
+	llvm::Value* codegen_integer_(llvm::Module&, llvm::IRBuilder<>&, llvm::Value* const*) override;
+
+	llvm::Value* codegen_reduction_(llvm::Module&, llvm::IRBuilder<>&);
+	bool is_reduction_() const;
+
 	std::string label_;
 	std::vector<ExprNode> params_;
 	std::map<std::string, Function*>& funs_;
 };
 
+class ArrayLiteralTree : public ExprTree
+{
+	public:
+	ArrayLiteralTree(std::vector<ExprNode>&& elements)
+		: ExprTree{TreeType::array_literal}, elements_{std::move(elements)}
+	{}
+
+	~ArrayLiteralTree() override;
+
+	void prepare_array(ArrayLoop&, llvm::Module&, llvm::IRBuilder<>&) override;
+
+	private:
+	ExprNode* child_(std::size_t) override;
+	void print_(std::ostream&, std::size_t) override;
+	bool node_is_array_() const override;
+	llvm::Value* codegen_(llvm::Module&, llvm::IRBuilder<>&, llvm::Value* const*) override;
+
+	std::vector<ExprNode> elements_;
+};
+
+class RangeTree : public ExprTree
+{
+	public:
+	RangeTree(ExprNode first, ExprNode last, ExprNode step)
+		: ExprTree{TreeType::range}, first_{std::move(first)}, last_{std::move(last)}, step_{std::move(step)}
+	{}
+
+	~RangeTree() override;
+
+	void prepare_array(ArrayLoop&, llvm::Module&, llvm::IRBuilder<>&) override;
+
+	private:
+	ExprNode* child_(std::size_t) override;
+	void print_(std::ostream&, std::size_t) override;
+	bool node_is_array_() const override;
+	NumericType node_numeric_type_() const override;
+	ExprTree* operand_(std::size_t, bool) override;
+	llvm::Value* codegen_(llvm::Module&, llvm::IRBuilder<>&, llvm::Value* const*) override;
+	llvm::Value* codegen_integer_(llvm::Module&, llvm::IRBuilder<>&, llvm::Value* const*) override;
+
+	ExprNode first_;
+	ExprNode last_;
+	ExprNode step_;
+};
+
+// let name = value in body. The value is computed once, and the references to the name in the body
+// use it. Array values are computed once per element in the loop of the let, and recomputed in the
+// loops of the reductions using them.
+class LetTree : public ExprTree
+{
+	friend class LocalTree;
+	public:
+	LetTree(std::string name, ExprNode value)
+		: ExprTree{TreeType::let}, name_{std::move(name)}, value_{std::move(value)}, body_{},
+		  code_{nullptr, nullptr, nullptr}, loop_{nullptr}
+	{}
+
+	~LetTree() override;
+
+	std::string const& name() const;
+	// The body is given once parsed, since the references to the name in it point to the let.
+	void set_body(ExprNode);
+
+	void prepare_array(ArrayLoop&, llvm::Module&, llvm::IRBuilder<>&) override;
+
+	private:
+	ExprNode* child_(std::size_t) override;
+	void print_(std::ostream&, std::size_t) override;
+	bool node_is_array_() const override;
+	NumericType node_numeric_type_() const override;
+	ExprTree* operand_(std::size_t, bool) override;
+	void operand_generated_(std::size_t, CheckedValue const&) override;
+	llvm::Value* codegen_(llvm::Module&, llvm::IRBuilder<>&, llvm::Value* const*) override;
+	llvm::Value* codegen_integer_(llvm::Module&, llvm::IRBuilder<>&, llvm::Value* const*) override;
+
+	// False if the value is an array which is not computed in the loop of the let.
+	bool computes_value_() const;
+
+	std::string name_;
+	ExprNode value_;
+	ExprNode body_;
+	// Value computed by the code being generated, and loop of the let if it is an array.
+	CheckedValue code_;
+	ArrayLoop* loop_;
+};
+
+class LocalTree : public ExprTree
+{
+	public:
+	LocalTree(std::string label, LetTree* let) : ExprTree{TreeType::local}, label_{std::move(label)}, let_{let}
+	{
+		assert(let_);
+	}
+
+	void prepare_array(ArrayLoop&, llvm::Module&, llvm::IRBuilder<>&) override;
+
+	private:
+	void print_(std::ostream&, std::size_t) override;
+	bool node_is_array_() const override;
+	NumericType node_numeric_type_() const override;
+	ExprTree* operand_(std::size_t, bool) override;
+	llvm::Value* codegen_(llvm::Module&, llvm::IRBuilder<>&, llvm::Value* const*) override;
+	llvm::Value* codegen_integer_(llvm::Module&, llvm::IRBuilder<>&, llvm::Value* const*) override;
+
+	// Array values used outside of the loop of their let are computed again.
+	bool substituted_() const;
+
+	std::string label_;
+	LetTree* let_;
+};
+
+// if(condition, then, else). Small branches without side effects are both computed, and their
+// results selected without branching. Array conditions select between the elements of both branches.
+class ConditionTree : public ExprTree
+{
+	public:
+	ConditionTree(ExprNode condition, ExprNode then, ExprNode otherwise)
+		: ExprTree{TreeType::condition}, condition_{std::move(condition)}, then_{std::move(then)},
+		  else_{std::move(otherwise)}
+	{}
+
+	~ConditionTree() override;
+
+	void prepare_array(ArrayLoop&, llvm::Module&, llvm::IRBuilder<>&) override;
+
+	private:
+	ExprNode* child_(std::size_t) override;
+	void print_(std::ostream&, std::size_t) override;
+	bool node_is_array_() const override;
+	NumericType node_numeric_type_() const override;
+	ExprTree* operand_(std::size_t, bool) override;
+	llvm::Value* codegen_(llvm::Module&, llvm::IRBuilder<>&, llvm::Value* const*) override;
+	llvm::Value* codegen_integer_(llvm::Module&, llvm::IRBuilder<>&, llvm::Value* const*) override;
+
+	bool selected_() const;
+	llvm::Value* codegen_branches_(llvm::Module&, llvm::IRBuilder<>&, llvm::Value*, bool integer);
+
+	ExprNode condition_;
+	ExprNode then_;
+	ExprNode else_;
+};
+
+// Loops are computed on numbers. Their value is the value of the body in the last iteration, 0 if
+// the body is never computed, or nan if the loop is stopped after too many iterations.
+class WhileTree : public ExprTree
+{
+	public:
+	WhileTree(ExprNode condition, ExprNode body)
+		: ExprTree{TreeType::while_loop}, condition_{std::move(condition)}, body_{std::move(body)}
+	{}
+
+	~WhileTree() override;
+
+	private:
+	ExprNode* child_(std::size_t) override;
+	void print_(std::ostream&, std::size_t) override;
+	llvm::Value* codegen_(llvm::Module&, llvm::IRBuilder<>&, llvm::Value* const*) override;
+
+	ExprNode condition_;
+	ExprNode body_;
+};
+
+// for(variable, first, last, body) assigns first, first + 1, ... up to last to the variable, and
+// computes the body after each assignment.
+class ForTree : public ExprTree
+{
+	public:
+	// The parser checks that the variable is an identifier.
+	ForTree(ExprNode variable, ExprNode first, ExprNode last, ExprNode body)
+		: ExprTree{TreeType::for_loop}, variable_{std::move(variable)}, first_{std::move(first)},
+		  last_{std::move(last)}, body_{std::move(body)}
+	{
+		assert(variable_->type == TreeType::identifier);
+	}
+
+	~ForTree() override;
+
+	private:
+	ExprNode* child_(std::size_t) override;
+	std::string const* assigned_variable_() const override;
+	void print_(std::ostream&, std::size_t) override;
+	ExprTree* operand_(std::size_t, bool) override;
+	llvm::Value* codegen_(llvm::Module&, llvm::IRBuilder<>&, llvm::Value* const*) override;
+
+	ExprNode variable_;
+	ExprNode first_;
+	ExprNode last_;
+	ExprNode body_;
+};
+
 #endif // Header guard
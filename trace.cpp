@@ -0,0 +1,185 @@
+// Copyright 2015 Benoît Vey
+
+#include "trace.hpp"
+
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <cstdint>
+#include <sstream>
+#include <vector>
+
+#include "random.hpp"
+#include "session.hpp"
+#include "utility.hpp"
+
+namespace
+{
+
+std::size_t const reported_lines{5};
+
+using milliseconds = std::chrono::duration<double, std::milli>;
+
+struct TracedLine
+{
+	std::array<std::chrono::nanoseconds, 4> timings;
+	std::uint64_t hash;
+	std::string input;
+};
+
+std::array<char const*, 4> const phase_names{{"parse", "compile", "run", "total"}};
+
+std::array<std::chrono::nanoseconds, 4> phases(LineTimings const& timings)
+{
+	return {{timings.parse, timings.compile, timings.run, timings.total}};
+}
+
+// FNV-1a, enough to tell whether the output of a line changed.
+std::uint64_t hash_output(std::string const& text)
+{
+	std::uint64_t hash{0xcbf29ce484222325};
+	for (unsigned char elem : text)
+		hash = (hash ^ elem) * 0x100000001b3;
+	return hash;
+}
+
+// The output of these commands reports times and sizes, which change from one run to the other.
+std::array<char const*, 4> const measuring_commands{{"bench", "montecarlo", "mem", "profile"}};
+
+bool is_measurement(std::string const& input)
+{
+	auto begin = input.find_first_not_of(" \t");
+	if (begin == std::string::npos || input[begin] != '!')
+		return false;
+	auto name = input.substr(begin + 1, input.find_first_of(" \t", begin) - begin - 1);
+	return std::find(std::begin(measuring_commands), std::end(measuring_commands), name) !=
+	       std::end(measuring_commands);
+}
+
+std::vector<TracedLine> read_trace(std::string const& path, std::uint64_t& seed)
+{
+	std::ifstream file{path};
+	if (!file)
+		throw InvalidInput{"Cannot open " + path};
+	std::string header;
+	std::getline(file, header);
+	std::istringstream header_stream{header};
+	std::string word;
+	if (!(header_stream >> word >> seed) || word != "seed")
+		throw InvalidInput{path + ":1 : Expected the seed of the trace"};
+	std::vector<TracedLine> lines;
+	std::string line;
+	for (std::size_t number{2} ; std::getline(file, line) ; ++number)
+	{
+		auto tab = line.find('\t');
+		std::istringstream fields{line.substr(0, tab)};
+		TracedLine traced{};
+		for (auto& elem : traced.timings)
+		{
+			std::int64_t count{};
+			fields >> count;
+			elem = std::chrono::nanoseconds{count};
+		}
+		fields >> std::hex >> traced.hash;
+		if (tab == std::string::npos || !fields)
+			throw InvalidInput{path + ':' + std::to_string(number) + " : Invalid trace line"};
+		traced.input = line.substr(tab + 1);
+		lines.emplace_back(std::move(traced));
+	}
+	return lines;
+}
+
+void write_comparison(std::ostream& os, std::chrono::nanoseconds recorded, std::chrono::nanoseconds replayed)
+{
+	os << milliseconds{recorded}.count() << " ms recorded, " << milliseconds{replayed}.count() << " ms replayed";
+	if (recorded.count() != 0)
+		os << ", x" << static_cast<double>(replayed.count()) / recorded.count();
+}
+
+} // namespace
+
+TraceRecorder::TraceRecorder(std::string const& path) : file_{path}
+{
+	if (!file_)
+		throw InvalidInput{"Cannot create " + path};
+	// The streams of the threads may already have drawn numbers.
+	set_random_seed(random_seed());
+	file_ << "seed " << random_seed() << '\n';
+}
+
+bool TraceRecorder::execute(std::string line, Session& session, std::ostream& os)
+{
+	auto input = line;
+	std::ostringstream line_output;
+	auto keep_going = session.execute(std::move(line), line_output);
+	auto text = line_output.str();
+	os << text;
+	for (auto& elem : phases(session.timings()))
+		file_ << elem.count() << ' ';
+	// Flushed, so that the trace of a session which crashed can be replayed.
+	file_ << std::hex << hash_output(text) << std::dec << '\t' << input << std::endl;
+	return keep_going;
+}
+
+void replay_trace(std::string const& path, Session& session, std::ostream& os)
+{
+	std::uint64_t seed{};
+	auto lines = read_trace(path, seed);
+	set_random_seed(seed);
+
+	std::array<std::chrono::nanoseconds, 4> recorded_total{};
+	std::array<std::chrono::nanoseconds, 4> replayed_total{};
+	// Pairs of a line and its replayed total time.
+	std::vector<std::pair<std::size_t, std::chrono::nanoseconds>> replayed;
+	std::vector<std::size_t> changed_outputs;
+	for (std::size_t i{0} ; i < lines.size() ; ++i)
+	{
+		std::ostringstream line_output;
+		auto keep_going = session.execute(lines[i].input, line_output);
+		auto timings = phases(session.timings());
+		for (std::size_t j{0} ; j < timings.size() ; ++j)
+		{
+			recorded_total[j] += lines[i].timings[j];
+			replayed_total[j] += timings[j];
+		}
+		replayed.emplace_back(i, timings.back());
+		if (!is_measurement(lines[i].input) && hash_output(line_output.str()) != lines[i].hash)
+			changed_outputs.emplace_back(i);
+		if (!keep_going)
+			break;
+	}
+
+	os << "Replayed " << replayed.size() << " lines\n";
+	for (std::size_t i{0} ; i < phase_names.size() ; ++i)
+	{
+		os << phase_names[i] << " : ";
+		write_comparison(os, recorded_total[i], replayed_total[i]);
+		os << '\n';
+	}
+
+	auto slowdown = [&lines](std::pair<std::size_t, std::chrono::nanoseconds> const& line)
+	{
+		return line.second - lines[line.first].timings.back();
+	};
+	std::sort(std::begin(replayed), std::end(replayed), [&slowdown](auto const& lhs, auto const& rhs)
+	{
+		return slowdown(lhs) > slowdown(rhs);
+	});
+	auto slower = std::find_if(std::begin(replayed), std::end(replayed), [&slowdown](auto const& line)
+	{
+		return slowdown(line) <= std::chrono::nanoseconds::zero();
+	});
+	replayed.erase(slower, std::end(replayed));
+	if (replayed.size() > reported_lines)
+		replayed.resize(reported_lines);
+	if (!replayed.empty())
+		os << "Slower lines :\n";
+	for (auto& elem : replayed)
+	{
+		os << "\tline " << elem.first + 1 << " : ";
+		write_comparison(os, lines[elem.first].timings.back(), elem.second);
+		os << " : " << lines[elem.first].input << '\n';
+	}
+	for (auto elem : changed_outputs)
+		os << "Output of line " << elem + 1 << " changed : " << lines[elem].input << '\n';
+}
@@ -0,0 +1,36 @@
+// Copyright 2015 Benoît Vey
+
+#ifndef CALC_TRACE_HPP_
+#define CALC_TRACE_HPP_
+
+#include <fstream>
+#include <iosfwd>
+#include <string>
+
+class Session;
+
+// Traces are text files recording the input of a session, to be replayed as a benchmark. They start
+// with the seed of rand, followed by a line per input line: the time spent on each phase in
+// nanoseconds, a hash of the output, and the input after a tab.
+class TraceRecorder
+{
+	public:
+	// Restarts the streams of rand from the recorded seed. Throws InvalidInput if the file cannot be
+	// created.
+	explicit TraceRecorder(std::string const& path);
+
+	// Executes the line in the session, writes its output to the stream and records it. Returns false
+	// once the line asks to quit.
+	bool execute(std::string, Session&, std::ostream&);
+
+	private:
+	std::ofstream file_;
+};
+
+// Executes the lines of a trace in the session with the recorded seed, and writes to the stream
+// the timings of each phase compared with the recording, and the lines whose timings or output
+// changed the most. The output of the commands measuring times or memory is not compared. Throws
+// InvalidInput if the trace cannot be read.
+void replay_trace(std::string const& path, Session&, std::ostream&);
+
+#endif // Header guard
@@ -5,6 +5,7 @@
 
 #include <algorithm>
 #include <initializer_list>
+#include <iostream>
 #include <string>
 
 class InvalidInput : public std::exception
@@ -34,4 +35,21 @@ bool is_in(T const& v, std::initializer_list<T> const& vs)
 	return std::find(std::begin(vs), std::end(vs), v) != std::end(vs);
 }
 
+// Messages are written to the output of the session running on the current thread.
+inline std::ostream*& output_stream()
+{
+	thread_local std::ostream* os{&std::cout};
+	return os;
+}
+
+inline std::ostream& output()
+{
+	return *output_stream();
+}
+
+inline void set_output(std::ostream& os)
+{
+	output_stream() = &os;
+}
+
 #endif // Header guard
@@ -0,0 +1,150 @@
+// Copyright 2015 Benoît Vey
+
+#include "watchdog.hpp"
+
+#include <string>
+
+#include "utility.hpp"
+
+namespace
+{
+
+thread_local Watchdog* current{nullptr};
+thread_local std::chrono::milliseconds limit{0};
+thread_local bool polls{true};
+
+std::atomic<std::chrono::milliseconds::rep> default_limit{0};
+
+} // namespace
+
+Watchdog::Watchdog() : cancelled_{false}, expired_{false}, exhausted_{false}, deadline_{}, limit_{0}
+{}
+
+void Watchdog::start()
+{
+	cancelled_ = false;
+	expired_ = false;
+	exhausted_ = false;
+	limit_ = limit;
+	deadline_ = limit_.count() == 0 ? clock::time_point::max() : clock::now() + limit_;
+	current = this;
+}
+
+void Watchdog::stop()
+{
+	current = nullptr;
+}
+
+void Watchdog::cancel()
+{
+	cancelled_ = true;
+}
+
+// The deadline does not change while the code runs, so the threads can read it without locking.
+bool Watchdog::interrupted()
+{
+	if (cancelled_ || expired_ || exhausted_)
+		return true;
+	if (clock::now() < deadline_)
+		return false;
+	expired_ = true;
+	return true;
+}
+
+void Watchdog::exhaust()
+{
+	exhausted_ = true;
+}
+
+void Watchdog::check() const
+{
+	if (cancelled_)
+		throw InvalidInput{"Evaluation cancelled"};
+	if (exhausted_)
+		throw InvalidInput{"Loop stopped after " + std::to_string(max_loop_iterations) + " iterations"};
+	if (expired_)
+		throw InvalidInput{"Evaluation stopped after the time limit of " + std::to_string(limit_.count()) + " ms"};
+}
+
+Watchdog* current_watchdog()
+{
+	return current;
+}
+
+void set_current_watchdog(Watchdog* watchdog)
+{
+	current = watchdog;
+}
+
+void check_watchdog()
+{
+	if (current)
+		current->check();
+}
+
+std::chrono::milliseconds time_limit()
+{
+	return limit;
+}
+
+void set_time_limit(std::chrono::milliseconds new_limit)
+{
+	limit = new_limit;
+}
+
+std::chrono::milliseconds default_time_limit()
+{
+	return std::chrono::milliseconds{default_limit.load()};
+}
+
+void set_default_time_limit(std::chrono::milliseconds new_limit)
+{
+	default_limit = new_limit.count();
+}
+
+bool polls_enabled()
+{
+	return polls;
+}
+
+void set_polls_enabled(bool enabled)
+{
+	polls = enabled;
+}
+
+llvm::Value* codegen_poll(llvm::Module& main, llvm::IRBuilder<>& builder)
+{
+	if (!polls)
+		return builder.getFalse();
+	auto fn = main.getFunction("calcrt_poll");
+	if (!fn)
+	{
+		auto fn_type = llvm::FunctionType::get(builder.getInt8Ty(), {}, false);
+		fn = llvm::Function::Create(fn_type, llvm::Function::ExternalLinkage, "calcrt_poll", &main);
+	}
+	return builder.CreateICmpNE(builder.CreateCall(fn, {}), builder.getInt8(0), "interrupted");
+}
+
+void codegen_loop_limit(llvm::Module& main, llvm::IRBuilder<>& builder)
+{
+	if (!polls)
+		return;
+	auto fn = main.getFunction("calcrt_loop_limit");
+	if (!fn)
+	{
+		auto fn_type = llvm::FunctionType::get(builder.getVoidTy(), {}, false);
+		fn = llvm::Function::Create(fn_type, llvm::Function::ExternalLinkage, "calcrt_loop_limit", &main);
+	}
+	builder.CreateCall(fn, {});
+}
+
+extern "C" bool calcrt_poll()
+{
+	return current && current->interrupted();
+}
+
+extern "C" void calcrt_loop_limit()
+{
+	if (current)
+		current->exhaust();
+}
@@ -0,0 +1,89 @@
+// Copyright 2015 Benoît Vey
+
+#ifndef CALC_WATCHDOG_HPP_
+#define CALC_WATCHDOG_HPP_
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+
+#include <llvm/IR/IRBuilder.h>
+#include <llvm/IR/Module.h>
+
+// Loops poll the watchdog once every that many iterations.
+std::uint64_t const poll_iterations{std::uint64_t{1} << 14};
+// Loops stop the code with an error after that many iterations.
+std::uint64_t const max_loop_iterations{std::uint64_t{1} << 32};
+
+// Interrupts the compiled code run for a session. The loops of the code poll the watchdog of their
+// thread, and exit early once it is cancelled or past its deadline. Calls are not polled since
+// functions cannot be recursive, so the code stops within a few thousand iterations of a loop.
+class Watchdog
+{
+	public:
+	Watchdog();
+
+	Watchdog(Watchdog const&) = delete;
+	Watchdog& operator=(Watchdog const&) = delete;
+
+	Watchdog(Watchdog&&) = delete;
+	Watchdog& operator=(Watchdog&&) = delete;
+
+	// Watches the code run by the current thread until stop, for at most the time limit of the
+	// thread.
+	void start();
+	void stop();
+
+	// Can be called from any thread, and from signal handlers.
+	void cancel();
+
+	// Called by the polls.
+	bool interrupted();
+	// Called by the loops reaching max_loop_iterations.
+	void exhaust();
+
+	// Throws InvalidInput if the code was interrupted since start.
+	void check() const;
+
+	private:
+	using clock = std::chrono::steady_clock;
+
+	std::atomic<bool> cancelled_;
+	std::atomic<bool> expired_;
+	std::atomic<bool> exhausted_;
+	clock::time_point deadline_;
+	std::chrono::milliseconds limit_;
+};
+
+// Watchdog of the current thread, or nullptr. The threads running the code of a session in parallel
+// watch the watchdog of the session.
+Watchdog* current_watchdog();
+void set_current_watchdog(Watchdog*);
+
+// Throws InvalidInput if the code run by the current thread was interrupted.
+void check_watchdog();
+
+// Time the lines of the current thread can run, or zero without limit. The default is the limit of
+// the new sessions.
+std::chrono::milliseconds time_limit();
+void set_time_limit(std::chrono::milliseconds);
+std::chrono::milliseconds default_time_limit();
+void set_default_time_limit(std::chrono::milliseconds);
+
+// Code generated by the current thread without polls cannot be interrupted, but does not depend on
+// the program. Polls are enabled by default.
+bool polls_enabled();
+void set_polls_enabled(bool);
+
+// Returns true once the watchdog of the thread running the code is interrupted, or false when polls
+// are disabled.
+llvm::Value* codegen_poll(llvm::Module&, llvm::IRBuilder<>&);
+// Exhausts the watchdog of the thread running the code, unless polls are disabled. The loops of code
+// run without a watchdog are then nan.
+void codegen_loop_limit(llvm::Module&, llvm::IRBuilder<>&);
+
+// Called by the polls.
+extern "C" bool calcrt_poll();
+extern "C" void calcrt_loop_limit();
+
+#endif // Header guard